@@ -0,0 +1,301 @@
+// microbenchmarks for the growth, meshing and math hot paths. Results are
+// written one JSON object per line so runs can be compared by script
+#include "forest.h"
+#include "image.h"
+#include "mesh.h"
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// every allocation made by the benchmarked code goes through these, see
+// the --wrap flags for this target in the Makefile
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t n, size_t size);
+void * __real_realloc(void * p, size_t size);
+void __real_free(void * p);
+
+static size_t num_allocs;
+static size_t alloc_bytes;
+
+void * __wrap_malloc(size_t size) {
+    num_allocs++;
+    alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void * __wrap_calloc(size_t n, size_t size) {
+    num_allocs++;
+    alloc_bytes += n * size;
+    return __real_calloc(n, size);
+}
+
+void * __wrap_realloc(void * p, size_t size) {
+    num_allocs++;
+    alloc_bytes += size;
+    return __real_realloc(p, size);
+}
+
+void __wrap_free(void * p) {
+    __real_free(p);
+}
+
+static double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+typedef void (*bench_fn)(void * context);
+
+static double min_time = 0.5;
+static FILE * out;
+
+// runs fn until min_time has passed and reports the cost of one call, and
+// of each of the items that call processed
+static void run(const char * name, size_t segments, size_t items, bench_fn fn, void * context) {
+    // warm up, and make sure lazily grown buffers are at their final size
+    fn(context);
+
+    size_t iterations = 0;
+    num_allocs = 0;
+    alloc_bytes = 0;
+    double start = seconds();
+    double elapsed;
+    do {
+        fn(context);
+        iterations++;
+        elapsed = seconds() - start;
+    } while (elapsed < min_time);
+
+    double ns_per_op = elapsed * 1e9 / iterations;
+    fprintf(out, "{\"bench\": \"%s\", \"segments\": %zu, \"items\": %zu, \"iterations\": %zu, "
+        "\"ns_per_op\": %.1f, \"ns_per_item\": %.3f, \"bytes_per_op\": %.1f, \"allocs_per_op\": %.3f}\n",
+        name, segments, items, iterations,
+        ns_per_op, ns_per_op / (items ? items : 1),
+        (double)alloc_bytes / iterations, (double)num_allocs / iterations);
+    fflush(out);
+}
+
+typedef struct {
+    forest_t * forest;
+    pool_t * pool;
+    mesh_t mesh;
+    vec_path_t children;
+    vec_float rates;
+    // inputs for the per call math benches
+    vec_vec3s a;
+    vec_vec3s b;
+    mat4s m;
+    vec3s sink;
+} context_t;
+
+static void bench_radial_growth(void * context) {
+    context_t * c = context;
+    forest_t * forest = c->forest;
+    radial_growth(&forest->paths, vec_float_data(&c->rates), 0, paths_size(&forest->paths));
+}
+
+// new_paths reads the tips from next_tips and only writes the children and
+// flags, so it can be run repeatedly over the same tips
+static void bench_new_paths(void * context) {
+    context_t * c = context;
+    forest_t * forest = c->forest;
+    vec_path_t_clear(&c->children);
+    new_paths(forest->seed, &forest->paths, &forest->trees, &forest->grid,
+        &forest->light, 0, vec_size_t_size(&forest->paths.next_tips), &c->children);
+}
+
+// from scratch, rather than just the segments added since the last call
+static void bench_new_geometry(void * context) {
+    context_t * c = context;
+    mesh_clear(&c->mesh);
+    new_geometry(c->forest, &c->mesh);
+}
+
+// over the rings left by the new_geometry bench
+static void bench_lod_build(void * context) {
+    context_t * c = context;
+    forest_t * forest = c->forest;
+    lod_build(&forest->lod, &forest->paths, vec_tree_t_size(&forest->trees), &c->mesh);
+}
+
+// a single branch, each segment continuing from the last
+static void bench_add_segment(void * context) {
+    context_t * c = context;
+    mesh_clear(&c->mesh);
+    size_t n = vec_vec3s_size(&c->a);
+    for (size_t i = 0; i < n; i++) {
+        mat4s m1 = c->m;
+        m1.col[3] = glms_vec4(*vec_vec3s_at(&c->a, i), 1.0f);
+        if (i == 0) {
+            mesh_add_root_segment(&c->mesh, 0, c->m, m1);
+        } else {
+            mesh_add_segment(&c->mesh, 0, i - 1, m1);
+        }
+    }
+}
+
+static void bench_add_leaves(void * context) {
+    context_t * c = context;
+    mesh_clear(&c->mesh);
+    size_t n = vec_vec3s_size(&c->a);
+    for (size_t i = 0; i < n; i++) {
+        mat4s m = c->m;
+        m.col[3] = glms_vec4(*vec_vec3s_at(&c->a, i), 1.0f);
+        mesh_add_leaves(&c->mesh, 0, 0, m, 0.01f, 1.0f);
+    }
+}
+
+static void bench_axes_from_dir_up(void * context) {
+    context_t * c = context;
+    size_t n = vec_vec3s_size(&c->a);
+    vec3s sum = c->sink;
+    for (size_t i = 0; i < n; i++) {
+        vec3s x, y, z;
+        axes_from_dir_up(*vec_vec3s_at(&c->a, i), *vec_vec3s_at(&c->b, i), &x, &y, &z);
+        sum = glms_vec3_add(sum, glms_vec3_add(x, glms_vec3_add(y, z)));
+    }
+    c->sink = sum;
+}
+
+static void bench_transform(void * context) {
+    context_t * c = context;
+    size_t n = vec_vec3s_size(&c->a);
+    vec3s sum = c->sink;
+    for (size_t i = 0; i < n; i++) {
+        sum = glms_vec3_add(sum, transform(c->m, *vec_vec3s_at(&c->a, i)));
+    }
+    c->sink = sum;
+}
+
+typedef struct {
+    size_t dim;
+    vec_uint8_t source;
+    vec_uint8_t output;
+} mip_context_t;
+
+static void bench_mip_chain(void * context) {
+    mip_context_t * c = context;
+    mip_chain(c->dim, vec_uint8_t_data(&c->source), &c->output);
+}
+
+static void usage(const char * name) {
+    fprintf(stderr,
+        "usage: %s [-s min] [-e max] [-t seconds] [-o file]\n"
+        "  -s  smallest size as a power of ten (default 3)\n"
+        "  -e  largest size as a power of ten (default 6, up to 7)\n"
+        "  -t  minimum time to run each benchmark for (default 0.5)\n"
+        "  -o  write the results to file rather than stdout\n",
+        name);
+}
+
+int main(int argc, char ** argv) {
+    int min_exponent = 3;
+    int max_exponent = 6;
+    out = stdout;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:e:t:o:")) != -1) {
+        switch (opt) {
+        case 's':
+            min_exponent = atoi(optarg);
+            break;
+        case 'e':
+            max_exponent = atoi(optarg);
+            break;
+        case 't':
+            min_time = atof(optarg);
+            break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if (!out) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    const char * threads = getenv("TREE_THREADS");
+    pool_t * pool = pool_init(threads ? atoi(threads) : 0);
+
+    size_t size = 1;
+    for (int e = 0; e < min_exponent; e++) {
+        size *= 10;
+    }
+    for (int e = min_exponent; e <= max_exponent; e++, size *= 10) {
+        // grow a forest to at least the target size from a fixed seed
+        forest_t forest = forest_init(16, 1, pool_num_threads(pool) * 4);
+        while (paths_size(&forest.paths) < size) {
+            grow(&forest, pool);
+        }
+        // set up next_tips as grow would before spawning
+        vec_size_t_clear(&forest.paths.next_tips);
+        foreach(vec_size_t, &forest.paths.tips, it) {
+            vec_size_t_push_back(&forest.paths.next_tips, *it.ref);
+        }
+        size_t segments = paths_size(&forest.paths);
+        size_t tips = vec_size_t_size(&forest.paths.tips);
+
+        context_t c = {
+            .forest = &forest,
+            .pool = pool,
+            .mesh = mesh_init(),
+            .children = vec_path_t_init(),
+            .rates = vec_float_init(),
+            .a = vec_vec3s_init(),
+            .b = vec_vec3s_init(),
+            .m = glms_mat4_identity(),
+        };
+        vec_float_resize(&c.rates, vec_tree_t_size(&forest.trees), 0.0001f);
+        rng_t rng = rng_init(1, 0, e);
+        vec_vec3s_resize(&c.a, size, (vec3s){0});
+        vec_vec3s_resize(&c.b, size, (vec3s){0});
+        rng_vecs(&rng, vec_vec3s_data(&c.a), size, 2.0f);
+        rng_vecs(&rng, vec_vec3s_data(&c.b), size, 2.0f);
+
+        run("radial_growth", segments, segments, bench_radial_growth, &c);
+        run("new_paths", segments, tips, bench_new_paths, &c);
+        run("new_geometry", segments, segments, bench_new_geometry, &c);
+        run("lod_build", segments, segments, bench_lod_build, &c);
+        run("add_segment", size, size, bench_add_segment, &c);
+        run("add_leaves", size, size, bench_add_leaves, &c);
+        run("axes_from_dir_up", size, size, bench_axes_from_dir_up, &c);
+        run("transform", size, size, bench_transform, &c);
+
+        // the nearest power of two square texture with about size pixels
+        size_t dim = 1;
+        while (dim * dim * 4 <= size) {
+            dim *= 2;
+        }
+        mip_context_t mc = {
+            .dim = dim,
+            .source = vec_uint8_t_init(),
+            .output = vec_uint8_t_init()
+        };
+        vec_uint8_t_resize(&mc.source, dim * dim * 4, 128);
+        run("mip_chain", size, dim * dim, bench_mip_chain, &mc);
+        vec_uint8_t_free(&mc.source);
+        vec_uint8_t_free(&mc.output);
+
+        vec_vec3s_free(&c.a);
+        vec_vec3s_free(&c.b);
+        vec_path_t_free(&c.children);
+        vec_float_free(&c.rates);
+        mesh_free(&c.mesh);
+        forest_free(&forest);
+    }
+
+    pool_free(&pool);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
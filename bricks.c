@@ -0,0 +1,98 @@
+#include "bricks.h"
+
+#define EMPTY UINT64_MAX
+
+brick_map_t brick_map_init() {
+    return (brick_map_t){
+        .slots = vec_brick_slot_t_init(),
+        .num_bricks = 0
+    };
+}
+
+void brick_map_free(brick_map_t * map) {
+    vec_brick_slot_t_free(&map->slots);
+}
+
+// the slot a key is looked for from
+static size_t home(brick_map_t * map, uint64_t key) {
+    // every axis lands in the low bits the mask keeps
+    uint64_t h = key * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h ^ (h >> 32)) & (vec_brick_slot_t_size(&map->slots) - 1);
+}
+
+// the slot holding key, or the empty slot where it would go. The table is
+// never more than half full, so the probe always ends
+static brick_slot_t * find(brick_map_t * map, uint64_t key) {
+    size_t mask = vec_brick_slot_t_size(&map->slots) - 1;
+    brick_slot_t * slots = vec_brick_slot_t_data(&map->slots);
+    size_t slot = home(map, key);
+    while (slots[slot].key != key && slots[slot].key != EMPTY) {
+        slot = (slot + 1) & mask;
+    }
+    return &slots[slot];
+}
+
+// the bricks stay where they are, only the slots pointing at them move
+static void rehash(brick_map_t * map, size_t capacity) {
+    vec_brick_slot_t old = map->slots;
+    map->slots = vec_brick_slot_t_init();
+    vec_brick_slot_t_resize(&map->slots, capacity, (brick_slot_t){.key = EMPTY, .brick = 0});
+    foreach(vec_brick_slot_t, &old, it) {
+        if (it.ref->key != EMPTY) {
+            *find(map, it.ref->key) = *it.ref;
+        }
+    }
+    vec_brick_slot_t_free(&old);
+}
+
+size_t brick_map_find(brick_map_t * map, uint64_t key) {
+    if (map->num_bricks == 0) {
+        return NO_BRICK;
+    }
+    brick_slot_t * slot = find(map, key);
+    return slot->key == EMPTY ? NO_BRICK : slot->brick;
+}
+
+size_t brick_map_add(brick_map_t * map, uint64_t key) {
+    size_t capacity = vec_brick_slot_t_size(&map->slots);
+    if ((map->num_bricks + 1) * 2 > capacity) {
+        rehash(map, capacity ? capacity * 2 : 256);
+    }
+    *find(map, key) = (brick_slot_t){.key = key, .brick = map->num_bricks};
+    return map->num_bricks++;
+}
+
+void brick_map_remove(brick_map_t * map, uint64_t key, uint64_t last_key) {
+    size_t mask = vec_brick_slot_t_size(&map->slots) - 1;
+    brick_slot_t * slots = vec_brick_slot_t_data(&map->slots);
+    brick_slot_t * slot = find(map, key);
+    size_t brick = slot->brick;
+    // close the gap by moving back any later key of the run that would no
+    // longer be found past it
+    size_t gap = slot - slots;
+    for (size_t s = (gap + 1) & mask; slots[s].key != EMPTY; s = (s + 1) & mask) {
+        size_t h = home(map, slots[s].key);
+        bool stays = gap <= s ? gap < h && h <= s : gap < h || h <= s;
+        if (!stays) {
+            slots[gap] = slots[s];
+            gap = s;
+        }
+    }
+    slots[gap].key = EMPTY;
+    map->num_bricks--;
+    if (last_key != key) {
+        find(map, last_key)->brick = brick;
+    }
+}
+
+void brick_map_reset(brick_map_t * map, size_t num_bricks) {
+    size_t capacity = 256;
+    while (num_bricks * 2 > capacity) {
+        capacity *= 2;
+    }
+    vec_brick_slot_t_resize(&map->slots, capacity, (brick_slot_t){.key = EMPTY, .brick = 0});
+    foreach(vec_brick_slot_t, &map->slots, it) {
+        it.ref->key = EMPTY;
+    }
+    map->num_bricks = 0;
+}
@@ -0,0 +1,71 @@
+#ifndef BRICKS_H
+#define BRICKS_H
+
+#include "vectors.h"
+
+// cells of a sparse grid are stored in cubic bricks of BRICK cells a side, so
+// that looking at the neighbours of a cell usually stays in one brick
+#define BRICK_BITS 2
+#define BRICK (1 << BRICK_BITS)
+#define BRICK_CELLS (BRICK * BRICK * BRICK)
+// what brick_map_find returns for a brick that isn't there
+#define NO_BRICK SIZE_MAX
+
+typedef struct {
+    uint64_t key;
+    size_t brick;
+} brick_slot_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T brick_slot_t
+#include <ctl/vector.h>
+
+// which of its owner's bricks holds a key, found through an open addressed
+// hash table so that adding, removing and looking up a brick cost the same
+// however many there are. The owner keeps the bricks in a vector, numbered as
+// they were added, and moves them as the map says. Lookups don't write, so
+// any number of threads may look up while nothing is being changed
+typedef struct {
+    vec_brick_slot_t slots;
+    size_t num_bricks;
+} brick_map_t;
+
+brick_map_t brick_map_init();
+
+void brick_map_free(brick_map_t * map);
+
+// 21 bits per axis of brick coordinates, +-200 km even in 5 cm cells
+#define BRICK_AXIS_BITS 21
+#define BRICK_AXIS_BIAS (1 << (BRICK_AXIS_BITS - 1))
+#define BRICK_AXIS_MASK ((1 << BRICK_AXIS_BITS) - 1)
+
+// the key of the brick holding cell (x, y, z). Inline, as casting shade calls
+// these for every voxel it touches
+static inline uint64_t brick_key(int64_t x, int64_t y, int64_t z) {
+    return ((uint64_t)(((x >> BRICK_BITS) + BRICK_AXIS_BIAS) & BRICK_AXIS_MASK) << (2 * BRICK_AXIS_BITS)) |
+        ((uint64_t)(((y >> BRICK_BITS) + BRICK_AXIS_BIAS) & BRICK_AXIS_MASK) << BRICK_AXIS_BITS) |
+        (uint64_t)(((z >> BRICK_BITS) + BRICK_AXIS_BIAS) & BRICK_AXIS_MASK);
+}
+
+// where cell (x, y, z) lies in its brick
+static inline size_t brick_cell(int64_t x, int64_t y, int64_t z) {
+    const int64_t mask = BRICK - 1;
+    return (((x & mask) * BRICK) + (y & mask)) * BRICK + (z & mask);
+}
+
+// the number of the brick with key, NO_BRICK if there isn't one
+size_t brick_map_find(brick_map_t * map, uint64_t key);
+
+// numbers a new brick with key after the others, for the owner to append
+size_t brick_map_add(brick_map_t * map, uint64_t key);
+
+// forgets the brick with key. The owner fills the gap with its last brick,
+// which has last_key, as the map now expects
+void brick_map_remove(brick_map_t * map, uint64_t key, uint64_t last_key);
+
+// forgets every brick, leaving room for num_bricks to be added again in order,
+// as after the bricks were filled in directly
+void brick_map_reset(brick_map_t * map, size_t num_bricks);
+
+#endif
@@ -0,0 +1,382 @@
+#include "capture.h"
+#include "vectors.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// stored deflate blocks hold at most this many bytes
+#define STORED_BLOCK 65535
+
+typedef enum {
+    CAPTURE_PNG,
+    CAPTURE_Y4M,
+} capture_format_e;
+
+typedef struct capture_s {
+    capture_format_e format;
+    int width;
+    int height;
+    // a PNG's name is stem, the frame number, then extension
+    char * stem;
+    char * extension;
+    FILE * file;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    // the frames in the ring, slots head .. head + queued are waiting to be
+    // written, and the one after them is the render thread's while acquired
+    uint8_t * slots[CAPTURE_SLOTS];
+    size_t head;
+    size_t queued;
+    bool acquired;
+    bool quit;
+    size_t frames;
+    size_t dropped;
+    // only touched by the encoder thread
+    size_t written;
+    bool failed;
+    vec_uint8_t encoded;
+    vec_uint8_t row;
+    uint32_t crc_table[256];
+} capture_t;
+
+static void put_bytes(vec_uint8_t * out, const void * data, size_t size) {
+    size_t at = vec_uint8_t_size(out);
+    vec_uint8_t_resize(out, at + size, 0);
+    memcpy(vec_uint8_t_data(out) + at, data, size);
+}
+
+static void put_u32(vec_uint8_t * out, uint32_t x) {
+    uint8_t bytes[4] = {x >> 24, x >> 16, x >> 8, x};
+    put_bytes(out, bytes, 4);
+}
+
+static uint32_t crc32(const uint32_t * table, const uint8_t * data, size_t size) {
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+}
+
+// a PNG chunk whose type and data are already at the end of out, from start
+static void end_chunk(capture_t * capture, size_t start) {
+    vec_uint8_t * out = &capture->encoded;
+    uint8_t * chunk = vec_uint8_t_data(out) + start;
+    size_t size = vec_uint8_t_size(out) - start;
+    // the length counts the data, not the type before it
+    uint8_t length[4] = {(size - 4) >> 24, (size - 4) >> 16, (size - 4) >> 8, size - 4};
+    memcpy(chunk - 4, length, 4);
+    put_u32(out, crc32(capture->crc_table, vec_uint8_t_data(out) + start, size));
+}
+
+static size_t begin_chunk(vec_uint8_t * out, const char * type) {
+    put_u32(out, 0);
+    size_t start = vec_uint8_t_size(out);
+    put_bytes(out, type, 4);
+    return start;
+}
+
+// an RGB PNG of the frame. The image data is left uncompressed, in stored
+// deflate blocks, which costs disk rather than the time of the encoder
+static void encode_png(capture_t * capture, const uint8_t * pixels) {
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    vec_uint8_t * out = &capture->encoded;
+    vec_uint8_t_clear(out);
+    put_bytes(out, signature, 8);
+
+    size_t start = begin_chunk(out, "IHDR");
+    put_u32(out, capture->width);
+    put_u32(out, capture->height);
+    // 8 bits, RGB, default compression, filter and no interlace
+    uint8_t header[5] = {8, 2, 0, 0, 0};
+    put_bytes(out, header, 5);
+    end_chunk(capture, start);
+
+    start = begin_chunk(out, "IDAT");
+    uint8_t zlib_header[2] = {0x78, 0x01};
+    put_bytes(out, zlib_header, 2);
+    // each row is its filter, none, then its pixels without alpha
+    size_t row_size = 1 + capture->width * 3;
+    size_t raw_size = row_size * capture->height;
+    uint32_t a = 1;
+    uint32_t b = 0;
+    vec_uint8_t_resize(&capture->row, row_size, 0);
+    uint8_t * row = vec_uint8_t_data(&capture->row);
+    size_t done = 0;
+    size_t block_left = 0;
+    for (int y = 0; y < capture->height; y++) {
+        row[0] = 0;
+        const uint8_t * src = pixels + (size_t)y * capture->width * 4;
+        for (int x = 0; x < capture->width; x++) {
+            memcpy(row + 1 + x * 3, src + x * 4, 3);
+        }
+        for (size_t i = 0; i < row_size; i++) {
+            a = (a + row[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        for (size_t at = 0; at < row_size;) {
+            if (block_left == 0) {
+                size_t size = raw_size - done < STORED_BLOCK ? raw_size - done : STORED_BLOCK;
+                uint8_t block[5] = {done + size == raw_size, size, size >> 8, ~size, ~size >> 8};
+                put_bytes(out, block, 5);
+                block_left = size;
+            }
+            size_t n = row_size - at < block_left ? row_size - at : block_left;
+            put_bytes(out, row + at, n);
+            at += n;
+            done += n;
+            block_left -= n;
+        }
+    }
+    put_u32(out, b << 16 | a);
+    end_chunk(capture, start);
+
+    start = begin_chunk(out, "IEND");
+    end_chunk(capture, start);
+}
+
+// BT.601 studio range, chroma averaged over each 2 by 2 block of pixels
+static void encode_y4m(capture_t * capture, const uint8_t * pixels) {
+    vec_uint8_t * out = &capture->encoded;
+    int w = capture->width;
+    int h = capture->height;
+    int cw = (w + 1) / 2;
+    int ch = (h + 1) / 2;
+    vec_uint8_t_clear(out);
+    put_bytes(out, "FRAME\n", 6);
+    size_t at = vec_uint8_t_size(out);
+    vec_uint8_t_resize(out, at + (size_t)w * h + 2 * (size_t)cw * ch, 0);
+    uint8_t * luma = vec_uint8_t_data(out) + at;
+    uint8_t * cb = luma + (size_t)w * h;
+    uint8_t * cr = cb + (size_t)cw * ch;
+    for (int y = 0; y < h; y++) {
+        const uint8_t * p = pixels + (size_t)y * w * 4;
+        for (int x = 0; x < w; x++, p += 4) {
+            luma[(size_t)y * w + x] = ((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16;
+        }
+    }
+    for (int y = 0; y < ch; y++) {
+        for (int x = 0; x < cw; x++) {
+            int sum[3] = {0};
+            int n = 0;
+            for (int dy = 0; dy < 2 && y * 2 + dy < h; dy++) {
+                for (int dx = 0; dx < 2 && x * 2 + dx < w; dx++) {
+                    const uint8_t * p = pixels + ((size_t)(y * 2 + dy) * w + x * 2 + dx) * 4;
+                    for (int k = 0; k < 3; k++) {
+                        sum[k] += p[k];
+                    }
+                    n++;
+                }
+            }
+            int r = sum[0] / n;
+            int g = sum[1] / n;
+            int b = sum[2] / n;
+            cb[(size_t)y * cw + x] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+            cr[(size_t)y * cw + x] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+        }
+    }
+}
+
+static void write_frame(capture_t * capture, const uint8_t * pixels) {
+    if (capture->failed) {
+        return;
+    }
+    FILE * file = capture->file;
+    char * filename = NULL;
+    if (capture->format == CAPTURE_PNG) {
+        encode_png(capture, pixels);
+        size_t size = strlen(capture->stem) + strlen(capture->extension) + 32;
+        filename = malloc(size);
+        snprintf(filename, size, "%s_%05zu%s", capture->stem, capture->written,
+            capture->extension);
+        file = fopen(filename, "wb");
+        if (!file) {
+            perror(filename);
+            capture->failed = true;
+            free(filename);
+            return;
+        }
+    } else {
+        encode_y4m(capture, pixels);
+    }
+    size_t size = vec_uint8_t_size(&capture->encoded);
+    bool ok = fwrite(vec_uint8_t_data(&capture->encoded), 1, size, file) == size;
+    if (filename) {
+        ok = fclose(file) == 0 && ok;
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: failed writing frame %zu\n", filename ? filename : capture->stem,
+            capture->written);
+        capture->failed = true;
+    }
+    free(filename);
+    capture->written++;
+}
+
+static void * run(void * arg) {
+    capture_t * capture = arg;
+    pthread_mutex_lock(&capture->mutex);
+    while (true) {
+        while (!capture->quit && capture->queued == 0) {
+            pthread_cond_wait(&capture->changed, &capture->mutex);
+        }
+        if (capture->queued == 0) {
+            break;
+        }
+        uint8_t * pixels = capture->slots[capture->head];
+        pthread_mutex_unlock(&capture->mutex);
+
+        write_frame(capture, pixels);
+
+        pthread_mutex_lock(&capture->mutex);
+        capture->head = (capture->head + 1) % CAPTURE_SLOTS;
+        capture->queued--;
+        pthread_cond_broadcast(&capture->changed);
+    }
+    pthread_mutex_unlock(&capture->mutex);
+    return NULL;
+}
+
+static bool ends_with(const char * s, const char * suffix) {
+    size_t n = strlen(s);
+    size_t m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+capture_t * capture_init(const char * filename, int width, int height, int fps) {
+    capture_t * capture = malloc(sizeof(capture_t));
+    *capture = (capture_t){
+        .format = ends_with(filename, ".y4m") ? CAPTURE_Y4M : CAPTURE_PNG,
+        .width = width,
+        .height = height,
+        .stem = strdup(filename),
+        .encoded = vec_uint8_t_init(),
+        .row = vec_uint8_t_init(),
+    };
+    if (capture->format == CAPTURE_Y4M) {
+        capture->file = fopen(filename, "wb");
+        if (!capture->file) {
+            perror(filename);
+            free(capture->stem);
+            free(capture);
+            return NULL;
+        }
+        fprintf(capture->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+    } else {
+        // the extension is kept apart from the stem to put the number between
+        char * dot = strrchr(capture->stem, '.');
+        char * slash = strrchr(capture->stem, '/');
+        if (dot && (!slash || dot > slash)) {
+            capture->extension = strdup(dot);
+            *dot = '\0';
+        } else {
+            capture->extension = strdup(".png");
+        }
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        capture->crc_table[i] = c;
+    }
+    for (int i = 0; i < CAPTURE_SLOTS; i++) {
+        capture->slots[i] = malloc((size_t)width * height * 4);
+    }
+    pthread_mutex_init(&capture->mutex, NULL);
+    pthread_cond_init(&capture->changed, NULL);
+    pthread_create(&capture->thread, NULL, run, capture);
+    return capture;
+}
+
+bool capture_free(capture_t ** capture) {
+    bool ok = true;
+    if (*capture) {
+        capture_t * c = *capture;
+        pthread_mutex_lock(&c->mutex);
+        c->quit = true;
+        pthread_cond_broadcast(&c->changed);
+        pthread_mutex_unlock(&c->mutex);
+        pthread_join(c->thread, NULL);
+        pthread_cond_destroy(&c->changed);
+        pthread_mutex_destroy(&c->mutex);
+        ok = !c->failed;
+        if (c->file && fclose(c->file) != 0) {
+            perror(c->stem);
+            ok = false;
+        }
+        for (int i = 0; i < CAPTURE_SLOTS; i++) {
+            free(c->slots[i]);
+        }
+        vec_uint8_t_free(&c->encoded);
+        vec_uint8_t_free(&c->row);
+        free(c->stem);
+        free(c->extension);
+        free(c);
+        *capture = NULL;
+    }
+    return ok;
+}
+
+int capture_width(capture_t * capture) {
+    return capture->width;
+}
+
+int capture_height(capture_t * capture) {
+    return capture->height;
+}
+
+uint8_t * capture_acquire(capture_t * capture) {
+    uint8_t * slot = NULL;
+    pthread_mutex_lock(&capture->mutex);
+    if (capture->queued < CAPTURE_SLOTS) {
+        capture->acquired = true;
+        slot = capture->slots[(capture->head + capture->queued) % CAPTURE_SLOTS];
+    } else {
+        capture->dropped++;
+    }
+    pthread_mutex_unlock(&capture->mutex);
+    return slot;
+}
+
+void capture_submit(capture_t * capture) {
+    pthread_mutex_lock(&capture->mutex);
+    if (capture->acquired) {
+        capture->acquired = false;
+        capture->queued++;
+        capture->frames++;
+        pthread_cond_broadcast(&capture->changed);
+    }
+    pthread_mutex_unlock(&capture->mutex);
+}
+
+void capture_drop(capture_t * capture) {
+    pthread_mutex_lock(&capture->mutex);
+    capture->dropped++;
+    pthread_mutex_unlock(&capture->mutex);
+}
+
+void capture_wait(capture_t * capture) {
+    pthread_mutex_lock(&capture->mutex);
+    while (capture->queued == CAPTURE_SLOTS) {
+        pthread_cond_wait(&capture->changed, &capture->mutex);
+    }
+    pthread_mutex_unlock(&capture->mutex);
+}
+
+size_t capture_frames(capture_t * capture) {
+    pthread_mutex_lock(&capture->mutex);
+    size_t frames = capture->frames;
+    pthread_mutex_unlock(&capture->mutex);
+    return frames;
+}
+
+size_t capture_dropped(capture_t * capture) {
+    pthread_mutex_lock(&capture->mutex);
+    size_t dropped = capture->dropped;
+    pthread_mutex_unlock(&capture->mutex);
+    return dropped;
+}
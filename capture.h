@@ -0,0 +1,50 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// writes frames on a thread of its own, so whoever renders them never waits
+// on the encoding or the disk. Frames are queued in a ring of CAPTURE_SLOTS
+// and written in order, either as a raw Y4M stream or as a PNG sequence
+typedef struct capture_s capture_t;
+
+#define CAPTURE_SLOTS 4
+
+// frames of width by height go to filename, as a 4:2:0 Y4M stream at fps
+// frames a second if it ends in .y4m. Otherwise each frame is a PNG, named
+// from filename with the frame number inserted before the extension, so
+// frames.png gives frames_00000.png, frames_00001.png and so on. NULL if the
+// output can't be opened
+capture_t * capture_init(const char * filename, int width, int height, int fps);
+
+// writes the frames still queued, then stops the thread. Returns false if
+// any frame failed to be written
+bool capture_free(capture_t ** capture);
+
+int capture_width(capture_t * capture);
+
+int capture_height(capture_t * capture);
+
+// a slot for the next frame, width * height RGBA8 pixels, top row first.
+// Never waits: NULL if every slot is still queued, when the frame counts as
+// dropped
+uint8_t * capture_acquire(capture_t * capture);
+
+// queues the slot from capture_acquire to be written
+void capture_submit(capture_t * capture);
+
+// counts a frame that couldn't be captured in time as dropped
+void capture_drop(capture_t * capture);
+
+// waits for a free slot, for rendering offline where a frame is better late
+// than dropped
+void capture_wait(capture_t * capture);
+
+// frames submitted and dropped so far
+size_t capture_frames(capture_t * capture);
+
+size_t capture_dropped(capture_t * capture);
+
+#endif
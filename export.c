@@ -0,0 +1,392 @@
+#include "export.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// vertices and triangles are gathered this many at a time before writing
+#define BATCH 4096
+
+static const char * object_name[MAX_OBJECT_TYPE] = {
+    [GROUND] = "ground",
+    [TREE] = "branches",
+    [LEAF] = "leaves",
+    [SHADOW] = "shadows",
+};
+
+static const char * texture_file[MAX_OBJECT_TYPE] = {
+    [GROUND] = "mud.png",
+    [TREE] = "bark.png",
+    [LEAF] = "leaf.png",
+    [SHADOW] = "contact_shadow.png",
+};
+
+typedef struct {
+    vec3s position;
+    vec3s normal;
+    vec2s uv;
+} export_vertex_t;
+
+// positions are exported in world space, the mesh keeps them relative to the
+// origin of their chunk
+static vec3s dequantise_position(const int16_t * p, vec3s origin) {
+    return (vec3s){origin.x + p[0] / POSITION_SCALE, origin.y + p[1] / POSITION_SCALE,
+        origin.z + p[2] / POSITION_SCALE};
+}
+
+static vec3s dequantise_normal(const int16_t * n) {
+    return oct_decode((vec2s){unsnorm16(n[0]), unsnorm16(n[1])});
+}
+
+static vec3s tree_origin(mesh_t * mesh, size_t tree) {
+    size_t c = tree < vec_size_t_size(&mesh->tree_chunk) ? *vec_size_t_at(&mesh->tree_chunk, tree) : 0;
+    return c < mesh->num_chunks ? mesh->chunks[c].origin : (vec3s){0};
+}
+
+static size_t num_vertices(mesh_t * mesh, object_type_e type) {
+    if (type == LEAF) {
+        return vec_leaf_instance_t_size(&mesh->lods[0].leaves) * LEAF_CLUSTER_VERTICES;
+    }
+    size_t n = 0;
+    for (size_t c = 0; c < mesh->num_chunks; c++) {
+        mesh_chunk_t * chunk = &mesh->chunks[c];
+        if (type != TREE) {
+            n += vec_vertex_t_size(&chunk->vertices[type]);
+        } else if (mesh->instanced) {
+            n += vec_segment_instance_t_size(&chunk->instances) * UNIT_CYLINDER_VERTICES;
+        } else {
+            n += vec_ring_vertex_t_size(&chunk->rings);
+        }
+    }
+    return n;
+}
+
+static size_t num_triangles(mesh_t * mesh, object_type_e type) {
+    return type == TREE && !mesh->instanced ? mesh_num_indices(mesh) / 3 :
+        num_vertices(mesh, type) / 3;
+}
+
+// where the shaders would put ring vertex i of a chunk
+static export_vertex_t ring_vertex(mesh_chunk_t * chunk, size_t i) {
+    ring_vertex_t * r = vec_ring_vertex_t_at(&chunk->rings, i);
+    vec3s d = dequantise_normal(r->direction);
+    float radius = *vec_float_at(&chunk->radii, (size_t)r->segment);
+    int corner = r->centre[3] % 4;
+    return (export_vertex_t){
+        .position = glms_vec3_add(dequantise_position(r->centre, chunk->origin),
+            glms_vec3_scale(d, radius)),
+        .normal = d,
+        .uv = (vec2s){corner * 0.5f, r->centre[3] / 4},
+    };
+}
+
+// where the instanced vertex shader would put corner k of the unit cylinder
+// stretched over a segment
+static export_vertex_t instance_vertex(mesh_chunk_t * chunk, segment_instance_t * s, int k) {
+    const float * corner = unit_cylinder[k];
+    bool far = corner[2] > 0.5f;
+    vec3s x = dequantise_normal(far ? s->x1 : s->x0);
+    vec3s z = dequantise_normal(far ? s->z1 : s->z0);
+    vec3s d = glms_vec3_add(glms_vec3_scale(x, corner[0]), glms_vec3_scale(z, corner[1]));
+    float radius = *vec_float_at(&chunk->radii, (size_t)s->segment[far]);
+    return (export_vertex_t){
+        .position = glms_vec3_add(dequantise_position(far ? s->centre1 : s->centre0,
+            chunk->origin), glms_vec3_scale(d, radius)),
+        .normal = d,
+        .uv = (vec2s){corner[3], corner[2]},
+    };
+}
+
+static export_vertex_t leaf_vertex(leaf_instance_t * l, int k, vec3s origin) {
+    const float * corner = leaf_cluster[k];
+    vec3s x = dequantise_normal(l->x);
+    vec3s z = dequantise_normal(l->z);
+    float px = corner[0] * (l->radius + 0.15f * l->scale) + corner[2] * 0.1f * l->scale;
+    float pz = corner[1] * (l->radius + 0.15f * l->scale) + corner[3] * 0.1f * l->scale;
+    return (export_vertex_t){
+        .position = glms_vec3_add(dequantise_position(l->position, origin),
+            glms_vec3_add(glms_vec3_scale(x, px), glms_vec3_scale(z, pz))),
+        .normal = glms_vec3_cross(z, x),
+        .uv = (vec2s){corner[2], corner[3]},
+    };
+}
+
+static export_vertex_t plain_vertex(mesh_chunk_t * chunk, object_type_e type, size_t i) {
+    vertex_t * v = vec_vertex_t_at(&chunk->vertices[type], i);
+    return (export_vertex_t){
+        .position = dequantise_position(v->position, chunk->origin),
+        .normal = dequantise_normal(v->normal),
+        .uv = (vec2s){unsnorm16(v->texcoord[0]) * TEXCOORD_RANGE,
+            unsnorm16(v->texcoord[1]) * TEXCOORD_RANGE},
+    };
+}
+
+// calls fn with the vertices of a type, chunk by chunk, up to BATCH at a time
+typedef bool (*vertices_fn)(void * context, const export_vertex_t * vertices, size_t count);
+
+typedef struct {
+    vertices_fn fn;
+    void * context;
+    bool ok;
+    size_t count;
+    export_vertex_t vertices[BATCH];
+} vertex_batch_t;
+
+static void flush_vertices(vertex_batch_t * batch) {
+    if (batch->ok && batch->count > 0) {
+        batch->ok = batch->fn(batch->context, batch->vertices, batch->count);
+    }
+    batch->count = 0;
+}
+
+static void add_vertex(vertex_batch_t * batch, export_vertex_t v) {
+    batch->vertices[batch->count++] = v;
+    if (batch->count == BATCH) {
+        flush_vertices(batch);
+    }
+}
+
+static bool each_vertices(mesh_t * mesh, object_type_e type, vertices_fn fn, void * context) {
+    vertex_batch_t batch = {.fn = fn, .context = context, .ok = true};
+    if (type == LEAF) {
+        // leaves are kept by tree, each placed relative to its tree's chunk
+        lod_t * lod = &mesh->lods[0];
+        const size_t * start = vec_size_t_data(&lod->leaf_start);
+        size_t num_marks = vec_size_t_size(&lod->leaf_start);
+        for (size_t t = 0; t + 1 < num_marks && batch.ok; t++) {
+            vec3s origin = tree_origin(mesh, t);
+            for (size_t l = start[t]; l < start[t + 1]; l++) {
+                for (int k = 0; k < LEAF_CLUSTER_VERTICES; k++) {
+                    add_vertex(&batch, leaf_vertex(vec_leaf_instance_t_at(&lod->leaves, l), k,
+                        origin));
+                }
+            }
+        }
+    } else if (type == TREE && mesh->instanced) {
+        // six unindexed triangles for each instance
+        for (size_t c = 0; c < mesh->num_chunks && batch.ok; c++) {
+            mesh_chunk_t * chunk = &mesh->chunks[c];
+            foreach(vec_segment_instance_t, &chunk->instances, it) {
+                for (int k = 0; k < UNIT_CYLINDER_VERTICES; k++) {
+                    add_vertex(&batch, instance_vertex(chunk, it.ref, k));
+                }
+            }
+        }
+    } else {
+        for (size_t c = 0; c < mesh->num_chunks && batch.ok; c++) {
+            mesh_chunk_t * chunk = &mesh->chunks[c];
+            size_t n = type == TREE ? vec_ring_vertex_t_size(&chunk->rings) :
+                vec_vertex_t_size(&chunk->vertices[type]);
+            for (size_t i = 0; i < n; i++) {
+                add_vertex(&batch, type == TREE ? ring_vertex(chunk, i) :
+                    plain_vertex(chunk, type, i));
+            }
+        }
+    }
+    flush_vertices(&batch);
+    return batch.ok;
+}
+
+// calls fn with the triangles of a type, up to BATCH at a time, as indices
+// into its vertices in the order each_vertices gives them
+typedef bool (*triangles_fn)(void * context, const uint32_t * indices, size_t count);
+
+static bool each_triangles(mesh_t * mesh, object_type_e type, triangles_fn fn, void * context) {
+    uint32_t batch[BATCH * 3];
+    if (type == TREE && !mesh->instanced) {
+        // a tree's indices count from the first ring of its chunk
+        size_t * ring_base = malloc((mesh->num_chunks + 1) * sizeof(size_t));
+        ring_base[0] = 0;
+        for (size_t c = 0; c < mesh->num_chunks; c++) {
+            ring_base[c + 1] = ring_base[c] + vec_ring_vertex_t_size(&mesh->chunks[c].rings);
+        }
+        bool ok = true;
+        for (size_t t = 0; t < mesh->num_trees && ok; t++) {
+            size_t c = t < vec_size_t_size(&mesh->tree_chunk) ? *vec_size_t_at(&mesh->tree_chunk, t) : 0;
+            const uint32_t * indices = vec_uint32_t_data(&mesh->tree_indices[t]);
+            size_t n = vec_uint32_t_size(&mesh->tree_indices[t]) / 3;
+            for (size_t i = 0; i < n && ok; i += BATCH) {
+                size_t count = n - i < BATCH ? n - i : BATCH;
+                for (size_t k = 0; k < count * 3; k++) {
+                    batch[k] = ring_base[c] + indices[i * 3 + k];
+                }
+                ok = fn(context, batch, count);
+            }
+        }
+        free(ring_base);
+        return ok;
+    }
+    size_t n = num_triangles(mesh, type);
+    for (size_t i = 0; i < n; i += BATCH) {
+        size_t count = n - i < BATCH ? n - i : BATCH;
+        for (size_t k = 0; k < count * 3; k++) {
+            batch[k] = (i * 3) + k;
+        }
+        if (!fn(context, batch, count)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    FILE * file;
+    // added to every index, OBJ numbers vertices across the whole file from 1
+    size_t base;
+} obj_t;
+
+static bool obj_vertices(void * context, const export_vertex_t * vertices, size_t count) {
+    obj_t * obj = context;
+    for (size_t i = 0; i < count; i++) {
+        const export_vertex_t * v = &vertices[i];
+        fprintf(obj->file, "v %.4f %.4f %.4f\nvt %.4f %.4f\nvn %.3f %.3f %.3f\n",
+            v->position.x, v->position.y, v->position.z, v->uv.x, v->uv.y,
+            v->normal.x, v->normal.y, v->normal.z);
+    }
+    return !ferror(obj->file);
+}
+
+static bool obj_triangles(void * context, const uint32_t * indices, size_t count) {
+    obj_t * obj = context;
+    for (size_t i = 0; i < count * 3; i += 3) {
+        size_t a = obj->base + indices[i];
+        size_t b = obj->base + indices[i + 1];
+        size_t c = obj->base + indices[i + 2];
+        fprintf(obj->file, "f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n", a, a, a, b, b, b, c, c, c);
+    }
+    return !ferror(obj->file);
+}
+
+// filename with insert added to its stem and its extension replaced
+static char * with_suffix(const char * filename, const char * insert, const char * extension) {
+    const char * dot = strrchr(filename, '.');
+    const char * slash = strrchr(filename, '/');
+    size_t stem = dot && (!slash || dot > slash) ? (size_t)(dot - filename) : strlen(filename);
+    char * name = malloc(stem + strlen(insert) + strlen(extension) + 1);
+    memcpy(name, filename, stem);
+    strcpy(name + stem, insert);
+    strcat(name, extension);
+    return name;
+}
+
+static bool write_mtl(const char * filename) {
+    FILE * file = fopen(filename, "w");
+    if (!file) {
+        perror(filename);
+        return false;
+    }
+    for (int type = 0; type < MAX_OBJECT_TYPE; type++) {
+        fprintf(file, "newmtl %s\nKd 1 1 1\nmap_Kd %s\n", object_name[type], texture_file[type]);
+        if (type == LEAF || type == SHADOW) {
+            // cut out and blended by their alpha
+            fprintf(file, "map_d %s\n", texture_file[type]);
+        }
+        fprintf(file, "\n");
+    }
+    return fclose(file) == 0;
+}
+
+static bool export_obj(mesh_t * mesh, const char * filename) {
+    char * mtl = with_suffix(filename, "", ".mtl");
+    bool ok = write_mtl(mtl);
+    FILE * file = ok ? fopen(filename, "w") : NULL;
+    if (ok && !file) {
+        perror(filename);
+        ok = false;
+    }
+    if (ok) {
+        const char * slash = strrchr(mtl, '/');
+        fprintf(file, "mtllib %s\n", slash ? slash + 1 : mtl);
+        obj_t obj = {.file = file, .base = 1};
+        for (int type = 0; type < MAX_OBJECT_TYPE && ok; type++) {
+            fprintf(file, "o %s\nusemtl %s\n", object_name[type], object_name[type]);
+            ok = each_vertices(mesh, type, obj_vertices, &obj) &&
+                each_triangles(mesh, type, obj_triangles, &obj);
+            obj.base += num_vertices(mesh, type);
+        }
+        ok = fclose(file) == 0 && ok;
+        if (!ok) {
+            fprintf(stderr, "%s: failed writing\n", filename);
+        }
+    }
+    free(mtl);
+    return ok;
+}
+
+// the PLY face record, a count of 3 then the indices
+#pragma pack(push, 1)
+typedef struct {
+    uint8_t count;
+    uint32_t indices[3];
+} ply_face_t;
+#pragma pack(pop)
+
+static bool ply_triangles(void * context, const uint32_t * indices, size_t count) {
+    FILE * file = context;
+    ply_face_t faces[BATCH];
+    for (size_t i = 0; i < count; i++) {
+        faces[i].count = 3;
+        memcpy(faces[i].indices, indices + i * 3, sizeof(faces[i].indices));
+    }
+    return fwrite(faces, sizeof(ply_face_t), count, file) == count;
+}
+
+// export_vertex_t is already the 8 floats of a vertex record
+static bool ply_vertices(void * context, const export_vertex_t * vertices, size_t count) {
+    return fwrite(vertices, sizeof(export_vertex_t), count, context) == count;
+}
+
+static bool export_ply_object(mesh_t * mesh, object_type_e type, const char * filename) {
+    FILE * file = fopen(filename, "wb");
+    if (!file) {
+        perror(filename);
+        return false;
+    }
+    const uint16_t one = 1;
+    bool little_endian = *(const uint8_t *)&one == 1;
+    size_t n = num_vertices(mesh, type);
+    fprintf(file,
+        "ply\n"
+        "format binary_%s_endian 1.0\n"
+        "comment TextureFile %s\n"
+        "element vertex %zu\n"
+        "property float x\nproperty float y\nproperty float z\n"
+        "property float nx\nproperty float ny\nproperty float nz\n"
+        "property float s\nproperty float t\n"
+        "element face %zu\n"
+        "property list uchar uint vertex_indices\n"
+        "end_header\n",
+        little_endian ? "little" : "big", texture_file[type], n, num_triangles(mesh, type));
+
+    bool ok = each_vertices(mesh, type, ply_vertices, file) &&
+        each_triangles(mesh, type, ply_triangles, file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "%s: failed writing\n", filename);
+    }
+    return ok;
+}
+
+static bool export_ply(mesh_t * mesh, const char * filename) {
+    bool ok = true;
+    for (int type = 0; type < MAX_OBJECT_TYPE && ok; type++) {
+        char insert[32];
+        snprintf(insert, sizeof(insert), "_%s", object_name[type]);
+        char * name = with_suffix(filename, insert, ".ply");
+        ok = export_ply_object(mesh, type, name);
+        free(name);
+    }
+    return ok;
+}
+
+bool export_mesh(mesh_t * mesh, const char * filename) {
+    const char * dot = strrchr(filename, '.');
+    if (dot && strcmp(dot, ".obj") == 0) {
+        return export_obj(mesh, filename);
+    }
+    if (dot && strcmp(dot, ".ply") == 0) {
+        return export_ply(mesh, filename);
+    }
+    fprintf(stderr, "%s: can only export .obj or .ply\n", filename);
+    return false;
+}
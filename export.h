@@ -0,0 +1,22 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "mesh.h"
+
+// writes the ground, branches, leaves and contact shadows of a mesh at full
+// detail as four separate meshes, in the format named by the extension of
+// filename:
+//   .obj  one file with an object and material for each, the materials in a
+//         .mtl beside it using the textures the renderer uses
+//   .ply  binary in the host's byte order, one file for each as PLY has no
+//         way to keep meshes apart, named filename with _ground, _branches
+//         and so on inserted before the extension
+// Vertices are dequantised and, for branches and leaves, placed as the
+// shaders would place them, a batch at a time as they are written, so no
+// second copy of the mesh is ever held. Branches meshed as instances are
+// written as the unit cylinder placed for each. Only the grown trees are
+// exported, not the copies of them. Returns false, having said why on
+// stderr, on failure
+bool export_mesh(mesh_t * mesh, const char * filename);
+
+#endif
@@ -0,0 +1,710 @@
+#include "forest.h"
+#include "timing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+paths_t paths_init() {
+    return (paths_t){
+        .position = vec_vec3s_init(),
+        .direction = vec_vec3s_init(),
+        .up = vec_vec3s_init(),
+        .radius = vec_float_init(),
+        .is_leader = vec_uint8_t_init(),
+        .is_leaf = vec_uint8_t_init(),
+        .last_path = vec_size_t_init(),
+        .tree = vec_size_t_init(),
+        .tips = vec_size_t_init(),
+        .next_tips = vec_size_t_init()
+    };
+}
+
+void paths_free(paths_t * paths) {
+    vec_vec3s_free(&paths->position);
+    vec_vec3s_free(&paths->direction);
+    vec_vec3s_free(&paths->up);
+    vec_float_free(&paths->radius);
+    vec_uint8_t_free(&paths->is_leader);
+    vec_uint8_t_free(&paths->is_leaf);
+    vec_size_t_free(&paths->last_path);
+    vec_size_t_free(&paths->tree);
+    vec_size_t_free(&paths->tips);
+    vec_size_t_free(&paths->next_tips);
+}
+
+size_t paths_size(paths_t * paths) {
+    return vec_float_size(&paths->radius);
+}
+
+size_t paths_push_back(paths_t * paths, path_t path) {
+    size_t index = paths_size(paths);
+    vec_vec3s_push_back(&paths->position, path.position);
+    vec_vec3s_push_back(&paths->direction, path.direction);
+    vec_vec3s_push_back(&paths->up, path.up);
+    vec_float_push_back(&paths->radius, path.radius);
+    vec_uint8_t_push_back(&paths->is_leader, path.is_leader);
+    vec_uint8_t_push_back(&paths->is_leaf, path.is_leaf);
+    vec_size_t_push_back(&paths->last_path, path.last_path);
+    vec_size_t_push_back(&paths->tree, path.tree);
+    if (path.is_leaf) {
+        vec_size_t_push_back(&paths->tips, index);
+    }
+    return index;
+}
+
+// gather a single row back out of the columns
+path_t paths_at(paths_t * paths, size_t i) {
+    return (path_t){
+        .position = *vec_vec3s_at(&paths->position, i),
+        .direction = *vec_vec3s_at(&paths->direction, i),
+        .up = *vec_vec3s_at(&paths->up, i),
+        .radius = *vec_float_at(&paths->radius, i),
+        .is_leader = *vec_uint8_t_at(&paths->is_leader, i),
+        .is_leaf = *vec_uint8_t_at(&paths->is_leaf, i),
+        .last_path = *vec_size_t_at(&paths->last_path, i),
+        .tree = *vec_size_t_at(&paths->tree, i)
+    };
+}
+
+growth_t growth_init(size_t num_tasks) {
+    growth_t growth = {
+        .stage = GROWTH_IDLE,
+        .rates = vec_float_init(),
+        .num_tasks = num_tasks,
+        .tip_start = vec_size_t_init(),
+        .tip_next = vec_size_t_init(),
+        .children = malloc(sizeof(vec_path_t) * num_tasks)
+    };
+    for (size_t i = 0; i < num_tasks; i++) {
+        growth.children[i] = vec_path_t_init();
+    }
+    return growth;
+}
+
+void growth_free(growth_t * growth) {
+    for (size_t i = 0; i < growth->num_tasks; i++) {
+        vec_path_t_free(&growth->children[i]);
+    }
+    free(growth->children);
+    vec_size_t_free(&growth->tip_next);
+    vec_size_t_free(&growth->tip_start);
+    vec_float_free(&growth->rates);
+}
+
+path_t create_shoot(vec3s origin, size_t tree) {
+    return (path_t){
+        .position =  glms_vec3_add(origin, (vec3s){.x = 0, .y = 0.0f, .z = 0.0f}),
+        .direction = (vec3s){.x = 0, .y = 0.1f, .z = 0.0f},
+        .up =  (vec3s){.x =  0, .y = 0.0f, .z = 1.0f},
+        .radius = 0.01f,
+        .is_leader = true,
+        .is_leaf = true,
+        .tree = tree
+    };
+}
+
+// ground beyond the trees on the edges of the forest
+static const float ground_margin = 30.0f;
+
+static void plant(forest_t * forest, vec3s position, size_t tree) {
+    rng_t rng = rng_init(forest->seed, tree, UINT64_MAX);
+    vec3s root_pos = glms_vec3_add(rng_vec(&rng, 1.0f), position);
+    root_pos.y = 0.0f;
+    path_t path = create_shoot(root_pos, tree);
+    path.last_path = paths_size(&forest->paths);
+    paths_push_back(&forest->paths, path);
+    vec3s end = glms_vec3_add(path.position, path.direction);
+    grid_add(&forest->grid, end, tree);
+    light_add_tip(&forest->light, end);
+    vec_tree_t_push_back(&forest->trees, 
+        (tree_t){
+            .has_leader = true,
+            .origin = root_pos,
+            .radius = 0.0f,
+            .shoot = path.last_path,
+            .bounds = box_extend(box_point(path.position),
+                glms_vec3_add(path.position, path.direction)),
+            .rng = rng
+    });
+}
+
+// a copy of one of num_templates trees at a spot, varied from the seed
+static tree_copy_t make_copy(forest_t * forest, vec3s position, size_t spot,
+        size_t num_templates) {
+    rng_t rng = rng_init(forest->seed, spot, UINT64_MAX - 1);
+    vec3s jitter = rng_vec(&rng, 1.0f);
+    jitter.y = 0.0f;
+    return (tree_copy_t){
+        .tree = rng_next(&rng) % num_templates,
+        .position = glms_vec3_add(position, jitter),
+        .yaw = glm_rad(rng_float(&rng, 360.0f)),
+        .scale = 0.8f + rng_float(&rng, 0.4f),
+        .tint = glms_vec3_add((vec3s){1.0f, 1.0f, 1.0f}, rng_vec(&rng, 0.3f)),
+    };
+}
+
+// the spots of the grid, chunk by chunk and within a chunk in rows of x. The
+// trees stand in the square of num_trees spots in the middle, planted when
+// plant_trees is set, and copies of them in the other spots
+static void lay_out(forest_t * forest, size_t num_trees, bool plant_trees) {
+    int side = forest->side;
+    int size = side < CHUNK_TREES ? (side > 0 ? side : 1) : CHUNK_TREES;
+    int num_chunks = (side + size - 1) / size;
+    int block = (int)sqrt(num_trees);
+    int b0 = (side - block) / 2;
+    float off = (side - 1.0f) / 2.0f;
+    vec_chunk_t_clear(&forest->chunks);
+    vec_tree_copy_t_clear(&forest->copies);
+    size_t tree = 0;
+    for (int cx = 0; cx < num_chunks; cx++) {
+        for (int cz = 0; cz < num_chunks; cz++) {
+            int x0 = cx * size;
+            int z0 = cz * size;
+            int x1 = x0 + size < side ? x0 + size : side;
+            int z1 = z0 + size < side ? z0 + size : side;
+            size_t first_tree = tree;
+            size_t first_copy = vec_tree_copy_t_size(&forest->copies);
+            for (int x = x0; x < x1; x++) {
+                for (int z = z0; z < z1; z++) {
+                    vec3s position = glms_vec3_scale((vec3s){x - off, 0.0f, z - off}, 2.0f);
+                    if (x < b0 || x >= b0 + block || z < b0 || z >= b0 + block) {
+                        vec_tree_copy_t_push_back(&forest->copies,
+                            make_copy(forest, position, x * side + z, num_trees));
+                        continue;
+                    }
+                    if (plant_trees) {
+                        plant(forest, position, tree);
+                    }
+                    vec_tree_t_at(&forest->trees, tree)->chunk = vec_chunk_t_size(&forest->chunks);
+                    tree++;
+                }
+            }
+            // each spot has the square 2 m across around it
+            box_t area = {
+                .lo = (vec3s){(x0 - off) * 2.0f - 1.0f, 0.0f, (z0 - off) * 2.0f - 1.0f},
+                .hi = (vec3s){(x1 - 1 - off) * 2.0f + 1.0f, 0.0f, (z1 - 1 - off) * 2.0f + 1.0f},
+            };
+            vec3s origin = glms_vec3_scale(glms_vec3_add(area.lo, area.hi), 0.5f);
+            area.lo.x -= cx == 0 ? ground_margin : 0.0f;
+            area.lo.z -= cz == 0 ? ground_margin : 0.0f;
+            area.hi.x += cx == num_chunks - 1 ? ground_margin : 0.0f;
+            area.hi.z += cz == num_chunks - 1 ? ground_margin : 0.0f;
+            vec_chunk_t_push_back(&forest->chunks, (chunk_t){
+                .first_tree = first_tree,
+                .num_trees = tree - first_tree,
+                .first_copy = first_copy,
+                .num_copies = vec_tree_copy_t_size(&forest->copies) - first_copy,
+                .origin = origin,
+                .area = area,
+            });
+        }
+    }
+}
+
+forest_t forest_init_templates(size_t num_trees, size_t num_templates, uint64_t seed,
+        size_t num_tasks) {
+    size_t side = (size_t)sqrt(num_trees);
+    size_t block = (size_t)sqrt(num_templates);
+    block = block < side ? block : side;
+    block = block > 0 || side == 0 ? block : 1;
+    forest_t forest = {
+        .seed = seed,
+        .side = side,
+        .trees = vec_tree_t_init(),
+        .copies = vec_tree_copy_t_init(),
+        .chunks = vec_chunk_t_init(),
+        .paths = paths_init(),
+        .stats = (growth_stats_t){0},
+        .growth = growth_init(num_tasks),
+        .lod = lod_scratch_init(),
+        .grid = grid_init(),
+        .light = light_init(SHADOW_DEPTH),
+        .geometry_elapsed = 0,
+    };
+    lay_out(&forest, block * block, true);
+    return forest;
+}
+
+forest_t forest_init(size_t num_trees, uint64_t seed, size_t num_tasks) {
+    return forest_init_templates(num_trees, num_trees, seed, num_tasks);
+}
+
+void forest_set_shadow_depth(forest_t * forest, float depth) {
+    paths_t * paths = &forest->paths;
+    light_free(&forest->light);
+    forest->light = light_init(depth);
+    foreach(vec_size_t, &paths->tips, it) {
+        light_add_tip(&forest->light, glms_vec3_add(*vec_vec3s_at(&paths->position, *it.ref),
+            *vec_vec3s_at(&paths->direction, *it.ref)));
+    }
+}
+
+void forest_index_chunks(forest_t * forest) {
+    lay_out(forest, vec_tree_t_size(&forest->trees), false);
+}
+
+// TREE_SEED picks the seed for reproducible runs, otherwise it comes from the clock
+uint64_t forest_seed_from_env() {
+    const char * seed = getenv("TREE_SEED");
+    uint64_t s = seed ? strtoull(seed, NULL, 0) : (uint64_t)time(0);
+    printf("seed %llu\n", (unsigned long long)s);
+    return s;
+}
+
+void forest_print_stats(forest_t * forest) {
+    growth_stats_t *stats = &forest->stats;
+    if (stats->segments > 0) {
+        printf("grew %zu steps: visited %zu tips of %zu segments (%.1f%% skipped)\n",
+            stats->steps, stats->tips, stats->segments,
+            100.0 * (1.0 - (double)stats->tips / (double)stats->segments));
+    }
+}
+
+void forest_free(forest_t * forest) {
+    growth_free(&forest->growth);
+    lod_scratch_free(&forest->lod);
+    grid_free(&forest->grid);
+    light_free(&forest->light);
+    paths_free(&forest->paths);
+    vec_chunk_t_free(&forest->chunks);
+    vec_tree_copy_t_free(&forest->copies);
+    vec_tree_t_free(&forest->trees);
+}
+
+// how hard a new segment is pushed out of crowded cells next to its end
+static const float crowd_avoidance = 0.5f;
+
+// vigor, from 0 to 1, shortens the segment. Returns false, leaving the tip to
+// die, if the segment would end in a cell another tree already reached
+bool new_path(paths_t * paths, grid_t * grid, const size_t parent_index, path_t * child,
+        float radius, bool is_leader, bool has_leader, float vigor, rng_t * rng) {
+    vec3s parent_position = *vec_vec3s_at(&paths->position, parent_index);
+    vec3s parent_direction = *vec_vec3s_at(&paths->direction, parent_index);
+    vec3s parent_up = *vec_vec3s_at(&paths->up, parent_index);
+    vec3s x, y, z;
+    axes_from_dir_up(parent_direction, parent_up, &x, &y, &z);
+    // perturb direction randomly
+    float perturb = is_leader ? 0.1f : 1.0f;
+    float length = 0.01f;
+    if (is_leader) {
+        length = 0.05f;
+    } else if(!has_leader) {
+        length = 0.03f;
+    }
+    length *= 0.5f + 0.5f * vigor;
+
+    vec3s direction = glms_vec3_scale( 
+        glms_vec3_normalize(glms_vec3_add(
+                (vec3s){.x = 0.0f, .y = 0.1f, .z = 0.0f}, // vertical tropism
+                glms_vec3_add(y, rng_vec(rng, perturb)))),
+                length);
+
+    // steer away from the neighbouring cells by how full they are
+    vec3s position = glms_vec3_add(parent_position, parent_direction);
+    vec3s end = glms_vec3_add(position, direction);
+    vec3s away = grid_away(grid, end);
+    if (glms_vec3_norm2(away) > 0.0f) {
+        direction = glms_vec3_scale(
+            glms_vec3_normalize(glms_vec3_add(glms_vec3_normalize(direction),
+                glms_vec3_scale(away, crowd_avoidance))),
+            length);
+        end = glms_vec3_add(position, direction);
+    }
+    size_t tree = *vec_size_t_at(&paths->tree, parent_index);
+    const cell_t * cell = grid_at(grid, end);
+    if (cell && cell->tree != tree) {
+        return false;
+    }
+
+    *child = (path_t){
+        .position = position,
+        .direction = direction,
+        .up = z,
+        .radius = radius,
+        .is_leader = is_leader,
+        .is_leaf = true,
+        .tree = tree,
+        .last_path = parent_index
+    };
+    return true;
+}
+
+void radial_growth(paths_t * paths, const float * rates, size_t begin, size_t end) {
+    float * restrict radius = vec_float_data(&paths->radius);
+    const uint8_t * restrict is_leader = vec_uint8_t_data(&paths->is_leader);
+    const size_t * restrict tree = vec_size_t_data(&paths->tree);
+    for (size_t i = begin; i < end; i++) {
+        radius[i] += is_leader[i] ? 0.001f : rates[tree[i]];
+    }
+}
+
+// radial growth of paths [begin, end), split between the tasks
+static void radial_growth_task(void * context, size_t task) {
+    growth_t * growth = context;
+    size_t n = growth->end - growth->begin;
+    radial_growth(&growth->forest->paths, vec_float_data(&growth->rates),
+        growth->begin + n * task / growth->num_tasks,
+        growth->begin + n * (task + 1) / growth->num_tasks);
+}
+
+// spawn children for the tips [begin, end) of paths->next_tips into children,
+// only touching the trees those tips belong to
+void new_paths(uint64_t seed, paths_t * paths, vec_tree_t * trees, grid_t * grid,
+        light_t * light, size_t begin, size_t end, vec_path_t * children) {
+    for(size_t t = begin; t < end; t++) {
+        size_t i = *vec_size_t_at(&paths->next_tips, t);
+        *vec_uint8_t_at(&paths->is_leaf, i) = false;
+        bool path_is_leader = *vec_uint8_t_at(&paths->is_leader, i);
+        size_t tree_index = *vec_size_t_at(&paths->tree, i);
+        tree_t * tree = vec_tree_t_at(trees, tree_index);
+        // a tip only ever spawns once so its segment index keys its own stream
+        rng_t rng = rng_init(seed, tree_index, i);
+        vec3s position = *vec_vec3s_at(&paths->position, i);
+        // a tip in the open branches half as often again, one in deep shade
+        // half as often, and grows shorter segments
+        float vigor = light_exposure(light,
+            glms_vec3_add(position, *vec_vec3s_at(&paths->direction, i)));
+        int n = rng_prob(&rng, (path_is_leader ? 0.2f : 0.05f) * (0.5f + vigor)) ? 2 : 1;
+        float radius = 0.01f;
+        float radii[] = {radius, radius};
+        
+        float horiz_dist_from_root = glms_vec3_norm(
+            glms_vec3_sub(
+                (vec3s){position.x, 0.0f, position.z},
+                tree->origin));
+        tree->radius = tree->radius > horiz_dist_from_root ? tree->radius : horiz_dist_from_root;
+
+        bool has_leader = tree->has_leader;
+        bool child_is_leader = path_is_leader && has_leader;
+        bool is_leader[] = {child_is_leader, false};
+
+        if (n == 2) {
+            radii[0] = path_is_leader ? radius :
+                (rng_float(&rng, 0.5f) + 0.5f) * radius;
+            // sum of children = area of parent
+            radii[1] = sqrt(radius * radius - radii[0] * radii[0]);
+        }
+
+        for (int j = 0; j < n; j++) {
+            path_t child;
+            if (new_path(paths, grid, i, &child, radii[j], is_leader[j], has_leader, vigor,
+                    &rng)) {
+                vec_path_t_push_back(children, child);
+            }
+        }
+    }
+}
+
+// spawns from at most TIP_BATCH more of the task's tips
+static void new_paths_task(void * context, size_t task) {
+    growth_t * growth = context;
+    forest_t * forest = growth->forest;
+    size_t * next = vec_size_t_at(&growth->tip_next, task);
+    size_t end = *vec_size_t_at(&growth->tip_start, task + 1);
+    size_t stop = end - *next > TIP_BATCH ? *next + TIP_BATCH : end;
+    new_paths(forest->seed, &forest->paths, &forest->trees, &forest->grid, &forest->light,
+        *next, stop, &growth->children[task]);
+    *next = stop;
+}
+
+// the rates for radial growth, and the paths it has to cover
+static void start_step(forest_t * forest) {
+    growth_t * growth = &forest->growth;
+    vec_float_clear(&growth->rates);
+    foreach(vec_tree_t, &forest->trees, it) {
+        vec_float_push_back(&growth->rates, it.ref->has_leader ? 0.0001f : 0.001f);
+    }
+    growth->next = 0;
+    growth->num_paths = paths_size(&forest->paths);
+    for (int stage = 0; stage < MAX_GROWTH_STAGE; stage++) {
+        growth->elapsed[stage] = 0;
+    }
+    growth->stage = GROWTH_RADIAL;
+}
+
+// decays the leaders and hands each task the tips of its group of trees
+static void start_new_paths(forest_t * forest) {
+    growth_t * growth = &forest->growth;
+    paths_t * paths = &forest->paths;
+    vec_tree_t * trees = &forest->trees;
+    growth_stats_t * stats = &forest->stats;
+    const size_t num_tasks = growth->num_tasks;
+
+    // each tree draws from its own stream, so the order doesn't matter
+    uint64_t start = timing_now();
+    foreach(vec_tree_t, trees, it) {
+        it.ref->has_leader = it.ref->has_leader && rng_prob(&it.ref->rng, 0.98f);
+    }
+    timing_record(TIMING_LEADER_DECAY, start);
+
+    // children are pushed onto paths->tips by paths_push_back, so start it
+    // empty and spawn from the previous list in next_tips
+    vec_size_t_swap(&paths->tips, &paths->next_tips);
+    vec_size_t_clear(&paths->tips);
+    const size_t num_tips = vec_size_t_size(&paths->next_tips);
+    const size_t num_trees = vec_tree_t_size(trees);
+    stats->steps++;
+    stats->tips += num_tips;
+    stats->segments += paths_size(paths);
+
+    vec_size_t_clear(&growth->tip_start);
+    size_t t = 0;
+    for (size_t task = 0; task < num_tasks; task++) {
+        size_t first_tree = num_trees * task / num_tasks;
+        while (t < num_tips &&
+                *vec_size_t_at(&paths->tree, *vec_size_t_at(&paths->next_tips, t)) < first_tree) {
+            t++;
+        }
+        vec_size_t_push_back(&growth->tip_start, t);
+    }
+    vec_size_t_push_back(&growth->tip_start, num_tips);
+    vec_size_t_clear(&growth->tip_next);
+    for (size_t task = 0; task < num_tasks; task++) {
+        vec_size_t_push_back(&growth->tip_next, *vec_size_t_at(&growth->tip_start, task));
+    }
+    growth->stage = GROWTH_NEW_PATHS;
+}
+
+static bool tips_left(growth_t * growth) {
+    for (size_t task = 0; task < growth->num_tasks; task++) {
+        if (*vec_size_t_at(&growth->tip_next, task) < *vec_size_t_at(&growth->tip_start, task + 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// every tip just spawned, or died, so its shade goes and its children's
+// comes. Does up to MERGE_BATCH more of the tips and then the children, in
+// task order, returning false once they are all done
+static bool merge(forest_t * forest) {
+    growth_t * growth = &forest->growth;
+    paths_t * paths = &forest->paths;
+    for (size_t n = 0; n < MERGE_BATCH; n++) {
+        if (growth->next < vec_size_t_size(&paths->next_tips)) {
+            size_t i = *vec_size_t_at(&paths->next_tips, growth->next++);
+            light_remove_tip(&forest->light, glms_vec3_add(*vec_vec3s_at(&paths->position, i),
+                *vec_vec3s_at(&paths->direction, i)));
+            continue;
+        }
+        while (growth->merge_task < growth->num_tasks &&
+                growth->next_child == vec_path_t_size(&growth->children[growth->merge_task])) {
+            vec_path_t_clear(&growth->children[growth->merge_task]);
+            growth->merge_task++;
+            growth->next_child = 0;
+        }
+        if (growth->merge_task == growth->num_tasks) {
+            return false;
+        }
+        path_t * child = vec_path_t_at(&growth->children[growth->merge_task],
+            growth->next_child++);
+        paths_push_back(paths, *child);
+        // a child starts where its parent ends, so only its end is new
+        vec3s end = glms_vec3_add(child->position, child->direction);
+        tree_t * tree = vec_tree_t_at(&forest->trees, child->tree);
+        tree->bounds = box_extend(tree->bounds, end);
+        grid_add(&forest->grid, end, child->tree);
+        light_add_tip(&forest->light, end);
+    }
+    return true;
+}
+
+static void record_step(growth_t * growth) {
+    static const timing_phase_e phase[MAX_GROWTH_STAGE] = {
+        [GROWTH_RADIAL] = TIMING_RADIAL_GROWTH,
+        [GROWTH_NEW_PATHS] = TIMING_NEW_PATHS,
+        [GROWTH_MERGE] = TIMING_MERGE,
+    };
+    uint64_t total = 0;
+    for (int stage = GROWTH_RADIAL; stage < MAX_GROWTH_STAGE; stage++) {
+        timing_record_ns(phase[stage], growth->elapsed[stage]);
+        total += growth->elapsed[stage];
+    }
+    timing_record_ns(TIMING_STEP, total);
+}
+
+// one growth step, split by groups of trees and into chunks. Each tree only
+// reads its own segments and random streams, the children are merged in
+// tree order, and every stage finishes before the next starts, so the result
+// does not depend on the number of threads or on how the step is sliced
+bool grow_until(forest_t * forest, pool_t * pool, uint64_t deadline) {
+    growth_t * growth = &forest->growth;
+    growth->forest = forest;
+    if (growth->stage == GROWTH_IDLE) {
+        start_step(forest);
+    }
+    // at least one chunk is done however late it is, so steps always finish
+    uint64_t now = timing_now();
+    do {
+        uint64_t start = now;
+        growth_stage_e stage = growth->stage;
+        switch (stage) {
+        case GROWTH_RADIAL:
+            growth->begin = growth->next;
+            growth->end = growth->num_paths - growth->next > RADIAL_BATCH ?
+                growth->next + RADIAL_BATCH : growth->num_paths;
+            pool_run(pool, radial_growth_task, growth, growth->num_tasks);
+            growth->next = growth->end;
+            if (growth->next == growth->num_paths) {
+                start_new_paths(forest);
+            }
+            break;
+        case GROWTH_NEW_PATHS:
+            pool_run(pool, new_paths_task, growth, growth->num_tasks);
+            if (!tips_left(growth)) {
+                growth->next = 0;
+                growth->merge_task = 0;
+                growth->next_child = 0;
+                growth->stage = GROWTH_MERGE;
+            }
+            break;
+        case GROWTH_MERGE:
+            if (!merge(forest)) {
+                growth->stage = GROWTH_IDLE;
+            }
+            break;
+        default:
+            break;
+        }
+        now = timing_now();
+        growth->elapsed[stage] += now - start;
+        if (growth->stage == GROWTH_IDLE) {
+            record_step(growth);
+        }
+    } while (growth->stage != GROWTH_IDLE && now < deadline);
+    return growth->stage == GROWTH_IDLE;
+}
+
+void grow(forest_t * forest, pool_t * pool) {
+    while (!grow_until(forest, pool, UINT64_MAX)) {
+    }
+}
+
+mat4s paths_end_frame(paths_t * paths, size_t i) {
+    vec3s x, y, z;
+    vec3s direction = *vec_vec3s_at(&paths->direction, i);
+    vec3s position = glms_vec3_add(*vec_vec3s_at(&paths->position, i), direction);
+    axes_from_dir_up(direction, *vec_vec3s_at(&paths->up, i), &x, &y, &z);
+    return mat_from_axes(x, y, z, position);
+}
+
+// the frame at the base of a shoot
+static mat4s start_frame(paths_t * paths, size_t i) {
+    vec3s x, y, z;
+    axes_from_dir_up(*vec_vec3s_at(&paths->direction, i), *vec_vec3s_at(&paths->up, i),
+        &x, &y, &z);
+    return mat_from_axes(x, y, z, *vec_vec3s_at(&paths->position, i));
+}
+
+// a shoot is its own parent, its start ring sits at its position. Otherwise
+// the start frame of a child is the end frame of its parent
+static void add_segment(mesh_t * mesh, paths_t * paths, size_t i) {
+    size_t parent = *vec_size_t_at(&paths->last_path, i);
+    size_t tree = *vec_size_t_at(&paths->tree, i);
+    if (mesh->instanced) {
+        mat4s m0 = parent != i ? paths_end_frame(paths, parent) : start_frame(paths, i);
+        mesh_add_instance(mesh, tree, m0, parent, paths_end_frame(paths, i));
+    } else if (parent != i) {
+        mesh_add_segment(mesh, tree, parent, paths_end_frame(paths, i));
+    } else {
+        mesh_add_root_segment(mesh, tree, start_frame(paths, i), paths_end_frame(paths, i));
+    }
+}
+
+// segments meshed between looks at the clock
+#define MESH_BATCH 4096
+
+// chunks are placed, and their ground laid, before anything is meshed into
+// them, and again after the mesh is cleared
+static void place_chunks(forest_t * forest, mesh_t * mesh) {
+    for (size_t c = 0; c < vec_chunk_t_size(&forest->chunks); c++) {
+        if (c < mesh->num_chunks && vec_vertex_t_size(&mesh->chunks[c].vertices[GROUND]) > 0) {
+            continue;
+        }
+        chunk_t * chunk = vec_chunk_t_at(&forest->chunks, c);
+        mesh_set_chunk(mesh, c, chunk->origin, chunk->first_tree, chunk->num_trees);
+        mesh_add_ground(mesh, c, chunk->area);
+        for (size_t k = chunk->first_copy; k < chunk->first_copy + chunk->num_copies; k++) {
+            tree_copy_t * copy = vec_tree_copy_t_at(&forest->copies, k);
+            tree_t * tree = vec_tree_t_at(&forest->trees, copy->tree);
+            mat4s m = glms_translate_make(copy->position);
+            m = glms_mat4_mul(m, glms_rotate_make(copy->yaw, (vec3s){0.0f, 1.0f, 0.0f}));
+            m = glms_mat4_mul(m, glms_scale_make((vec3s){copy->scale, copy->scale, copy->scale}));
+            m = glms_mat4_mul(m, glms_translate_make(glms_vec3_negate(tree->origin)));
+            mesh_add_copy(mesh, c, copy->tree, m, copy->tint);
+        }
+    }
+}
+
+// a tree's shadow grows with its spread
+static bool shadows_changed(forest_t * forest, mesh_t * mesh, size_t first_tree,
+        size_t num_trees) {
+    for (size_t t = first_tree; t < first_tree + num_trees; t++) {
+        if (t >= vec_float_size(&mesh->shadow_radii) ||
+                vec_tree_t_at(&forest->trees, t)->radius != *vec_float_at(&mesh->shadow_radii, t)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool new_geometry_until(forest_t * forest, mesh_t * mesh, uint64_t deadline) {
+    uint64_t start = timing_now();
+    paths_t * paths = &forest->paths;
+    const size_t num_paths = paths_size(paths);
+    place_chunks(forest, mesh);
+    // branch vertices don't depend on the radius, so only the segments added
+    // since the last call need meshing
+    while (mesh->num_segments < num_paths) {
+        size_t end = num_paths - mesh->num_segments > MESH_BATCH ?
+            mesh->num_segments + MESH_BATCH : num_paths;
+        for (size_t i = mesh->num_segments; i < end; i++) {
+            add_segment(mesh, paths, i);
+        }
+        if (end < num_paths && timing_now() >= deadline) {
+            forest->geometry_elapsed += timing_now() - start;
+            return false;
+        }
+    }
+    if (!lod_build_until(&forest->lod, paths, vec_tree_t_size(&forest->trees), mesh, deadline)) {
+        forest->geometry_elapsed += timing_now() - start;
+        return false;
+    }
+    mesh_set_radii(mesh, vec_float_data(&paths->radius), num_paths);
+
+    // the trunk is the thickest part of a tree and leaves reach a little
+    // beyond the skeleton
+    for (size_t t = 0; t < vec_tree_t_size(&forest->trees); t++) {
+        tree_t * tree = vec_tree_t_at(&forest->trees, t);
+        float trunk = *vec_float_at(&paths->radius, tree->shoot);
+        mesh_set_bounds(mesh, t, box_pad(tree->bounds, trunk + 0.3f));
+    }
+    // the shadows of a chunk are left alone, and not uploaded again, unless
+    // they change. Copies take their template's shadow, scaled
+    bool templates_changed = shadows_changed(forest, mesh, 0, vec_tree_t_size(&forest->trees));
+    for (size_t c = 0; c < vec_chunk_t_size(&forest->chunks); c++) {
+        chunk_t * chunk = vec_chunk_t_at(&forest->chunks, c);
+        if (!shadows_changed(forest, mesh, chunk->first_tree, chunk->num_trees) &&
+                !(templates_changed && chunk->num_copies > 0)) {
+            continue;
+        }
+        mesh_clear_type(mesh, c, SHADOW);
+        for (size_t t = chunk->first_tree; t < chunk->first_tree + chunk->num_trees; t++) {
+            tree_t * tree = vec_tree_t_at(&forest->trees, t);
+            mesh_add_contact_shadow(mesh, t, tree->origin, tree->radius);
+        }
+        for (size_t k = chunk->first_copy; k < chunk->first_copy + chunk->num_copies; k++) {
+            tree_copy_t * copy = vec_tree_copy_t_at(&forest->copies, k);
+            float radius = vec_tree_t_at(&forest->trees, copy->tree)->radius * copy->scale;
+            mesh_add_copy_shadow(mesh, c, copy->position, radius);
+        }
+    }
+    timing_record_ns(TIMING_NEW_GEOMETRY, forest->geometry_elapsed + timing_now() - start);
+    forest->geometry_elapsed = 0;
+    return true;
+}
+
+void new_geometry(forest_t * forest, mesh_t * mesh) {
+    new_geometry_until(forest, mesh, UINT64_MAX);
+}
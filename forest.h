@@ -0,0 +1,234 @@
+#ifndef FOREST_H
+#define FOREST_H
+
+#include "grid.h"
+#include "light.h"
+#include "lod.h"
+#include "mesh.h"
+#include "pool.h"
+#include "vectors.h"
+
+typedef struct path_s {
+    vec3s position;
+    vec3s direction;
+    vec3s up;
+    float radius;
+    bool is_leader;
+    bool is_leaf;
+    size_t last_path;
+    size_t tree;
+} path_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T path_t
+#include <ctl/vector.h>
+
+// the path store keeps one column per field of path_t so that the per step
+// loops only stream through the fields they actually use
+typedef struct paths_s {
+    vec_vec3s position;
+    vec_vec3s direction;
+    vec_vec3s up;
+    vec_float radius;
+    vec_uint8_t is_leader;
+    vec_uint8_t is_leaf;
+    vec_size_t last_path;
+    vec_size_t tree;
+    // indices of the segments with is_leaf set, rewritten by every new_paths
+    // and always ordered by tree
+    vec_size_t tips;
+    vec_size_t next_tips;
+} paths_t;
+
+// how much of the store new_paths actually visits
+typedef struct {
+    size_t steps;
+    size_t tips;
+    size_t segments;
+} growth_stats_t;
+
+typedef struct tree_s {
+    bool has_leader; 
+    vec3s origin;
+    // the chunk the tree is planted in
+    size_t chunk;
+    float radius;
+    // the tree's first segment, always its thickest
+    size_t shoot;
+    // box around the skeleton, grown as segments are added
+    box_t bounds;
+    // tree level draws (placement, leader decay) come from this stream, spawning
+    // from a tip uses a stream keyed by the tip's segment
+    rng_t rng;
+} tree_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T tree_t
+#include <ctl/vector.h>
+
+// a template tree standing in for a tree at another spot, turned about y,
+// scaled and tinted. Only the templates are grown and meshed, copies are drawn
+// from their geometry
+typedef struct {
+    size_t tree;
+    vec3s position;
+    float yaw;
+    float scale;
+    vec3s tint;
+} tree_copy_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T tree_copy_t
+#include <ctl/vector.h>
+
+// the spots of a forest are 2 m apart in square chunks of up to CHUNK_TREES
+// by CHUNK_TREES, numbered chunk by chunk so each chunk's trees, and copies,
+// are contiguous. The mesh and the renderer keep the geometry of each chunk
+// apart, placed relative to its origin
+#define CHUNK_TREES 8
+
+typedef struct {
+    size_t first_tree;
+    size_t num_trees;
+    size_t first_copy;
+    size_t num_copies;
+    // the middle of the chunk, on the ground
+    vec3s origin;
+    // the ground the chunk covers, taken out past the trees on the edges of
+    // the forest
+    box_t area;
+} chunk_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T chunk_t
+#include <ctl/vector.h>
+
+struct forest_s;
+
+// where a growth step has got to. A step can be done a slice at a time, see
+// grow_until, and each stage is worked through a batch at a time
+typedef enum {
+    GROWTH_IDLE,
+    GROWTH_RADIAL,
+    GROWTH_NEW_PATHS,
+    GROWTH_MERGE,
+    MAX_GROWTH_STAGE
+} growth_stage_e;
+
+// paths thickened, tips spawned from by each task, and children merged, at a
+// time
+#define RADIAL_BATCH 65536
+#define TIP_BATCH 256
+#define MERGE_BATCH 4096
+
+// scratch for one growth step, shared by the tasks run on the pool
+typedef struct {
+    struct forest_s * forest;
+    growth_stage_e stage;
+    vec_float rates;
+    size_t num_tasks;
+    // radial growth covers the paths there were at the start of the step,
+    // the next batch starts at next and the tasks split [begin, end)
+    size_t num_paths;
+    size_t next;
+    size_t begin;
+    size_t end;
+    // task k spawns from tips tip_start[k] .. tip_start[k + 1], which are
+    // exactly the tips of its group of trees, and has got as far as
+    // tip_next[k]
+    vec_size_t tip_start;
+    vec_size_t tip_next;
+    // children spawned by each task, merged back in task order. The merge
+    // first takes the shade of tips up to next away
+    vec_path_t * children;
+    size_t merge_task;
+    size_t next_child;
+    // time spent in each stage of this step so far
+    uint64_t elapsed[MAX_GROWTH_STAGE];
+} growth_t;
+
+typedef struct forest_s {
+    uint64_t seed;
+    // trees stand in the middle of a grid of side by side spots, copies of
+    // them in the rest
+    size_t side;
+    vec_tree_t trees;
+    vec_tree_copy_t copies;
+    vec_chunk_t chunks;
+    paths_t paths;
+    growth_stats_t stats;
+    growth_t growth;
+    lod_scratch_t lod;
+    // the cells every segment end lies in, only added to between the
+    // parallel parts of a step so that new_paths sees the same grid whatever
+    // the number of threads
+    grid_t grid;
+    // shade cast by the current tips, kept up to date the same way
+    light_t light;
+    // time spent on the slices of meshing done so far since the mesh was
+    // last brought up to date, recorded as one when it is
+    uint64_t geometry_elapsed;
+} forest_t;
+
+paths_t paths_init();
+
+void paths_free(paths_t * paths);
+
+size_t paths_size(paths_t * paths);
+
+size_t paths_push_back(paths_t * paths, path_t path);
+
+path_t paths_at(paths_t * paths, size_t i);
+
+// the frame at the far end of segment i
+mat4s paths_end_frame(paths_t * paths, size_t i);
+
+// plants num_trees shoots, rounded down to a square, on a square grid in
+// chunks. num_tasks is how many pieces each growth step is split into
+forest_t forest_init(size_t num_trees, uint64_t seed, size_t num_tasks);
+
+// a grid of num_trees spots, as forest_init, with shoots planted only in the
+// square of num_templates spots in the middle. Every other spot has a copy of
+// one of them, picked and varied from the seed
+forest_t forest_init_templates(size_t num_trees, size_t num_templates, uint64_t seed,
+        size_t num_tasks);
+
+// has the tips cast shade depth metres down rather than SHADOW_DEPTH, casting
+// the current tips' shade again. Not while a step is in progress
+void forest_set_shadow_depth(forest_t * forest, float depth);
+
+// lays the trees out in chunks again, and places their copies, for trees
+// planted on a grid of the forest's side and then replaced, as by a snapshot
+void forest_index_chunks(forest_t * forest);
+
+void forest_free(forest_t * forest);
+
+uint64_t forest_seed_from_env();
+
+void forest_print_stats(forest_t * forest);
+
+void radial_growth(paths_t * paths, const float * rates, size_t begin, size_t end);
+
+void new_paths(uint64_t seed, paths_t * paths, vec_tree_t * trees, grid_t * grid,
+        light_t * light, size_t begin, size_t end, vec_path_t * children);
+
+// works on a growth step, starting one if none is in progress, until it is
+// finished or deadline, from timing_now, passes. Always gets at least one
+// chunk done. Returns true once the step is finished
+bool grow_until(forest_t * forest, pool_t * pool, uint64_t deadline);
+
+// a whole growth step
+void grow(forest_t * forest, pool_t * pool);
+
+// meshes the segments added since the last call until it is done or deadline
+// passes, returning true once it is done. Everything else in the mesh is
+// only brought up to date once the segments are
+bool new_geometry_until(forest_t * forest, mesh_t * mesh, uint64_t deadline);
+
+void new_geometry(forest_t * forest, mesh_t * mesh);
+
+#endif
@@ -0,0 +1,99 @@
+#include "grid.h"
+
+#include <math.h>
+#include <string.h>
+
+// segment ends in a cell that count as full
+#define FULL 4
+
+static const float inv_cell = 1.0f / GRID_CELL;
+
+grid_t grid_init() {
+    return (grid_t){
+        .map = brick_map_init(),
+        .bricks = vec_brick_t_init()
+    };
+}
+
+void grid_free(grid_t * grid) {
+    brick_map_free(&grid->map);
+    vec_brick_t_free(&grid->bricks);
+}
+
+typedef struct {
+    int64_t x, y, z;
+} coord_t;
+
+static coord_t cell_coord(vec3s p) {
+    return (coord_t){floorf(p.x * inv_cell), floorf(p.y * inv_cell), floorf(p.z * inv_cell)};
+}
+
+static uint64_t coord_key(coord_t c) {
+    return brick_key(c.x, c.y, c.z);
+}
+
+static size_t cell_index(coord_t c) {
+    return brick_cell(c.x, c.y, c.z);
+}
+
+static brick_t * brick_at(grid_t * grid, uint64_t key) {
+    size_t b = brick_map_find(&grid->map, key);
+    return b == NO_BRICK ? NULL : vec_brick_t_at(&grid->bricks, b);
+}
+
+void grid_reindex(grid_t * grid) {
+    brick_map_reset(&grid->map, vec_brick_t_size(&grid->bricks));
+    foreach(vec_brick_t, &grid->bricks, it) {
+        brick_map_add(&grid->map, it.ref->key);
+    }
+}
+
+void grid_add(grid_t * grid, vec3s p, size_t tree) {
+    coord_t c = cell_coord(p);
+    uint64_t key = coord_key(c);
+    brick_t * brick = brick_at(grid, key);
+    if (!brick) {
+        brick_map_add(&grid->map, key);
+        brick_t empty = {.key = key};
+        memset(empty.cells, 0, sizeof(empty.cells));
+        vec_brick_t_push_back(&grid->bricks, empty);
+        brick = vec_brick_t_at(&grid->bricks, vec_brick_t_size(&grid->bricks) - 1);
+    }
+    cell_t * cell = &brick->cells[cell_index(c)];
+    if (cell->count++ == 0) {
+        cell->tree = tree;
+    }
+}
+
+const cell_t * grid_at(grid_t * grid, vec3s p) {
+    coord_t c = cell_coord(p);
+    brick_t * brick = brick_at(grid, coord_key(c));
+    if (!brick || brick->cells[cell_index(c)].count == 0) {
+        return NULL;
+    }
+    return &brick->cells[cell_index(c)];
+}
+
+vec3s grid_away(grid_t * grid, vec3s p) {
+    static const int faces[6][3] = {
+        {-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}
+    };
+    coord_t c = cell_coord(p);
+    uint64_t key = coord_key(c);
+    brick_t * brick = brick_at(grid, key);
+    vec3s away = glms_vec3_zero();
+    for (int f = 0; f < 6; f++) {
+        coord_t n = {c.x + faces[f][0], c.y + faces[f][1], c.z + faces[f][2]};
+        // only a neighbour across the side of the brick needs another lookup
+        uint64_t n_key = coord_key(n);
+        brick_t * n_brick = n_key == key ? brick : brick_at(grid, n_key);
+        if (!n_brick) {
+            continue;
+        }
+        uint32_t count = n_brick->cells[cell_index(n)].count;
+        float crowding = count < FULL ? count / (float)FULL : 1.0f;
+        away = glms_vec3_sub(away,
+            glms_vec3_scale((vec3s){faces[f][0], faces[f][1], faces[f][2]}, crowding));
+    }
+    return away;
+}
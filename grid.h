@@ -0,0 +1,52 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include "bricks.h"
+
+// side of a grid cell in metres, about the length of a leader segment
+#define GRID_CELL 0.05f
+
+// how many segment ends lie in a cell and the tree that reached it first
+typedef struct {
+    uint32_t count;
+    uint32_t tree;
+} cell_t;
+
+typedef struct {
+    uint64_t key;
+    cell_t cells[BRICK_CELLS];
+} brick_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T brick_t
+#include <ctl/vector.h>
+
+// the occupied part of an unbounded uniform grid: bricks that hold at least
+// one segment end, found through a brick_map_t so that adding and looking up
+// a point cost the same however large the forest grows. Lookups don't write,
+// so any number of threads may look up while nothing is being added
+typedef struct {
+    brick_map_t map;
+    vec_brick_t bricks;
+} grid_t;
+
+grid_t grid_init();
+
+void grid_free(grid_t * grid);
+
+// rebuilds the hash table after the bricks were filled in directly, as when
+// loading a snapshot
+void grid_reindex(grid_t * grid);
+
+// marks the cell holding p as reached by tree
+void grid_add(grid_t * grid, vec3s p, size_t tree);
+
+// the cell holding p, NULL if it is empty
+const cell_t * grid_at(grid_t * grid, vec3s p);
+
+// the sum of the directions from the cell holding p to the six cells sharing
+// a face with it, weighted by how full each is. Pointing out of the crowd
+vec3s grid_away(grid_t * grid, vec3s p);
+
+#endif
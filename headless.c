@@ -0,0 +1,299 @@
+// grows a forest without a window or GL context and reports throughput,
+// for machines with no display
+#include "capture.h"
+#include "export.h"
+#include "forest.h"
+#include "mesh.h"
+#include "pool.h"
+#include "raster.h"
+#include "snapshot.h"
+#include "timing.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// set by SIGUSR1, the timings so far are printed after the step in progress
+static volatile sig_atomic_t print_timing;
+
+static void request_timing(int sig) {
+    (void)sig;
+    print_timing = 1;
+}
+
+static double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// the size of the images -r and -c render unless -s is given
+#define RENDER_WIDTH 800
+#define RENDER_HEIGHT 600
+
+// draws the forest with the software renderer, as tree would show it, and
+// writes the frame as a binary PPM
+static bool render_ppm(mesh_t * mesh, const char * filename, int render_width,
+        int render_height) {
+    renderer_t * renderer = renderer_init(render_width, render_height);
+    renderer_upload_vertices(renderer, mesh);
+    renderer_render(renderer, render_width, render_height);
+    int width, height;
+    const uint8_t * pixels = renderer_pixels(renderer, &width, &height);
+    FILE * file = fopen(filename, "wb");
+    if (!file) {
+        perror(filename);
+        renderer_free(&renderer);
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    uint8_t * row = malloc(width * 3);
+    bool ok = true;
+    for (int y = 0; y < height && ok; y++) {
+        for (int x = 0; x < width; x++) {
+            memcpy(row + x * 3, pixels + ((size_t)y * width + x) * 4, 3);
+        }
+        ok = fwrite(row, 3, width, file) == (size_t)width;
+    }
+    free(row);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "%s: failed writing\n", filename);
+    }
+    renderer_free(&renderer);
+    return ok;
+}
+
+static void usage(const char * name) {
+    fprintf(stderr,
+        "usage: %s [-n steps] [-t trees] [-k templates] [-g] [-i] [-l file [-m]] [-w file] [-e file] [-r file]\n"
+        "       [-c file [-f frames]] [-s WxH] [-d metres]\n"
+        "  -n  growth steps to run (default 200)\n"
+        "  -t  number of trees (default 16)\n"
+        "  -k  grow only this many of the trees, the rest are copies of them\n"
+        "  -g  also build the vertex arrays after every step\n"
+        "  -i  with -g, mesh branches as instances rather than rings\n"
+        "  -l  start from the forest in a snapshot rather than from shoots\n"
+        "  -m  with -l, memory map the snapshot rather than reading it\n"
+        "  -w  write a snapshot of the forest after the last step\n"
+        "  -e  export the mesh after the last step to a .obj or .ply file, the grown\n"
+        "      trees only and not their copies\n"
+        "  -r  render the forest after the last step on the CPU to a .ppm file\n"
+        "  -c  render a time-lapse of the growth on the CPU to a .y4m file, or a\n"
+        "      sequence of .png files numbered from the name given\n"
+        "  -f  with -c, frames rendered for each step (default 1)\n"
+        "  -s  size of the images -r and -c render (default 800x600)\n"
+        "  -d  how far below itself a tip casts shade (default 3, or the snapshot's)\n",
+        name);
+}
+
+int main(int argc, char ** argv) {
+    size_t num_steps = 200;
+    size_t num_trees = 16;
+    size_t num_templates = 0;
+    bool geometry = false;
+    bool instanced = false;
+    const char * load = NULL;
+    bool map = false;
+    const char * save = NULL;
+    const char * export = NULL;
+    const char * render = NULL;
+    const char * capture_file = NULL;
+    int frames_per_step = 1;
+    int render_width = RENDER_WIDTH;
+    int render_height = RENDER_HEIGHT;
+    // below zero leaves the forest's own
+    float shadow_depth = -1.0f;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:k:gil:mw:e:r:c:f:s:d:")) != -1) {
+        switch (opt) {
+        case 'n':
+            num_steps = strtoull(optarg, NULL, 0);
+            break;
+        case 't':
+            num_trees = strtoull(optarg, NULL, 0);
+            break;
+        case 'k':
+            num_templates = strtoull(optarg, NULL, 0);
+            break;
+        case 'g':
+            geometry = true;
+            break;
+        case 'i':
+            instanced = true;
+            break;
+        case 'l':
+            load = optarg;
+            break;
+        case 'm':
+            map = true;
+            break;
+        case 'w':
+            save = optarg;
+            break;
+        case 'e':
+            export = optarg;
+            break;
+        case 'r':
+            render = optarg;
+            break;
+        case 'c':
+            capture_file = optarg;
+            break;
+        case 'f':
+            frames_per_step = atoi(optarg);
+            if (frames_per_step < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &render_width, &render_height) != 2 ||
+                    render_width < 1 || render_height < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'd':
+            shadow_depth = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // everything is freed on the way out, whether or not the run failed
+    int status = 0;
+    const char * threads = getenv("TREE_THREADS");
+    pool_t * pool = pool_init(threads ? atoi(threads) : 0);
+    forest_t forest = forest_init_templates(num_trees, num_templates ? num_templates : num_trees,
+        forest_seed_from_env(), pool_num_threads(pool) * 4);
+    mesh_t mesh = mesh_init();
+    mesh.instanced = instanced;
+    renderer_t * renderer = NULL;
+    capture_t * capture = NULL;
+    if (load) {
+        double start = seconds();
+        if (!snapshot_load(&forest, load, pool_num_threads(pool) * 4, map)) {
+            status = 1;
+            goto done;
+        }
+        printf("loaded %zu segments in %.3fs\n", paths_size(&forest.paths), seconds() - start);
+    }
+    if (shadow_depth >= 0.0f) {
+        forest_set_shadow_depth(&forest, shadow_depth);
+    }
+
+    // a time-lapse is rendered as the forest grows, so needs the mesh of
+    // every step
+    if (capture_file) {
+        capture = capture_init(capture_file, render_width, render_height, 60);
+        if (!capture) {
+            status = 1;
+            goto done;
+        }
+        renderer = renderer_init(render_width, render_height);
+        renderer_set_capture(renderer, capture);
+        geometry = true;
+    }
+
+    size_t initial_segments = paths_size(&forest.paths);
+    size_t vertices = 0;
+    double grow_time = 0.0;
+    double mesh_time = 0.0;
+
+    signal(SIGUSR1, request_timing);
+    for (size_t step = 0; step < num_steps; step++) {
+        double start = seconds();
+        grow(&forest, pool);
+        double grown = seconds();
+        grow_time += grown - start;
+        if (geometry) {
+            // rings already in the mesh are kept rather than rebuilt
+            size_t kept = 0;
+            for (size_t c = 0; c < mesh.num_chunks; c++) {
+                kept += vec_ring_vertex_t_size(&mesh.chunks[c].rings);
+            }
+            new_geometry(&forest, &mesh);
+            mesh_time += seconds() - grown;
+            vertices += mesh_num_vertices(&mesh) - kept;
+        }
+        if (capture) {
+            // offline, so every frame waits its turn to be written rather
+            // than being dropped
+            renderer_upload_vertices(renderer, &mesh);
+            for (int f = 0; f < frames_per_step; f++) {
+                capture_wait(capture);
+                renderer_update(renderer);
+                renderer_capture_frame(renderer);
+                renderer_render(renderer, render_width, render_height);
+            }
+        }
+        if (print_timing) {
+            print_timing = 0;
+            timing_print(stdout);
+        }
+    }
+
+    size_t segments = paths_size(&forest.paths);
+    printf("threads %zu trees %zu steps %zu segments %zu\n",
+        pool_num_threads(pool), vec_tree_t_size(&forest.trees), num_steps, segments);
+    if (vec_tree_copy_t_size(&forest.copies) > 0) {
+        printf("copies %zu\n", vec_tree_copy_t_size(&forest.copies));
+    }
+    printf("steps/s %.1f\n", num_steps / grow_time);
+    printf("segments/s %.0f\n", (segments - initial_segments) / grow_time);
+    if (geometry) {
+        printf("vertices %zu\n", mesh_num_vertices(&mesh));
+        printf("vertices/s %.0f\n", vertices / mesh_time);
+        for (int lod = 0; lod < NUM_LODS; lod++) {
+            printf("lod %d indices %zu leaf clusters %zu\n", lod,
+                lod ? vec_uint32_t_size(&mesh.lods[lod].indices) : mesh_num_indices(&mesh),
+                vec_leaf_instance_t_size(&mesh.lods[lod].leaves));
+        }
+        if (instanced) {
+            size_t instances = 0;
+            for (size_t c = 0; c < mesh.num_chunks; c++) {
+                instances += vec_segment_instance_t_size(&mesh.chunks[c].instances);
+            }
+            printf("instances %zu, %zu bytes\n", instances, instances * sizeof(segment_instance_t));
+        }
+    }
+    if (capture) {
+        renderer_free(&renderer);
+        printf("captured %zu frames, dropped %zu\n", capture_frames(capture),
+            capture_dropped(capture));
+        if (!capture_free(&capture)) {
+            status = 1;
+            goto done;
+        }
+    }
+    forest_print_stats(&forest);
+    timing_print(stdout);
+    if (save && !snapshot_save(&forest, save)) {
+        status = 1;
+        goto done;
+    }
+    if (export || render) {
+        // without -g the mesh was never built
+        new_geometry(&forest, &mesh);
+    }
+    if ((export && !export_mesh(&mesh, export)) ||
+            (render && !render_ppm(&mesh, render, render_width, render_height))) {
+        status = 1;
+    }
+
+done:
+    // the renderer hands over the frames it's still reading back
+    renderer_free(&renderer);
+    capture_free(&capture);
+    mesh_free(&mesh);
+    forest_free(&forest);
+    pool_free(&pool);
+    return status;
+}
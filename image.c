@@ -0,0 +1,33 @@
+#include "image.h"
+
+#include <string.h>
+
+mip_chain_t mip_chain(size_t dim, uint8_t *data, vec_uint8_t *output) {
+    mip_chain_t chain = {.dim = dim};
+    // a mip map chain always fits in twice the original size
+    vec_uint8_t_resize(output, dim * dim * 4 * 2, 0);
+    uint8_t *p = vec_uint8_t_data(output);
+    memcpy(p, data, dim * dim * 4);
+    do {
+        size_t size = dim * dim * 4;
+        chain.level[chain.num_mipmaps] = p;
+        chain.size[chain.num_mipmaps] = size;
+        chain.num_mipmaps += 1;
+        uint8_t * src = p;
+        p += size;
+        dim = dim >> 1;
+        for (size_t y = 0; y < dim; y++) {
+            for (size_t x = 0; x < dim; x++) {
+                for (size_t k = 0; k < 4; k++) {
+                    size_t s00 = k + (x * 2 + y * 4 * dim) * 4; 
+                    p[k + (x + y * dim) * 4] =
+                        (src[s00] +
+                        src[s00 + 4] +
+                        src[s00 + 2 * dim * 4] +
+                        src[s00 + 2 * dim * 4 + 4]) / 4;
+                }
+            }
+        }
+    } while(dim > 0);
+    return chain;
+}
@@ -0,0 +1,19 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "vectors.h"
+
+#define MAX_MIPMAPS 16
+
+// RGBA8 levels, each half the size of the one before
+typedef struct {
+    size_t dim;
+    int num_mipmaps;
+    uint8_t * level[MAX_MIPMAPS];
+    size_t size[MAX_MIPMAPS];
+} mip_chain_t;
+
+// recursively subdivide the image, assumes the source is power of two square
+mip_chain_t mip_chain(size_t dim, uint8_t *data, vec_uint8_t *output);
+
+#endif
@@ -0,0 +1,113 @@
+#include "light.h"
+
+#include <math.h>
+#include <string.h>
+
+// shade, in tips directly overhead, at which a tip gets no light at all
+#define DARK 8.0f
+
+static const float inv_cell = 1.0f / LIGHT_CELL;
+
+light_t light_init(float depth) {
+    depth = fminf(fmaxf(depth, 0.0f), MAX_SHADOW_DEPTH);
+    return (light_t){
+        .map = brick_map_init(),
+        .bricks = vec_light_brick_t_init(),
+        .depth = depth,
+        .layers = (int)ceilf(depth * inv_cell),
+    };
+}
+
+void light_free(light_t * light) {
+    brick_map_free(&light->map);
+    vec_light_brick_t_free(&light->bricks);
+}
+
+typedef struct {
+    int64_t x, y, z;
+} voxel_t;
+
+static voxel_t voxel_of(vec3s p) {
+    return (voxel_t){floorf(p.x * inv_cell), floorf(p.y * inv_cell), floorf(p.z * inv_cell)};
+}
+
+void light_reindex(light_t * light) {
+    brick_map_reset(&light->map, vec_light_brick_t_size(&light->bricks));
+    foreach(vec_light_brick_t, &light->bricks, it) {
+        brick_map_add(&light->map, it.ref->key);
+        it.ref->total = 0;
+        for (size_t i = 0; i < BRICK_CELLS; i++) {
+            it.ref->total += it.ref->shade[i];
+        }
+    }
+}
+
+// the index rather than the brick, adding a brick may move the others
+static size_t brick_or_new(light_t * light, uint64_t key) {
+    size_t b = brick_map_find(&light->map, key);
+    if (b != NO_BRICK) {
+        return b;
+    }
+    light_brick_t empty = {.key = key, .total = 0};
+    memset(empty.shade, 0, sizeof(empty.shade));
+    vec_light_brick_t_push_back(&light->bricks, empty);
+    return brick_map_add(&light->map, key);
+}
+
+// the last brick takes the place of brick b
+static void free_brick(light_t * light, size_t b) {
+    light_brick_t * brick = vec_light_brick_t_at(&light->bricks, b);
+    size_t last = vec_light_brick_t_size(&light->bricks) - 1;
+    light_brick_t * moved = vec_light_brick_t_at(&light->bricks, last);
+    brick_map_remove(&light->map, brick->key, moved->key);
+    *brick = *moved;
+    vec_light_brick_t_pop_back(&light->bricks);
+}
+
+// adds sign times the cone of shade below p, a layer at a time. Each layer is
+// walked a brick at a time so that a brick is only looked up once a layer
+static void cast(light_t * light, vec3s p, int32_t sign) {
+    const int64_t mask = BRICK - 1;
+    voxel_t tip = voxel_of(p);
+    for (int q = 0; q <= light->layers; q++) {
+        int64_t r = q / SHADOW_SPREAD < SHADOW_RADIUS ? q / SHADOW_SPREAD : SHADOW_RADIUS;
+        int32_t shade = sign * (TIP_SHADE / (int32_t)((2 * r + 1) * (2 * r + 1)));
+        int64_t y = tip.y - q;
+        for (int64_t x0 = tip.x - r; x0 <= tip.x + r; x0 = (x0 | mask) + 1) {
+            int64_t x1 = (x0 | mask) < tip.x + r ? (x0 | mask) : tip.x + r;
+            for (int64_t z0 = tip.z - r; z0 <= tip.z + r; z0 = (z0 | mask) + 1) {
+                int64_t z1 = (z0 | mask) < tip.z + r ? (z0 | mask) : tip.z + r;
+                size_t b = brick_or_new(light, brick_key(x0, y, z0));
+                light_brick_t * brick = vec_light_brick_t_at(&light->bricks, b);
+                for (int64_t x = x0; x <= x1; x++) {
+                    for (int64_t z = z0; z <= z1; z++) {
+                        brick->shade[brick_cell(x, y, z)] += shade;
+                    }
+                }
+                // shade is never negative, so a brick summing to nothing is
+                // empty
+                brick->total += (int64_t)shade * (x1 - x0 + 1) * (z1 - z0 + 1);
+                if (brick->total == 0) {
+                    free_brick(light, b);
+                }
+            }
+        }
+    }
+}
+
+void light_add_tip(light_t * light, vec3s p) {
+    cast(light, p, 1);
+}
+
+void light_remove_tip(light_t * light, vec3s p) {
+    cast(light, p, -1);
+}
+
+float light_exposure(light_t * light, vec3s p) {
+    voxel_t v = voxel_of(p);
+    size_t b = brick_map_find(&light->map, brick_key(v.x, v.y, v.z));
+    float shadow = b == NO_BRICK ? 0.0f :
+        vec_light_brick_t_at(&light->bricks, b)->shade[brick_cell(v.x, v.y, v.z)] /
+        (float)TIP_SHADE - 1.0f;
+    return shadow <= 0.0f ? 1.0f : fmaxf(0.0f, 1.0f - shadow / DARK);
+}
@@ -0,0 +1,69 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "bricks.h"
+
+// side of a light voxel in metres, coarser than the occupancy grid
+#define LIGHT_CELL 0.2f
+// how far below itself, in metres, a tip casts shade unless told otherwise,
+// and the most it can be told
+#define SHADOW_DEPTH 3.0f
+#define MAX_SHADOW_DEPTH 20.0f
+// the cone of shade under a tip widens by a voxel on every side every this
+// many layers, until it is this many voxels either side of the tip. Past
+// that it goes straight down, so a tip touches at most (2 SHADOW_RADIUS + 1)²
+// voxels a layer however deep its shade
+#define SHADOW_SPREAD 4
+#define SHADOW_RADIUS 3
+// the shade of a tip spread over one layer of its cone. Every layer's
+// (2r + 1)² voxels divide it, so each voxel takes a whole share and removing a
+// tip takes back exactly what adding it put in
+#define TIP_SHADE (1 * 9 * 25 * 49)
+
+// shade in voxels of TIP_SHADE a tip, and its sum over the brick, so that a
+// brick left in the light is seen without looking at every voxel
+typedef struct {
+    uint64_t key;
+    int64_t total;
+    int32_t shade[BRICK_CELLS];
+} light_brick_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T light_brick_t
+#include <ctl/vector.h>
+
+// shadow cast by the leaf tips, accumulated in sparse voxels. Each tip adds a
+// cone of shade below it when it appears and takes it away again when it
+// spawns, so the grid always holds the shade of the current tips without
+// ever being rebuilt. A tip's shade is spread evenly over each layer of its
+// cone, so it falls off with the square of the distance below the tip until
+// the cone stops widening. Laid out like grid_t: bricks found through a
+// brick_map_t, and lookups don't write. A brick is freed once the last tip
+// shading it is removed
+typedef struct {
+    brick_map_t map;
+    vec_light_brick_t bricks;
+    // metres of shade under a tip, and the layers of voxels that spans
+    float depth;
+    int layers;
+} light_t;
+
+// tips cast shade depth metres down, clamped to 0 .. MAX_SHADOW_DEPTH
+light_t light_init(float depth);
+
+void light_free(light_t * light);
+
+// rebuilds the hash table and the totals after the bricks were filled in
+// directly
+void light_reindex(light_t * light);
+
+void light_add_tip(light_t * light, vec3s p);
+
+void light_remove_tip(light_t * light, vec3s p);
+
+// how much light reaches a tip at p, from 1 in the open down to 0 in deep
+// shade. The tip's own shadow isn't counted
+float light_exposure(light_t * light, vec3s p);
+
+#endif
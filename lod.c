@@ -0,0 +1,214 @@
+#include "lod.h"
+#include "forest.h"
+#include "timing.h"
+
+#include <math.h>
+#include <string.h>
+
+// per level, the thinnest branch kept and how close in direction to the first
+// segment of a straight run a segment must be to join it
+static const float min_radius[NUM_LODS] = {0.0f, 0.02f, 0.04f, 0.08f};
+static const float min_cos[NUM_LODS] = {1.0f, 0.98f, 0.9f, 0.8f};
+// a cluster standing in for the leaves of dropped twigs grows with the number
+// of tips it replaces, up to this
+static const float max_leaf_scale = 3.0f;
+// a tree is drawn at the first level whose screen size it is larger than
+static const float lod_screen_size[NUM_LODS] = {0.25f, 0.1f, 0.04f, 0.0f};
+
+lod_scratch_t lod_scratch_init() {
+    return (lod_scratch_t){
+        .builds = 0,
+        .stage = 0,
+        .by_tree = vec_size_t_init(),
+        .tree_start = vec_size_t_init(),
+        .tips_below = vec_float_init(),
+        .unit_direction = vec_vec3s_init(),
+        .kept = vec_uint8_t_init(),
+        .kept_children = vec_uint8_t_init(),
+        .continues = vec_uint8_t_init(),
+        .chain_first = vec_size_t_init(),
+    };
+}
+
+void lod_scratch_free(lod_scratch_t * scratch) {
+    vec_size_t_free(&scratch->by_tree);
+    vec_size_t_free(&scratch->tree_start);
+    vec_float_free(&scratch->tips_below);
+    vec_vec3s_free(&scratch->unit_direction);
+    vec_uint8_t_free(&scratch->kept);
+    vec_uint8_t_free(&scratch->kept_children);
+    vec_uint8_t_free(&scratch->continues);
+    vec_size_t_free(&scratch->chain_first);
+}
+
+static void zero(vec_uint8_t * v, size_t n) {
+    vec_uint8_t_clear(v);
+    vec_uint8_t_resize(v, n, 0);
+}
+
+// a counting sort of the segments by tree, which keeps each tree's in order
+static void sort_by_tree(lod_scratch_t * scratch, paths_t * paths, size_t num_trees) {
+    const size_t n = paths_size(paths);
+    const size_t * tree = vec_size_t_data(&paths->tree);
+    vec_size_t_clear(&scratch->tree_start);
+    vec_size_t_resize(&scratch->tree_start, num_trees + 2, 0);
+    size_t * start = vec_size_t_data(&scratch->tree_start);
+    for (size_t i = 0; i < n; i++) {
+        start[tree[i] + 2]++;
+    }
+    for (size_t t = 0; t < num_trees; t++) {
+        start[t + 2] += start[t + 1];
+    }
+    vec_size_t_resize(&scratch->by_tree, n, 0);
+    size_t * by_tree = vec_size_t_data(&scratch->by_tree);
+    // start[t + 1] is the cursor for tree t and ends up at the start of t + 1
+    for (size_t i = 0; i < n; i++) {
+        by_tree[start[tree[i] + 1]++] = i;
+    }
+    vec_size_t_resize(&scratch->tree_start, num_trees + 1, 0);
+}
+
+// unit directions for the straightness tests, and as children always come
+// after their parents a reverse pass adds up the tips below each segment
+static void summarise_skeleton(lod_scratch_t * scratch, paths_t * paths) {
+    const size_t n = paths_size(paths);
+    const vec3s * direction = vec_vec3s_data(&paths->direction);
+    vec_vec3s_resize(&scratch->unit_direction, n, (vec3s){0});
+    vec3s * unit = vec_vec3s_data(&scratch->unit_direction);
+    for (size_t i = 0; i < n; i++) {
+        unit[i] = glms_vec3_normalize(direction[i]);
+    }
+    const size_t * last_path = vec_size_t_data(&paths->last_path);
+    const uint8_t * is_leaf = vec_uint8_t_data(&paths->is_leaf);
+    vec_float_resize(&scratch->tips_below, n, 0.0f);
+    float * tips = vec_float_data(&scratch->tips_below);
+    for (size_t i = 0; i < n; i++) {
+        tips[i] = is_leaf[i];
+    }
+    for (size_t i = n; i-- > 0;) {
+        if (last_path[i] != i) {
+            tips[last_path[i]] += tips[i];
+        }
+    }
+}
+
+// one cluster per tip, the tips are already ordered by tree
+static void full_detail_leaves(paths_t * paths, size_t num_trees, mesh_t * mesh) {
+    const size_t * tips = vec_size_t_data(&paths->tips);
+    const size_t num_tips = vec_size_t_size(&paths->tips);
+    const size_t * tree = vec_size_t_data(&paths->tree);
+    const float * radius = vec_float_data(&paths->radius);
+    size_t k = 0;
+    for (size_t t = 0; t < num_trees; t++) {
+        mesh_lod_mark(mesh, 0);
+        for (; k < num_tips && tree[tips[k]] == t; k++) {
+            size_t i = tips[k];
+            mesh_add_leaves(mesh, 0, t, paths_end_frame(paths, i), radius[i], 1.0f);
+        }
+    }
+    mesh_lod_mark(mesh, 0);
+}
+
+static void coarse_level(lod_scratch_t * scratch, paths_t * paths, size_t num_trees,
+        int lod, mesh_t * mesh) {
+    const size_t n = paths_size(paths);
+    const size_t * last_path = vec_size_t_data(&paths->last_path);
+    const vec3s * unit = vec_vec3s_data(&scratch->unit_direction);
+    const float * radius = vec_float_data(&paths->radius);
+    const float * tips_below = vec_float_data(&scratch->tips_below);
+    zero(&scratch->kept, n);
+    zero(&scratch->kept_children, n);
+    zero(&scratch->continues, n);
+    vec_size_t_resize(&scratch->chain_first, n, 0);
+    uint8_t * kept = vec_uint8_t_data(&scratch->kept);
+    uint8_t * kept_children = vec_uint8_t_data(&scratch->kept_children);
+    uint8_t * continues = vec_uint8_t_data(&scratch->continues);
+    size_t * chain_first = vec_size_t_data(&scratch->chain_first);
+
+    // a twig is dropped with everything growing from it, shoots are always kept
+    for (size_t i = 0; i < n; i++) {
+        size_t p = last_path[i];
+        kept[i] = p == i || (kept[p] && radius[i] >= min_radius[lod]);
+        if (kept[i] && p != i && kept_children[p] < UINT8_MAX) {
+            kept_children[p]++;
+        }
+    }
+
+    // an only child joins its parent's run if it still points the same way
+    for (size_t i = 0; i < n; i++) {
+        if (!kept[i]) {
+            continue;
+        }
+        size_t p = last_path[i];
+        chain_first[i] = i;
+        if (p != i && kept_children[p] == 1) {
+            size_t first = chain_first[p];
+            if (glms_vec3_dot(unit[first], unit[i]) >= min_cos[lod]) {
+                chain_first[i] = first;
+                continues[p] = true;
+            }
+        }
+    }
+
+    const size_t * by_tree = vec_size_t_data(&scratch->by_tree);
+    const size_t * start = vec_size_t_data(&scratch->tree_start);
+    bool has_rings = vec_size_t_size(&mesh->end_rings) == n;
+    for (size_t t = 0; t < num_trees; t++) {
+        mesh_lod_mark(mesh, lod);
+        for (size_t k = start[t]; k < start[t + 1]; k++) {
+            size_t i = by_tree[k];
+            if (!kept[i]) {
+                continue;
+            }
+            if (has_rings && !continues[i]) {
+                mesh_add_lod_cylinder(mesh, lod,
+                    *vec_size_t_at(&mesh->start_rings, chain_first[i]),
+                    *vec_size_t_at(&mesh->end_rings, i));
+            }
+            if (kept_children[i] == 0) {
+                float scale = fminf(sqrtf(tips_below[i]), max_leaf_scale);
+                mesh_add_leaves(mesh, lod, t, paths_end_frame(paths, i), radius[i], scale);
+            }
+        }
+    }
+    mesh_lod_mark(mesh, lod);
+}
+
+// each call does the next stage: the leaves, then the skeleton summary, then
+// one coarse level at a time
+bool lod_build_until(lod_scratch_t * scratch, paths_t * paths, size_t num_trees, mesh_t * mesh,
+        uint64_t deadline) {
+    do {
+        if (scratch->stage == 0) {
+            mesh_clear_lod(mesh, 0);
+            full_detail_leaves(paths, num_trees, mesh);
+            bool cleared = vec_size_t_size(&mesh->lods[1].index_start) == 0;
+            if (scratch->builds++ % LOD_INTERVAL != 0 && !cleared) {
+                return true;
+            }
+            scratch->stage = 1;
+        } else if (scratch->stage == 1) {
+            sort_by_tree(scratch, paths, num_trees);
+            summarise_skeleton(scratch, paths);
+            scratch->stage = 2;
+        } else {
+            int lod = scratch->stage - 1;
+            mesh_clear_lod(mesh, lod);
+            coarse_level(scratch, paths, num_trees, lod, mesh);
+            scratch->stage = lod + 1 < NUM_LODS ? scratch->stage + 1 : 0;
+        }
+    } while (scratch->stage != 0 && timing_now() < deadline);
+    return scratch->stage == 0;
+}
+
+void lod_build(lod_scratch_t * scratch, paths_t * paths, size_t num_trees, mesh_t * mesh) {
+    lod_build_until(scratch, paths, num_trees, mesh, UINT64_MAX);
+}
+
+int lod_for_screen_size(float size) {
+    int lod = 0;
+    while (lod < NUM_LODS - 1 && size <= lod_screen_size[lod]) {
+        lod++;
+    }
+    return lod;
+}
@@ -0,0 +1,50 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include "mesh.h"
+#include "vectors.h"
+
+struct paths_s;
+
+// the coarse levels are only rebuilt every this many builds,
+// the full detail leaves every build
+#define LOD_INTERVAL 8
+
+// per segment scratch for building the levels of detail, kept between steps
+typedef struct {
+    size_t builds;
+    // how far a build done in slices has got, 0 when none is part done
+    int stage;
+    // segments of each tree in order, tree t's at tree_start[t] ..
+    vec_size_t by_tree;
+    vec_size_t tree_start;
+    vec_float tips_below;
+    vec_vec3s unit_direction;
+    vec_uint8_t kept;
+    vec_uint8_t kept_children;
+    // set when a segment is drawn as part of one cylinder with its only child
+    vec_uint8_t continues;
+    // first segment of the straight run a segment ends
+    vec_size_t chain_first;
+} lod_scratch_t;
+
+lod_scratch_t lod_scratch_init();
+
+void lod_scratch_free(lod_scratch_t * scratch);
+
+// rebuilds the full detail leaves and, every LOD_INTERVAL builds or after the
+// mesh was cleared, the coarse levels of every tree from the skeleton. The
+// full detail rings must already be meshed
+void lod_build(lod_scratch_t * scratch, struct paths_s * paths, size_t num_trees,
+        mesh_t * mesh);
+
+// lod_build a stage at a time until it is done or deadline, from timing_now,
+// passes. Returns true once it is done, the levels are only whole then
+bool lod_build_until(lod_scratch_t * scratch, struct paths_s * paths, size_t num_trees,
+        mesh_t * mesh, uint64_t deadline);
+
+// the level to draw a tree at whose bounding sphere spans size, as a fraction
+// of the viewport height
+int lod_for_screen_size(float size);
+
+#endif
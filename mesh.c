@@ -0,0 +1,477 @@
+#include "mesh.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+const float leaf_cluster[LEAF_CLUSTER_VERTICES][4] = {
+    { 0.0f,   -1.0f,  0.0f,   -1.0f}, { 0.0f,   -1.0f, -0.866f, 0.5f}, { 0.0f,   -1.0f, 0.866f, 0.5f},
+    {-0.866f,  0.5f,  0.0f,   -1.0f}, {-0.866f,  0.5f, -0.866f, 0.5f}, {-0.866f,  0.5f, 0.866f, 0.5f},
+    { 0.866f,  0.5f,  0.0f,   -1.0f}, { 0.866f,  0.5f, -0.866f, 0.5f}, { 0.866f,  0.5f, 0.866f, 0.5f},
+};
+
+const float unit_cylinder[UNIT_CYLINDER_VERTICES][4] = {
+    { 0.0f,    -1.0f, 0.0f, 0.0f}, {-0.866f, 0.5f, 0.0f, 0.5f}, { 0.0f,   -1.0f, 1.0f, 0.0f},
+    {-0.866f,  0.5f, 0.0f, 0.5f}, {-0.866f, 0.5f, 1.0f, 0.5f}, { 0.0f,   -1.0f, 1.0f, 0.0f},
+    {-0.866f,  0.5f, 0.0f, 0.5f}, { 0.866f, 0.5f, 0.0f, 1.0f}, {-0.866f, 0.5f, 1.0f, 0.5f},
+    { 0.866f,  0.5f, 0.0f, 1.0f}, { 0.866f, 0.5f, 1.0f, 1.0f}, {-0.866f, 0.5f, 1.0f, 0.5f},
+    { 0.866f,  0.5f, 0.0f, 1.0f}, { 0.0f,   -1.0f, 0.0f, 0.0f}, { 0.866f, 0.5f, 1.0f, 1.0f},
+    { 0.0f,   -1.0f, 0.0f, 0.0f}, { 0.0f,   -1.0f, 1.0f, 0.0f}, { 0.866f, 0.5f, 1.0f, 1.0f},
+};
+
+typedef struct {
+    vec2s offset;
+    float scale;
+} atlas_t;
+
+static void quantise_position(int16_t * out, vec3s p, int16_t w) {
+    for (int i = 0; i < 3; i++) {
+        float q = roundf(p.raw[i] * POSITION_SCALE);
+        out[i] = q < INT16_MIN ? INT16_MIN : q > INT16_MAX ? INT16_MAX : q;
+    }
+    out[3] = w;
+}
+
+static void quantise_direction(int16_t * out, vec3s n) {
+    vec2s e = oct_encode(n);
+    out[0] = snorm16(e.x);
+    out[1] = snorm16(e.y);
+}
+
+static vertex_t make_vertex(vec3s position, vec3s normal, vec2s texcoord) {
+    vertex_t v;
+    quantise_position(v.position, position, 1);
+    quantise_direction(v.normal, normal);
+    v.texcoord[0] = snorm16(texcoord.x / TEXCOORD_RANGE);
+    v.texcoord[1] = snorm16(texcoord.y / TEXCOORD_RANGE);
+    return v;
+}
+
+static mesh_chunk_t chunk_init(vec3s origin) {
+    mesh_chunk_t chunk = {
+        .origin = origin,
+        .rings = vec_ring_vertex_t_init(),
+        .instances = vec_segment_instance_t_init(),
+        .segments = vec_size_t_init(),
+        .radii = vec_float_init(),
+        .radii_lo = 0,
+        .radii_hi = 0,
+        .copies = vec_mesh_copy_t_init(),
+        .bounds = box_point(origin),
+    };
+    for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+        chunk.vertices[i] = vec_vertex_t_init();
+        chunk.dirty[i] = true;
+    }
+    return chunk;
+}
+
+static void chunk_free(mesh_chunk_t * chunk) {
+    for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+        vec_vertex_t_free(&chunk->vertices[i]);
+    }
+    vec_ring_vertex_t_free(&chunk->rings);
+    vec_segment_instance_t_free(&chunk->instances);
+    vec_size_t_free(&chunk->segments);
+    vec_float_free(&chunk->radii);
+    vec_mesh_copy_t_free(&chunk->copies);
+}
+
+mesh_t mesh_init() {
+    mesh_t mesh = {
+        .num_chunks = 0,
+        .chunks = NULL,
+        .tree_chunk = vec_size_t_init(),
+        .num_trees = 0,
+        .tree_indices = NULL,
+        .tree_instances = NULL,
+        .local_segments = vec_size_t_init(),
+        .start_rings = vec_size_t_init(),
+        .end_rings = vec_size_t_init(),
+        .instanced = false,
+        .bounds = vec_box_t_init(),
+        .leaves_dirty = true,
+        .lods_dirty = true,
+        .shadow_radii = vec_float_init(),
+        .num_segments = 0
+    };
+    for (int i = 0; i < NUM_LODS; i++) {
+        mesh.lods[i] = (lod_t){
+            .indices = vec_uint32_t_init(),
+            .index_start = vec_size_t_init(),
+            .leaves = vec_leaf_instance_t_init(),
+            .leaf_start = vec_size_t_init(),
+        };
+    }
+    return mesh;
+}
+
+void mesh_free(mesh_t * mesh) {
+    for (size_t c = 0; c < mesh->num_chunks; c++) {
+        chunk_free(&mesh->chunks[c]);
+    }
+    free(mesh->chunks);
+    vec_size_t_free(&mesh->tree_chunk);
+    for (size_t t = 0; t < mesh->num_trees; t++) {
+        vec_uint32_t_free(&mesh->tree_indices[t]);
+        vec_uint32_t_free(&mesh->tree_instances[t]);
+    }
+    free(mesh->tree_indices);
+    free(mesh->tree_instances);
+    vec_size_t_free(&mesh->local_segments);
+    vec_size_t_free(&mesh->start_rings);
+    vec_size_t_free(&mesh->end_rings);
+    for (int i = 0; i < NUM_LODS; i++) {
+        vec_uint32_t_free(&mesh->lods[i].indices);
+        vec_size_t_free(&mesh->lods[i].index_start);
+        vec_leaf_instance_t_free(&mesh->lods[i].leaves);
+        vec_size_t_free(&mesh->lods[i].leaf_start);
+    }
+    vec_box_t_free(&mesh->bounds);
+    vec_float_free(&mesh->shadow_radii);
+}
+
+static mesh_chunk_t * chunk_at(mesh_t * mesh, size_t chunk) {
+    if (chunk >= mesh->num_chunks) {
+        mesh->chunks = realloc(mesh->chunks, (chunk + 1) * sizeof(mesh_chunk_t));
+        for (size_t c = mesh->num_chunks; c <= chunk; c++) {
+            mesh->chunks[c] = chunk_init((vec3s){0});
+        }
+        mesh->num_chunks = chunk + 1;
+    }
+    return &mesh->chunks[chunk];
+}
+
+static size_t tree_chunk(mesh_t * mesh, size_t tree) {
+    return tree < vec_size_t_size(&mesh->tree_chunk) ? *vec_size_t_at(&mesh->tree_chunk, tree) : 0;
+}
+
+void mesh_set_chunk(mesh_t * mesh, size_t chunk, vec3s origin, size_t first_tree,
+        size_t num_trees) {
+    mesh_chunk_t * c = chunk_at(mesh, chunk);
+    // only ever moved before any branches are meshed into it
+    if (vec_ring_vertex_t_size(&c->rings) == 0 &&
+            vec_segment_instance_t_size(&c->instances) == 0) {
+        c->origin = origin;
+        c->bounds = box_point(origin);
+    }
+    if (first_tree + num_trees > vec_size_t_size(&mesh->tree_chunk)) {
+        vec_size_t_resize(&mesh->tree_chunk, first_tree + num_trees, 0);
+    }
+    for (size_t t = first_tree; t < first_tree + num_trees; t++) {
+        *vec_size_t_at(&mesh->tree_chunk, t) = chunk;
+    }
+}
+
+void mesh_clear_type(mesh_t * mesh, size_t chunk, object_type_e type) {
+    mesh_chunk_t * c = chunk_at(mesh, chunk);
+    vec_vertex_t_clear(&c->vertices[type]);
+    c->dirty[type] = true;
+}
+
+void mesh_clear(mesh_t * mesh) {
+    for (size_t c = 0; c < mesh->num_chunks; c++) {
+        mesh_chunk_t * chunk = &mesh->chunks[c];
+        for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+            mesh_clear_type(mesh, c, i);
+        }
+        vec_ring_vertex_t_clear(&chunk->rings);
+        vec_segment_instance_t_clear(&chunk->instances);
+        vec_size_t_clear(&chunk->segments);
+        vec_float_clear(&chunk->radii);
+        vec_mesh_copy_t_clear(&chunk->copies);
+        chunk->bounds = box_point(chunk->origin);
+    }
+    for (int i = 0; i < NUM_LODS; i++) {
+        mesh_clear_lod(mesh, i);
+    }
+    vec_box_t_clear(&mesh->bounds);
+    for (size_t t = 0; t < mesh->num_trees; t++) {
+        vec_uint32_t_clear(&mesh->tree_indices[t]);
+        vec_uint32_t_clear(&mesh->tree_instances[t]);
+    }
+    vec_size_t_clear(&mesh->local_segments);
+    vec_size_t_clear(&mesh->start_rings);
+    vec_size_t_clear(&mesh->end_rings);
+    vec_float_clear(&mesh->shadow_radii);
+    mesh->num_segments = 0;
+}
+
+void mesh_set_radii(mesh_t * mesh, const float * radii, size_t num_segments) {
+    for (size_t c = 0; c < mesh->num_chunks; c++) {
+        mesh_chunk_t * chunk = &mesh->chunks[c];
+        size_t n = vec_size_t_size(&chunk->segments);
+        const size_t * segments = vec_size_t_data(&chunk->segments);
+        // new segments always count as changed
+        size_t old = vec_float_size(&chunk->radii);
+        vec_float_resize(&chunk->radii, n, 0.0f);
+        float * r = vec_float_data(&chunk->radii);
+        size_t kept = old < n ? old : n;
+        size_t lo = kept;
+        size_t hi = kept < n ? n : 0;
+        for (size_t k = 0; k < kept; k++) {
+            float radius = segments[k] < num_segments ? radii[segments[k]] : 0.0f;
+            if (r[k] != radius) {
+                r[k] = radius;
+                lo = k < lo ? k : lo;
+                hi = k + 1 > hi ? k + 1 : hi;
+            }
+        }
+        for (size_t k = old; k < n; k++) {
+            r[k] = segments[k] < num_segments ? radii[segments[k]] : 0.0f;
+        }
+        if (lo < hi) {
+            bool clean = chunk->radii_lo == chunk->radii_hi;
+            chunk->radii_lo = clean || lo < chunk->radii_lo ? lo : chunk->radii_lo;
+            chunk->radii_hi = clean || hi > chunk->radii_hi ? hi : chunk->radii_hi;
+        }
+    }
+}
+
+void mesh_set_bounds(mesh_t * mesh, size_t tree, box_t bounds) {
+    if (tree >= vec_box_t_size(&mesh->bounds)) {
+        vec_box_t_resize(&mesh->bounds, tree + 1, bounds);
+    }
+    *vec_box_t_at(&mesh->bounds, tree) = bounds;
+    mesh_chunk_t * c = chunk_at(mesh, tree_chunk(mesh, tree));
+    c->bounds = box_extend(box_extend(c->bounds, bounds.lo), bounds.hi);
+}
+
+size_t mesh_num_vertices(mesh_t * mesh) {
+    size_t n = 0;
+    for (size_t c = 0; c < mesh->num_chunks; c++) {
+        n += vec_ring_vertex_t_size(&mesh->chunks[c].rings);
+        for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+            n += vec_vertex_t_size(&mesh->chunks[c].vertices[i]);
+        }
+    }
+    return n;
+}
+
+size_t mesh_num_indices(mesh_t * mesh) {
+    size_t n = 0;
+    for (size_t t = 0; t < mesh->num_trees; t++) {
+        n += vec_uint32_t_size(&mesh->tree_indices[t]);
+    }
+    return n;
+}
+
+void mesh_clear_lod(mesh_t * mesh, int lod) {
+    vec_uint32_t_clear(&mesh->lods[lod].indices);
+    vec_size_t_clear(&mesh->lods[lod].index_start);
+    vec_leaf_instance_t_clear(&mesh->lods[lod].leaves);
+    vec_size_t_clear(&mesh->lods[lod].leaf_start);
+    if (lod == 0) {
+        mesh->leaves_dirty = true;
+    } else {
+        mesh->lods_dirty = true;
+    }
+}
+
+void mesh_lod_mark(mesh_t * mesh, int lod) {
+    lod_t * l = &mesh->lods[lod];
+    vec_size_t_push_back(&l->index_start, vec_uint32_t_size(&l->indices));
+    vec_size_t_push_back(&l->leaf_start, vec_leaf_instance_t_size(&l->leaves));
+}
+
+static vec_uint32_t * tree_indices(mesh_t * mesh, size_t tree) {
+    if (tree >= mesh->num_trees) {
+        mesh->tree_indices = realloc(mesh->tree_indices, (tree + 1) * sizeof(vec_uint32_t));
+        mesh->tree_instances = realloc(mesh->tree_instances, (tree + 1) * sizeof(vec_uint32_t));
+        for (size_t t = mesh->num_trees; t <= tree; t++) {
+            mesh->tree_indices[t] = vec_uint32_t_init();
+            mesh->tree_instances[t] = vec_uint32_t_init();
+        }
+        mesh->num_trees = tree + 1;
+    }
+    return &mesh->tree_indices[tree];
+}
+
+// the next segment of the forest becomes the next of the tree's chunk,
+// returns its id there
+static size_t add_local_segment(mesh_t * mesh, mesh_chunk_t * chunk) {
+    size_t local = vec_size_t_size(&chunk->segments);
+    vec_size_t_push_back(&chunk->segments, mesh->num_segments++);
+    vec_size_t_push_back(&mesh->local_segments, local);
+    return local;
+}
+
+// the three vertices of a ring at frame m, returns the index of the first.
+// v alternates along the branch so the bark texture is mirrored every other
+// segment rather than jumping back across a shared ring
+static size_t add_ring(mesh_chunk_t * chunk, mat4s m, float segment, int v) {
+    vec_ring_vertex_t * rings = &chunk->rings;
+    // a 2D triangle
+    const float pi = 3.1416f;
+    float a = cos(pi / 3.0f);
+    float b = sin(pi / 3.0f);
+    vec3s c[3] = {
+        (vec3s){0.0f, 0.0f, -1.0f},
+        (vec3s){  -b, 0.0f,     a},
+        (vec3s){   b, 0.0f,     a}
+    };
+
+    // the ring is inflated to the radius in the vertex shader
+    size_t first = vec_ring_vertex_t_size(rings);
+    vec3s centre = glms_vec3_sub(transform(m, (vec3s){0.0f, 0.0f, 0.0f}), chunk->origin);
+    for (int i = 0; i < 3; i++) {
+        ring_vertex_t r = {.segment = segment};
+        quantise_position(r.centre, centre, i + 4 * v);
+        quantise_direction(r.direction, transform_normal(m, c[i]));
+        vec_ring_vertex_t_push_back(rings, r);
+    }
+    return first;
+}
+
+// a three sided cylinder joining ring r0 to ring r1
+static void add_cylinder(vec_uint32_t * indices, size_t r0, size_t r1) {
+    const int N = 18;
+    const uint32_t a0 = r0, b0 = r0 + 1, c0 = r0 + 2;
+    const uint32_t a1 = r1, b1 = r1 + 1, c1 = r1 + 2;
+    uint32_t triangles[] = {
+        a0, b0, a1,
+        b0, b1, a1,
+        b0, c0, b1,
+        c0, c1, b1,
+        c0, a0, c1,
+        a0, a1, c1
+    };
+    assert(sizeof(triangles) / sizeof(uint32_t) == N);
+
+    for (int i = 0; i < N; i++) {
+        vec_uint32_t_push_back(indices, triangles[i]);
+    }
+}
+
+static vec3s axis(mat4s m, int i) {
+    return (vec3s){m.col[i].x, m.col[i].y, m.col[i].z};
+}
+
+static void add_horiz_triangle(vec_vertex_t * vertices, vec3s origin, float radius,
+        atlas_t tex) {
+    // a 2D triangle
+    const float pi = 3.1416f;
+    float a = cos(pi / 3.0f);
+    float b = sin(pi / 3.0f);
+    vec3s c[3] = {
+        (vec3s){0.0f, 0.0f, -1.0f},
+        (vec3s){  -b, 0.0f,     a},
+        (vec3s){   b, 0.0f,     a}
+    };
+    vec3s normal = (vec3s){0.0f, 1.0f, 0.0f};
+    for(int i = 0; i < 3; i++) { 
+        vec3s t = glms_vec3_add(origin, glms_vec3_scale(c[i], radius));
+        vec2s uv = glms_vec2_add(tex.offset,
+                    glms_vec2_add((vec2s){0.5f, 0.5f}, 
+                        glms_vec2_scale((vec2s){c[i].x, c[i].z}, tex.scale * 0.5f)));
+        vertex_t v = make_vertex(t, normal, uv);
+        vec_vertex_t_push_back(vertices, v);
+    }
+}
+
+// segment ids are exact in a float up to 2^24 segments in a chunk
+void mesh_add_root_segment(mesh_t * mesh, size_t tree, mat4s m0, mat4s m1) {
+    mesh_chunk_t * chunk = chunk_at(mesh, tree_chunk(mesh, tree));
+    size_t segment = add_local_segment(mesh, chunk);
+    size_t r0 = add_ring(chunk, m0, segment, 0);
+    size_t r1 = add_ring(chunk, m1, segment, 1);
+    add_cylinder(tree_indices(mesh, tree), r0, r1);
+    vec_size_t_push_back(&mesh->start_rings, r0);
+    vec_size_t_push_back(&mesh->end_rings, r1);
+}
+
+// a segment's parent is always of the same tree, so in the same chunk
+void mesh_add_segment(mesh_t * mesh, size_t tree, size_t parent, mat4s m1) {
+    mesh_chunk_t * chunk = chunk_at(mesh, tree_chunk(mesh, tree));
+    size_t segment = add_local_segment(mesh, chunk);
+    size_t r0 = *vec_size_t_at(&mesh->end_rings, parent);
+    int v = 1 - vec_ring_vertex_t_at(&chunk->rings, r0)->centre[3] / 4;
+    size_t r1 = add_ring(chunk, m1, segment, v);
+    add_cylinder(tree_indices(mesh, tree), r0, r1);
+    vec_size_t_push_back(&mesh->start_rings, r0);
+    vec_size_t_push_back(&mesh->end_rings, r1);
+}
+
+void mesh_add_lod_cylinder(mesh_t * mesh, int lod, size_t r0, size_t r1) {
+    add_cylinder(&mesh->lods[lod].indices, r0, r1);
+}
+
+void mesh_add_leaves(mesh_t * mesh, int lod, size_t tree, mat4s mat, float radius,
+        float scale) {
+    vec3s origin = chunk_at(mesh, tree_chunk(mesh, tree))->origin;
+    leaf_instance_t leaf = {.radius = radius, .scale = scale};
+    quantise_position(leaf.position, glms_vec3_sub(axis(mat, 3), origin), 1);
+    quantise_direction(leaf.x, axis(mat, 0));
+    quantise_direction(leaf.z, axis(mat, 2));
+    vec_leaf_instance_t_push_back(&mesh->lods[lod].leaves, leaf);
+} 
+
+void mesh_add_contact_shadow(mesh_t * mesh, size_t tree, vec3s origin, float radius) {
+    mesh_chunk_t * chunk = chunk_at(mesh, tree_chunk(mesh, tree));
+    add_horiz_triangle(&chunk->vertices[SHADOW], glms_vec3_sub(origin, chunk->origin), radius,
+        (atlas_t){.scale = 1.0f});
+    if (tree >= vec_float_size(&mesh->shadow_radii)) {
+        vec_float_resize(&mesh->shadow_radii, tree + 1, -1.0f);
+    }
+    *vec_float_at(&mesh->shadow_radii, tree) = radius;
+    chunk->dirty[SHADOW] = true;
+} 
+
+void mesh_add_copy(mesh_t * mesh, size_t chunk, size_t tree, mat4s transform, vec3s tint) {
+    mesh_chunk_t * c = chunk_at(mesh, chunk);
+    vec_mesh_copy_t_push_back(&c->copies, (mesh_copy_t){
+        .transform = transform,
+        .tint = tint,
+        .tree = tree,
+    });
+}
+
+void mesh_add_copy_shadow(mesh_t * mesh, size_t chunk, vec3s origin, float radius) {
+    mesh_chunk_t * c = chunk_at(mesh, chunk);
+    add_horiz_triangle(&c->vertices[SHADOW], glms_vec3_sub(origin, c->origin), radius,
+        (atlas_t){.scale = 1.0f});
+    c->dirty[SHADOW] = true;
+}
+
+// two triangles, the texture repeating every 8 m from the world origin. Only
+// the fraction of the chunk origin in repeats is kept so the coordinates stay
+// small
+void mesh_add_ground(mesh_t * mesh, size_t chunk, box_t area) {
+    mesh_chunk_t * c = chunk_at(mesh, chunk);
+    const float repeat = 0.125f;
+    vec2s offset = {
+        c->origin.x * repeat - floorf(c->origin.x * repeat),
+        c->origin.z * repeat - floorf(c->origin.z * repeat),
+    };
+    float x[2] = {area.lo.x - c->origin.x, area.hi.x - c->origin.x};
+    float z[2] = {area.lo.z - c->origin.z, area.hi.z - c->origin.z};
+    const int corners[6][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 0}, {0, 1}, {1, 1}};
+    vec3s normal = (vec3s){0.0f, 1.0f, 0.0f};
+    for (int i = 0; i < 6; i++) {
+        vec3s p = {x[corners[i][0]], -0.1f, z[corners[i][1]]};
+        vec2s uv = glms_vec2_add(offset, (vec2s){p.x * repeat, p.z * repeat});
+        vec_vertex_t_push_back(&c->vertices[GROUND], make_vertex(p, normal, uv));
+    }
+    c->bounds = box_extend(box_extend(c->bounds, area.lo), area.hi);
+    c->dirty[GROUND] = true;
+}
+
+void mesh_add_instance(mesh_t * mesh, size_t tree, mat4s m0, size_t s0, mat4s m1) {
+    mesh_chunk_t * chunk = chunk_at(mesh, tree_chunk(mesh, tree));
+    // a shoot starts from its own end frame
+    size_t parent = s0 < vec_size_t_size(&mesh->local_segments) ?
+        *vec_size_t_at(&mesh->local_segments, s0) : vec_size_t_size(&chunk->segments);
+    size_t segment = add_local_segment(mesh, chunk);
+    segment_instance_t instance = {.segment = {parent, segment}};
+    quantise_position(instance.centre0, glms_vec3_sub(axis(m0, 3), chunk->origin), 1);
+    quantise_direction(instance.x0, axis(m0, 0));
+    quantise_direction(instance.z0, axis(m0, 2));
+    quantise_position(instance.centre1, glms_vec3_sub(axis(m1, 3), chunk->origin), 1);
+    quantise_direction(instance.x1, axis(m1, 0));
+    quantise_direction(instance.z1, axis(m1, 2));
+    // the tree has no branch indices, its instances are listed instead
+    tree_indices(mesh, tree);
+    vec_uint32_t_push_back(&mesh->tree_instances[tree],
+        vec_segment_instance_t_size(&chunk->instances));
+    vec_segment_instance_t_push_back(&chunk->instances, instance);
+}
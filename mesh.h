@@ -0,0 +1,253 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "vectors.h"
+
+// vertices are quantised to 16 bits a component. Positions are in steps of
+// 1 / POSITION_SCALE m, covering 64 m either side of the origin of their
+// chunk, normals are octahedral snorm16 and texture coordinates are snorm16
+// of uv / TEXCOORD_RANGE. The shaders in renderer.c hard code both scales
+#define POSITION_SCALE 512.0f
+#define TEXCOORD_RANGE 16.0f
+
+typedef struct {
+    int16_t position[4];
+    int16_t normal[2];
+    int16_t texcoord[2];
+} vertex_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T vertex_t
+#include <ctl/vector.h>
+
+// a branch vertex before the radius is applied. The vertex shader places it
+// at centre + direction * radius of segment, so it never changes as the
+// branch thickens. w of centre is the corner of the ring, which gives u, plus
+// 4 times v, which alternates between 0 and 1 along the branch
+typedef struct {
+    int16_t centre[4];
+    int16_t direction[2];
+    float segment;
+} ring_vertex_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T ring_vertex_t
+#include <ctl/vector.h>
+
+// a branch segment for instanced drawing, the vertex shader stretches a unit
+// cylinder between the two end frames. Each end takes the radius of its
+// segment, the ring directions are built from the x and z axes of the frame
+typedef struct {
+    int16_t centre0[4];
+    int16_t x0[2];
+    int16_t z0[2];
+    int16_t centre1[4];
+    int16_t x1[2];
+    int16_t z1[2];
+    float segment[2];
+} segment_instance_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T segment_instance_t
+#include <ctl/vector.h>
+
+// a cluster of three leaves around a tip, drawn from one shared mesh. The
+// leaves sit in the plane of the x and z axes of the tip's end frame, pushed
+// out by the radius of the tip
+typedef struct {
+    int16_t position[4];
+    int16_t x[2];
+    int16_t z[2];
+    float radius;
+    // leaf size relative to a tip's, larger for the clusters of coarse levels
+    float scale;
+} leaf_instance_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T leaf_instance_t
+#include <ctl/vector.h>
+
+// the shared leaf cluster as (x, z) of the direction to the leaf from the
+// tip, then (x, z) of the corner within the leaf, which is also its uv. A
+// leaf is at corner.xy * (radius + 0.15 * scale) + corner.zw * 0.1 * scale
+// along the x and z axes of the instance
+#define LEAF_CLUSTER_VERTICES 9
+
+extern const float leaf_cluster[LEAF_CLUSTER_VERTICES][4];
+
+// the corners of a three sided unit cylinder as (x, z, end, u), for drawing
+// segment instances. x and z weight the axes of the frame at that end, giving
+// the ring direction
+#define UNIT_CYLINDER_VERTICES 18
+
+extern const float unit_cylinder[UNIT_CYLINDER_VERTICES][4];
+
+#define POD
+#define NOT_INTEGRAL
+#define T box_t
+#include <ctl/vector.h>
+
+// level 0 is full detail, each level after drops thinner twigs, draws longer
+// straight runs of segments as one cylinder and has fewer, larger leaf clusters
+#define NUM_LODS 4
+
+// the geometry of every tree at one level of detail, grouped by tree. Tree t
+// has indices index_start[t] .. index_start[t + 1] and likewise leaves. The
+// indices reuse the full detail rings. Level 0 only has leaves, its indices
+// are in tree_indices so that they can stay append only
+typedef struct {
+    vec_uint32_t indices;
+    vec_size_t index_start;
+    vec_leaf_instance_t leaves;
+    vec_size_t leaf_start;
+} lod_t;
+
+// a tree drawn again elsewhere from its own geometry, with transform taking
+// it from where the tree stands to where the copy does, and its colour
+// multiplied by tint
+typedef struct {
+    mat4s transform;
+    vec3s tint;
+    size_t tree;
+} mesh_copy_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T mesh_copy_t
+#include <ctl/vector.h>
+
+typedef enum object_type_e {
+    GROUND,
+    TREE,
+    LEAF,
+    SHADOW,
+    MAX_OBJECT_TYPE
+} object_type_e;
+
+// the geometry of one chunk of the forest, see forest.h, with positions
+// relative to its origin. GROUND and SHADOW are plain vertex arrays, TREE
+// geometry lives in rings and LEAF geometry in the levels of the mesh
+typedef struct {
+    vec3s origin;
+    vec_vertex_t vertices[MAX_OBJECT_TYPE];
+    // three vertices per ring, each segment adds the ring at its far end and
+    // triangles joining it to its parent's end ring. Segment ids in the rings
+    // count the chunk's segments only
+    vec_ring_vertex_t rings;
+    vec_segment_instance_t instances;
+    // the index in the forest of each segment meshed into the chunk, and its
+    // radius. Only radii[radii_lo .. radii_hi] changed since the renderer last
+    // uploaded them, nothing did if they're equal
+    vec_size_t segments;
+    vec_float radii;
+    size_t radii_lo;
+    size_t radii_hi;
+    // copies of trees that stand in the chunk, only ever added with its
+    // ground
+    vec_mesh_copy_t copies;
+    // box around the trees and the ground of the chunk, but not the copies
+    box_t bounds;
+    // object types whose vertices changed since the renderer last uploaded
+    // them. Branch geometry is append only, for TREE this means it was cleared
+    bool dirty[MAX_OBJECT_TYPE];
+} mesh_chunk_t;
+
+// vertex arrays built on the CPU without any GL, kept apart by chunk
+typedef struct mesh_s {
+    size_t num_chunks;
+    mesh_chunk_t * chunks;
+    vec_size_t tree_chunk;
+    // the triangles of each tree are kept apart, indexing the rings of its
+    // chunk, so trees can be drawn at different levels of detail
+    size_t num_trees;
+    vec_uint32_t * tree_indices;
+    // or when instanced, the instances of each tree, by index in its chunk
+    vec_uint32_t * tree_instances;
+    // for every segment already meshed, its id within its chunk and the
+    // first vertex of the rings it starts and ends at
+    vec_size_t local_segments;
+    vec_size_t start_rings;
+    vec_size_t end_rings;
+    // when set, branches are meshed as instances rather than rings
+    bool instanced;
+    // rebuilt every step, along with LEAF geometry, which is always instanced
+    // with one cluster per tip at full detail. Leaves are placed relative to
+    // the origin of their tree's chunk
+    lod_t lods[NUM_LODS];
+    // box around everything drawn for each tree, for culling it and picking
+    // its level of detail
+    vec_box_t bounds;
+    // the full detail leaves, and the coarse levels, changed since the
+    // renderer last uploaded them
+    bool leaves_dirty;
+    bool lods_dirty;
+    // radius of the contact shadow meshed under each tree
+    vec_float shadow_radii;
+    // segments already meshed into rings
+    size_t num_segments;
+} mesh_t;
+
+mesh_t mesh_init();
+
+void mesh_free(mesh_t * mesh);
+
+// clears the geometry but keeps the chunks
+void mesh_clear(mesh_t * mesh);
+
+// places chunk at origin and puts the trees first_tree .. first_tree +
+// num_trees in it. Trees not in any chunk are in chunk 0, which is at the
+// origin until placed
+void mesh_set_chunk(mesh_t * mesh, size_t chunk, vec3s origin, size_t first_tree,
+        size_t num_trees);
+
+// clears the vertices of one object type of a chunk, other than TREE, whose
+// rings only ever have segments appended
+void mesh_clear_type(mesh_t * mesh, size_t chunk, object_type_e type);
+
+// the radius of every segment, by its index in the forest
+void mesh_set_radii(mesh_t * mesh, const float * radii, size_t num_segments);
+
+void mesh_set_bounds(mesh_t * mesh, size_t tree, box_t bounds);
+
+size_t mesh_num_vertices(mesh_t * mesh);
+
+// the first segment of a branch, from a new ring at frame m0 to a ring at m1
+void mesh_add_root_segment(mesh_t * mesh, size_t tree, mat4s m0, mat4s m1);
+
+// a segment continuing from the end ring of segment parent to a ring at m1
+void mesh_add_segment(mesh_t * mesh, size_t tree, size_t parent, mat4s m1);
+
+size_t mesh_num_indices(mesh_t * mesh);
+
+// empties one level of detail, level 0 being the full detail leaves
+void mesh_clear_lod(mesh_t * mesh, int lod);
+
+// records where the next tree's geometry starts in a level, called before
+// each tree and once after the last
+void mesh_lod_mark(mesh_t * mesh, int lod);
+
+// a cylinder in a coarse level from ring r0 to ring r1
+void mesh_add_lod_cylinder(mesh_t * mesh, int lod, size_t r0, size_t r1);
+
+// a segment for the instanced path, from frame m0 at the end of segment s0
+void mesh_add_instance(mesh_t * mesh, size_t tree, mat4s m0, size_t s0, mat4s m1);
+
+void mesh_add_leaves(mesh_t * mesh, int lod, size_t tree, mat4s mat, float radius,
+        float scale);
+
+void mesh_add_contact_shadow(mesh_t * mesh, size_t tree, vec3s origin, float radius);
+
+// a copy of tree standing in chunk, see mesh_copy_t
+void mesh_add_copy(mesh_t * mesh, size_t chunk, size_t tree, mat4s transform, vec3s tint);
+
+// the shadow of a copy, origin being where the copy stands
+void mesh_add_copy_shadow(mesh_t * mesh, size_t chunk, vec3s origin, float radius);
+
+// the ground over area of a chunk, its texture lines up with its neighbours'
+void mesh_add_ground(mesh_t * mesh, size_t chunk, box_t area);
+
+#endif
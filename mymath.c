@@ -1,23 +1,102 @@
 #include "mymath.h"
-#include <stdlib.h>
 
-float rand_float(float s) {
-    return (rand() * s) / RAND_MAX;
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
 }
 
-bool rand_prob(float p) {
-    return rand_float(1.0f) < p;
+static inline uint32_t squares32(uint64_t counter, uint64_t key) {
+    uint64_t x = counter * key;
+    uint64_t y = x;
+    uint64_t z = y + key;
+    x = x * x + y; x = (x >> 32) | (x << 32);
+    x = x * x + z; x = (x >> 32) | (x << 32);
+    x = x * x + y; x = (x >> 32) | (x << 32);
+    return (x * x + z) >> 32;
 }
 
-vec3s rand_vec(float s) {
+// top 24 bits scaled to [0, 1)
+static inline float unit_float(uint32_t bits) {
+    return (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+rng_t rng_init(uint64_t seed, uint64_t tree, uint64_t segment) {
+    // squares wants a key with well mixed bits, hash the three parts into one
+    uint64_t key = splitmix64(seed ^ splitmix64(tree ^ splitmix64(segment)));
+    return (rng_t){
+        .key = key | 1,
+        .counter = 0
+    };
+}
+
+uint32_t rng_next(rng_t *rng) {
+    return squares32(rng->counter++, rng->key);
+}
+
+float rng_float(rng_t *rng, float s) {
+    return unit_float(rng_next(rng)) * s;
+}
+
+bool rng_prob(rng_t *rng, float p) {
+    return rng_float(rng, 1.0f) < p;
+}
+
+vec3s rng_vec(rng_t *rng, float s) {
     float h = s / 2.0f;
     return (vec3s) {
-        .x = rand_float(s) - h,
-        .y = rand_float(s) - h,
-        .z = rand_float(s) - h,
+        .x = rng_float(rng, s) - h,
+        .y = rng_float(rng, s) - h,
+        .z = rng_float(rng, s) - h,
     };
 }
 
+void rng_floats(rng_t *rng, float *out, size_t n, float s) {
+    const uint64_t counter = rng->counter;
+    const uint64_t key = rng->key;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = unit_float(squares32(counter + i, key)) * s;
+    }
+    rng->counter += n;
+}
+
+void rng_vecs(rng_t *rng, vec3s *out, size_t n, float s) {
+    // a vec3s is three packed floats, so fill them as one flat array
+    float *f = (float *)out;
+    const float h = s / 2.0f;
+    rng_floats(rng, f, n * 3, s);
+    for (size_t i = 0; i < n * 3; i++) {
+        f[i] -= h;
+    }
+}
+
+box_t box_point(vec3s p) {
+    return (box_t){.lo = p, .hi = p};
+}
+
+box_t box_extend(box_t b, vec3s p) {
+    return (box_t){.lo = glms_vec3_minv(b.lo, p), .hi = glms_vec3_maxv(b.hi, p)};
+}
+
+box_t box_pad(box_t b, float d) {
+    vec3s pad = (vec3s){d, d, d};
+    return (box_t){.lo = glms_vec3_sub(b.lo, pad), .hi = glms_vec3_add(b.hi, pad)};
+}
+
+box_t box_transform(mat4s m, box_t b) {
+    box_t r = box_point(transform(m, b.lo));
+    for (int i = 1; i < 8; i++) {
+        vec3s corner = {
+            i & 1 ? b.hi.x : b.lo.x,
+            i & 2 ? b.hi.y : b.lo.y,
+            i & 4 ? b.hi.z : b.lo.z,
+        };
+        r = box_extend(r, transform(m, corner));
+    }
+    return r;
+}
+
 mat4s mat_from_axes(
     vec3s x,
     vec3s y,
@@ -49,3 +128,34 @@ void axes_from_dir_up(vec3s dir, vec3s up,
     *z = glms_vec3_cross(*x, *y);
 }
 
+vec2s oct_encode(vec3s n) {
+    float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    vec2s e = (vec2s){n.x / l1, n.y / l1};
+    if (n.z < 0.0f) {
+        // the lower half folds over the diagonals
+        e = (vec2s){
+            (1.0f - fabsf(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f),
+            (1.0f - fabsf(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f)
+        };
+    }
+    return e;
+}
+
+vec3s oct_decode(vec2s e) {
+    vec3s n = (vec3s){e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y)};
+    if (n.z < 0.0f) {
+        n.x = (1.0f - fabsf(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f);
+        n.y = (1.0f - fabsf(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return glms_vec3_normalize(n);
+}
+
+int16_t snorm16(float x) {
+    x = x < -1.0f ? -1.0f : x > 1.0f ? 1.0f : x;
+    return (int16_t)lrintf(x * 32767.0f);
+}
+
+float unsnorm16(int16_t x) {
+    float f = x / 32767.0f;
+    return f < -1.0f ? -1.0f : f;
+}
@@ -3,12 +3,50 @@
 
 #include <cglm/struct.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-float rand_float(float s);
+// counter based generator (Widynski's squares): every draw is a pure function
+// of the key and the counter, so a stream keyed by (seed, tree, segment) gives
+// the same numbers whatever order or thread it is drawn from
+typedef struct {
+    uint64_t key;
+    uint64_t counter;
+} rng_t;
 
-bool rand_prob(float p);
+rng_t rng_init(uint64_t seed, uint64_t tree, uint64_t segment);
 
-vec3s rand_vec(float s);
+uint32_t rng_next(rng_t *rng);
+
+// uniform in [0, s)
+float rng_float(rng_t *rng, float s);
+
+bool rng_prob(rng_t *rng, float p);
+
+// uniform in the cube of side s centred on the origin
+vec3s rng_vec(rng_t *rng, float s);
+
+// batch versions of the above, each element is independent of the others so
+// the loops vectorise
+void rng_floats(rng_t *rng, float *out, size_t n, float s);
+
+void rng_vecs(rng_t *rng, vec3s *out, size_t n, float s);
+
+// axis aligned, lo is the minimum corner and hi the maximum
+typedef struct {
+    vec3s lo;
+    vec3s hi;
+} box_t;
+
+box_t box_point(vec3s p);
+
+box_t box_extend(box_t b, vec3s p);
+
+// grown by d on every side
+box_t box_pad(box_t b, float d);
+
+// the box around b once transformed by m
+box_t box_transform(mat4s m, box_t b);
 
 mat4s mat_from_axes(
     vec3s x,
@@ -24,4 +62,15 @@ vec3s transform_normal(mat4s m, vec3s v);
 void axes_from_dir_up(vec3s dir, vec3s up,
                 vec3s *x, vec3s *y, vec3s *z);
 
+// a unit vector folded onto the octahedron and flattened to [-1, 1]^2
+vec2s oct_encode(vec3s n);
+
+// and back, as the shaders do
+vec3s oct_decode(vec2s e);
+
+// [-1, 1] to the full range of a signed 16 bit normalised value
+int16_t snorm16(float x);
+
+float unsnorm16(int16_t x);
+
 #endif
@@ -0,0 +1,126 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct pool_s {
+    pthread_t * threads;
+    size_t num_threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    // the current batch, workers wake when generation changes
+    long generation;
+    pool_task_fn fn;
+    void * context;
+    size_t num_tasks;
+    size_t next_task;
+    size_t finished_tasks;
+    bool quit;
+} pool_t;
+
+// claim and run tasks from the current batch until none are left, called with the mutex held
+static void run_tasks(pool_t * pool) {
+    while (pool->next_task < pool->num_tasks) {
+        size_t task = pool->next_task++;
+        pthread_mutex_unlock(&pool->mutex);
+        pool->fn(pool->context, task);
+        pthread_mutex_lock(&pool->mutex);
+        pool->finished_tasks++;
+    }
+    if (pool->finished_tasks == pool->num_tasks) {
+        pthread_cond_broadcast(&pool->done);
+    }
+}
+
+static void * worker(void * arg) {
+    pool_t * pool = arg;
+    long generation = 0;
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        while (!pool->quit && pool->generation == generation) {
+            pthread_cond_wait(&pool->work, &pool->mutex);
+        }
+        if (pool->quit) {
+            break;
+        }
+        generation = pool->generation;
+        run_tasks(pool);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+pool_t * pool_init(size_t num_threads) {
+    if (num_threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cores > 0 ? cores : 1;
+    }
+
+    pool_t * pool = malloc(sizeof(pool_t));
+    *pool = (pool_t){
+        // the calling thread is the first worker
+        .num_threads = num_threads,
+        .threads = malloc(sizeof(pthread_t) * num_threads),
+    };
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (size_t i = 1; i < num_threads; i++) {
+        pthread_create(&pool->threads[i], NULL, worker, pool);
+    }
+    return pool;
+}
+
+void pool_free(pool_t ** pool) {
+    if (*pool) {
+        pool_t * p = *pool;
+        pthread_mutex_lock(&p->mutex);
+        p->quit = true;
+        pthread_cond_broadcast(&p->work);
+        pthread_mutex_unlock(&p->mutex);
+        for (size_t i = 1; i < p->num_threads; i++) {
+            pthread_join(p->threads[i], NULL);
+        }
+        pthread_cond_destroy(&p->done);
+        pthread_cond_destroy(&p->work);
+        pthread_mutex_destroy(&p->mutex);
+        free(p->threads);
+        free(p);
+        *pool = NULL;
+    }
+}
+
+size_t pool_num_threads(pool_t * pool) {
+    return pool->num_threads;
+}
+
+void pool_run(pool_t * pool, pool_task_fn fn, void * context, size_t num_tasks) {
+    if (num_tasks == 0) {
+        return;
+    }
+    if (pool->num_threads == 1 || num_tasks == 1) {
+        for (size_t i = 0; i < num_tasks; i++) {
+            fn(context, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->fn = fn;
+    pool->context = context;
+    pool->num_tasks = num_tasks;
+    pool->next_task = 0;
+    pool->finished_tasks = 0;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work);
+
+    run_tasks(pool);
+    while (pool->finished_tasks < pool->num_tasks) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,20 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+typedef struct pool_s pool_t;
+
+// called once for every task index in [0, num_tasks)
+typedef void (*pool_task_fn)(void * context, size_t task);
+
+pool_t * pool_init(size_t num_threads);
+
+void pool_free(pool_t ** pool);
+
+size_t pool_num_threads(pool_t * pool);
+
+// runs all the tasks on the workers and the calling thread, returning once they are done
+void pool_run(pool_t * pool, pool_task_fn fn, void * context, size_t num_tasks);
+
+#endif
@@ -0,0 +1,1143 @@
+// a software renderer behind renderer.h. It draws what renderer.c does, with
+// the same camera, culling, levels of detail and shading, into a framebuffer
+// in memory. Each frame the triangles are set up and binned into tiles by
+// tasks on a pool, then the tiles are rasterised in parallel
+#include "raster.h"
+#include "capture.h"
+#include "image.h"
+#include "lod.h"
+#include "mesh.h"
+#include "pool.h"
+#include "timing.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the framebuffer is rasterised in square tiles of this many pixels a side
+#define TILE_SIZE 64
+// pixels tested against the edges of a triangle at a time, in loops the
+// compiler vectorises
+#define SPAN 8
+
+// the level of a tree outside the view frustum
+#define CULLED UINT8_MAX
+
+// as the fragment shader of renderer.c
+static const vec3s light_dir = {0.5f, -0.5f, 0.0f};
+static const vec3s light_colour = {1.9f, 1.9f, 1.7f};
+static const vec3s ambient_colour = {1.9f, 1.9f, 1.9f};
+
+// the default clear colour of sokol, grey
+static const uint8_t clear_colour[4] = {128, 128, 128, 255};
+
+// a vertex as the vertex shaders leave it, with its position in world space
+typedef struct {
+    vec3s position;
+    vec2s uv;
+    // dot(light_dir, normal), the normal itself is not needed after that
+    float lambert;
+} soft_vertex_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T soft_vertex_t
+#include <ctl/vector.h>
+
+typedef struct {
+    vec_uint8_t pixels;
+    mip_chain_t chain;
+} texture_t;
+
+// a mesh chunk with its vertices dequantised and moved to world space.
+// GROUND and SHADOW are lists of triangles, TREE is the rings, indexed by
+// the trees, or when instanced the triangles of every segment
+typedef struct {
+    box_t bounds;
+    vec_soft_vertex_t vertices[MAX_OBJECT_TYPE];
+    // its trees are chunk_trees[first_tree .. first_tree + num_trees]
+    size_t first_tree;
+    size_t num_trees;
+    // copies of trees standing in the chunk, with the box around each and the
+    // level it is drawn at this frame
+    vec_mesh_copy_t copies;
+    vec_box_t copy_bounds;
+    vec_uint8_t copy_levels;
+    // some of the chunk is inside the view frustum this frame
+    bool visible;
+} soft_chunk_t;
+
+// one draw call, triangles of vertices, indexed unless indices is NULL
+typedef struct {
+    const soft_vertex_t * vertices;
+    size_t num_vertices;
+    const uint32_t * indices;
+    size_t num_triangles;
+    mat4s mvp;
+    object_type_e type;
+    vec4s tint;
+} draw_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T draw_t
+#include <ctl/vector.h>
+
+// a triangle clipped to the near plane and ready to rasterise. For each
+// vertex its window position and depth, 1 / w, and its attributes over w so
+// that they interpolate linearly across the screen
+typedef struct {
+    float x[3];
+    float y[3];
+    float z[3];
+    float q[3];
+    float u[3];
+    float v[3];
+    float l[3];
+    uint32_t draw;
+} soft_triangle_t;
+
+#define POD
+#define NOT_INTEGRAL
+#define T soft_triangle_t
+#include <ctl/vector.h>
+
+struct renderer_s {
+    long frame;
+    pool_t * pool;
+    texture_t textures[MAX_OBJECT_TYPE];
+    size_t num_chunks;
+    soft_chunk_t * chunks;
+    // the trees ordered by chunk, and the chunk of each tree
+    vec_size_t chunk_trees;
+    vec_size_t tree_chunk;
+    vec3s * chunk_origins;
+    // full detail branch indices of each tree, or when instanced the
+    // triangles of its instances
+    size_t num_trees;
+    vec_uint32_t * tree_indices;
+    // the coarse levels, and the leaves of every level as triangles, with the
+    // ranges of each tree in them counted in indices and clusters
+    vec_uint32_t lod_indices[NUM_LODS];
+    vec_soft_vertex_t lod_leaves[NUM_LODS];
+    vec_size_t index_start[NUM_LODS];
+    vec_size_t leaf_start[NUM_LODS];
+    vec_box_t bounds;
+    // the level each tree is drawn at this frame, or CULLED
+    vec_uint8_t levels;
+    bool instanced;
+    mat4s view;
+    mat4s view_proj;
+    // scales a size over a distance to a fraction of the viewport height
+    float focal;
+    float rx;
+    float ry;
+    // this frame's draws, in order, and the first triangle of each counting
+    // across all of them
+    vec_draw_t draws;
+    vec_size_t draw_start;
+    // setup task k takes an even share of the triangles, in order, and bins
+    // them into tile_bins[k * num_tiles + tile] so each tile draws them in
+    // the order they were submitted
+    size_t num_tasks;
+    vec_soft_triangle_t * triangles;
+    vec_uint32_t * tile_bins;
+    int width;
+    int height;
+    int tiles_x;
+    int tiles_y;
+    vec_uint8_t colour;
+    vec_float depth;
+    // while capturing every frame is rendered at the capture's size, seen
+    // through a projection of its own, and the frames asked for copied out
+    capture_t * capture;
+    bool capture_next;
+    mat4s capture_view_proj;
+};
+
+static soft_chunk_t soft_chunk_init() {
+    soft_chunk_t chunk = {
+        .copies = vec_mesh_copy_t_init(),
+        .copy_bounds = vec_box_t_init(),
+        .copy_levels = vec_uint8_t_init(),
+    };
+    for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+        chunk.vertices[i] = vec_soft_vertex_t_init();
+    }
+    return chunk;
+}
+
+static void soft_chunk_free(soft_chunk_t * chunk) {
+    for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+        vec_soft_vertex_t_free(&chunk->vertices[i]);
+    }
+    vec_mesh_copy_t_free(&chunk->copies);
+    vec_box_t_free(&chunk->copy_bounds);
+    vec_uint8_t_free(&chunk->copy_levels);
+}
+
+static void free_tile_bins(renderer_t * renderer) {
+    size_t num_bins = renderer->num_tasks * renderer->tiles_x * renderer->tiles_y;
+    for (size_t b = 0; b < num_bins; b++) {
+        vec_uint32_t_free(&renderer->tile_bins[b]);
+    }
+    free(renderer->tile_bins);
+    renderer->tile_bins = NULL;
+}
+
+void renderer_free(renderer_t ** renderer) {
+    if (*renderer) {
+        renderer_t * r = *renderer;
+        for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+            vec_uint8_t_free(&r->textures[i].pixels);
+        }
+        for (size_t c = 0; c < r->num_chunks; c++) {
+            soft_chunk_free(&r->chunks[c]);
+        }
+        free(r->chunks);
+        free(r->chunk_origins);
+        vec_size_t_free(&r->chunk_trees);
+        vec_size_t_free(&r->tree_chunk);
+        for (size_t t = 0; t < r->num_trees; t++) {
+            vec_uint32_t_free(&r->tree_indices[t]);
+        }
+        free(r->tree_indices);
+        for (int i = 0; i < NUM_LODS; i++) {
+            vec_uint32_t_free(&r->lod_indices[i]);
+            vec_soft_vertex_t_free(&r->lod_leaves[i]);
+            vec_size_t_free(&r->index_start[i]);
+            vec_size_t_free(&r->leaf_start[i]);
+        }
+        vec_box_t_free(&r->bounds);
+        vec_uint8_t_free(&r->levels);
+        vec_draw_t_free(&r->draws);
+        vec_size_t_free(&r->draw_start);
+        for (size_t k = 0; k < r->num_tasks; k++) {
+            vec_soft_triangle_t_free(&r->triangles[k]);
+        }
+        free(r->triangles);
+        free_tile_bins(r);
+        vec_uint8_t_free(&r->colour);
+        vec_float_free(&r->depth);
+        pool_free(&r->pool);
+        free(r);
+        *renderer = NULL;
+    }
+}
+
+// the textures renderer.c uses, as mip chains. A texture that can't be loaded
+// is left plain white
+static void load_texture(texture_t * texture, const char * filename) {
+    texture->pixels = vec_uint8_t_init();
+    int x, y, n;
+    uint8_t * data = stbi_load(filename, &x, &y, &n, 4);
+    if (!data) {
+        fprintf(stderr, "couldn't load %s: %s\n", filename, stbi_failure_reason());
+        uint8_t white[4] = {255, 255, 255, 255};
+        texture->chain = mip_chain(1, white, &texture->pixels);
+        return;
+    }
+    texture->chain = mip_chain(x, data, &texture->pixels);
+    stbi_image_free(data);
+}
+
+// the framebuffer and the tiles cut from it follow the size rendered at
+static void resize(renderer_t * renderer, int width, int height) {
+    if (width == renderer->width && height == renderer->height) {
+        return;
+    }
+    free_tile_bins(renderer);
+    renderer->width = width;
+    renderer->height = height;
+    renderer->tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    renderer->tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    size_t num_bins = renderer->num_tasks * renderer->tiles_x * renderer->tiles_y;
+    renderer->tile_bins = malloc(num_bins * sizeof(vec_uint32_t));
+    for (size_t b = 0; b < num_bins; b++) {
+        renderer->tile_bins[b] = vec_uint32_t_init();
+    }
+    vec_uint8_t_resize(&renderer->colour, (size_t)width * height * 4, 0);
+    vec_float_resize(&renderer->depth, (size_t)width * height, 1.0f);
+}
+
+// as renderer.c, aspect is of the framebuffer
+static mat4s projection(float aspect) {
+    return glms_perspective(glm_rad(60.0f), aspect, 0.5f, 20.0f);
+}
+
+renderer_t * renderer_init(int width, int height) {
+    renderer_t * renderer = malloc(sizeof(renderer_t));
+
+    *renderer = (renderer_t){
+        .frame = 0,
+        .pool = pool_init(0),
+        .num_chunks = 0,
+        .chunks = NULL,
+        .chunk_trees = vec_size_t_init(),
+        .tree_chunk = vec_size_t_init(),
+        .chunk_origins = NULL,
+        .num_trees = 0,
+        .tree_indices = NULL,
+        .bounds = vec_box_t_init(),
+        .levels = vec_uint8_t_init(),
+        .draws = vec_draw_t_init(),
+        .draw_start = vec_size_t_init(),
+        .colour = vec_uint8_t_init(),
+        .depth = vec_float_init(),
+        .capture = NULL,
+        .capture_next = false,
+    };
+    for (int i = 0; i < NUM_LODS; i++) {
+        renderer->lod_indices[i] = vec_uint32_t_init();
+        renderer->lod_leaves[i] = vec_soft_vertex_t_init();
+        renderer->index_start[i] = vec_size_t_init();
+        renderer->leaf_start[i] = vec_size_t_init();
+    }
+    renderer->num_tasks = pool_num_threads(renderer->pool) * 4;
+    renderer->triangles = malloc(renderer->num_tasks * sizeof(vec_soft_triangle_t));
+    for (size_t k = 0; k < renderer->num_tasks; k++) {
+        renderer->triangles[k] = vec_soft_triangle_t_init();
+    }
+    resize(renderer, width, height);
+
+    const char * texture_file[MAX_OBJECT_TYPE] = {
+        "mud.png",
+        "bark.png",
+        "leaf.png",
+        "contact_shadow.png"
+    };
+    for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+        load_texture(&renderer->textures[i], texture_file[i]);
+    }
+
+    /* view-projection matrix, as renderer.c */
+    mat4s proj = projection((float)width/(float)height);
+    mat4s view = glms_lookat((vec3s){0.0f, 2.5f, 6.0f}, (vec3s){0.0f, 1.0f, 0.0f}, (vec3s){0.0f, 1.0f, 0.0f});
+    renderer->view = view;
+    renderer->view_proj = glms_mat4_mul(proj, view);
+    renderer->focal = proj.col[1].y;
+
+    return renderer;
+}
+
+// undoes the quantisation of mesh.h, moving positions from their chunk to
+// world space
+static vec3s dequantise_position(const int16_t * p, vec3s origin) {
+    return (vec3s){origin.x + p[0] / POSITION_SCALE, origin.y + p[1] / POSITION_SCALE,
+        origin.z + p[2] / POSITION_SCALE};
+}
+
+static vec3s dequantise_normal(const int16_t * n) {
+    return oct_decode((vec2s){unsnorm16(n[0]), unsnorm16(n[1])});
+}
+
+static soft_vertex_t plain_vertex(const vertex_t * v, vec3s origin) {
+    return (soft_vertex_t){
+        .position = dequantise_position(v->position, origin),
+        .uv = (vec2s){unsnorm16(v->texcoord[0]) * TEXCOORD_RANGE,
+            unsnorm16(v->texcoord[1]) * TEXCOORD_RANGE},
+        .lambert = glms_vec3_dot(light_dir, dequantise_normal(v->normal)),
+    };
+}
+
+// as the branch vertex shader, inflating the ring by its segment's radius
+static soft_vertex_t ring_vertex(mesh_chunk_t * chunk, const ring_vertex_t * r) {
+    vec3s d = dequantise_normal(r->direction);
+    float radius = *vec_float_at(&chunk->radii, (size_t)r->segment);
+    int corner = r->centre[3] % 4;
+    return (soft_vertex_t){
+        .position = glms_vec3_add(dequantise_position(r->centre, chunk->origin),
+            glms_vec3_scale(d, radius)),
+        .uv = (vec2s){corner * 0.5f, r->centre[3] / 4},
+        .lambert = glms_vec3_dot(light_dir, d),
+    };
+}
+
+// as the instance vertex shader, corner k of the unit cylinder stretched
+// between the two end frames of a segment
+static soft_vertex_t instance_vertex(mesh_chunk_t * chunk, const segment_instance_t * s,
+        int k) {
+    const float * corner = unit_cylinder[k];
+    bool far = corner[2] > 0.5f;
+    vec3s x = dequantise_normal(far ? s->x1 : s->x0);
+    vec3s z = dequantise_normal(far ? s->z1 : s->z0);
+    vec3s d = glms_vec3_add(glms_vec3_scale(x, corner[0]), glms_vec3_scale(z, corner[1]));
+    float radius = *vec_float_at(&chunk->radii, (size_t)s->segment[far]);
+    return (soft_vertex_t){
+        .position = glms_vec3_add(dequantise_position(far ? s->centre1 : s->centre0,
+            chunk->origin), glms_vec3_scale(d, radius)),
+        .uv = (vec2s){corner[3], corner[2]},
+        .lambert = glms_vec3_dot(light_dir, d),
+    };
+}
+
+// as the leaf vertex shader, corner k of the shared cluster
+static soft_vertex_t leaf_vertex(const leaf_instance_t * l, int k, vec3s origin) {
+    const float * corner = leaf_cluster[k];
+    vec3s x = dequantise_normal(l->x);
+    vec3s z = dequantise_normal(l->z);
+    float px = corner[0] * (l->radius + 0.15f * l->scale) + corner[2] * 0.1f * l->scale;
+    float pz = corner[1] * (l->radius + 0.15f * l->scale) + corner[3] * 0.1f * l->scale;
+    return (soft_vertex_t){
+        .position = glms_vec3_add(dequantise_position(l->position, origin),
+            glms_vec3_add(glms_vec3_scale(x, px), glms_vec3_scale(z, pz))),
+        .uv = (vec2s){corner[2], corner[3]},
+        .lambert = glms_vec3_dot(light_dir, glms_vec3_cross(z, x)),
+    };
+}
+
+// an empty vector may have no storage, and memcpy must not be passed NULL
+// even for no bytes
+static void copy_sizes(vec_size_t * dst, vec_size_t * src) {
+    vec_size_t_resize(dst, vec_size_t_size(src), 0);
+    if (vec_size_t_size(src) > 0) {
+        memcpy(vec_size_t_data(dst), vec_size_t_data(src),
+            vec_size_t_size(src) * sizeof(size_t));
+    }
+}
+
+static void copy_indices(vec_uint32_t * dst, vec_uint32_t * src) {
+    vec_uint32_t_resize(dst, vec_uint32_t_size(src), 0);
+    if (vec_uint32_t_size(src) > 0) {
+        memcpy(vec_uint32_t_data(dst), vec_uint32_t_data(src),
+            vec_uint32_t_size(src) * sizeof(uint32_t));
+    }
+}
+
+// indexes the unit cylinders of a tree's instances, which are converted to
+// UNIT_CYLINDER_VERTICES vertices each
+static void instance_indices(vec_uint32_t * dst, vec_uint32_t * instances) {
+    size_t n = vec_uint32_t_size(instances);
+    vec_uint32_t_resize(dst, n * UNIT_CYLINDER_VERTICES, 0);
+    uint32_t * out = vec_uint32_t_data(dst);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t first = *vec_uint32_t_at(instances, i) * UNIT_CYLINDER_VERTICES;
+        for (int k = 0; k < UNIT_CYLINDER_VERTICES; k++) {
+            out[i * UNIT_CYLINDER_VERTICES + k] = first + k;
+        }
+    }
+}
+
+// the chunks match the mesh's, and the trees are sorted into them with a
+// counting sort
+static void index_chunks(renderer_t * renderer, mesh_t * mesh) {
+    if (mesh->num_chunks > renderer->num_chunks) {
+        renderer->chunks = realloc(renderer->chunks, mesh->num_chunks * sizeof(soft_chunk_t));
+        renderer->chunk_origins = realloc(renderer->chunk_origins,
+            mesh->num_chunks * sizeof(vec3s));
+        for (size_t c = renderer->num_chunks; c < mesh->num_chunks; c++) {
+            renderer->chunks[c] = soft_chunk_init();
+        }
+        renderer->num_chunks = mesh->num_chunks;
+    }
+    size_t num_tree_chunks = vec_size_t_size(&mesh->tree_chunk);
+    for (size_t c = 0; c < renderer->num_chunks; c++) {
+        renderer->chunks[c].num_trees = 0;
+        renderer->chunk_origins[c] = c < mesh->num_chunks ? mesh->chunks[c].origin :
+            (vec3s){0};
+    }
+    for (size_t t = 0; t < mesh->num_trees; t++) {
+        size_t c = t < num_tree_chunks ? *vec_size_t_at(&mesh->tree_chunk, t) : 0;
+        renderer->chunks[c].num_trees++;
+    }
+    size_t first = 0;
+    for (size_t c = 0; c < renderer->num_chunks; c++) {
+        renderer->chunks[c].first_tree = first;
+        first += renderer->chunks[c].num_trees;
+        renderer->chunks[c].num_trees = 0;
+    }
+    vec_size_t_resize(&renderer->chunk_trees, mesh->num_trees, 0);
+    vec_size_t_resize(&renderer->tree_chunk, mesh->num_trees, 0);
+    size_t * chunk_trees = vec_size_t_data(&renderer->chunk_trees);
+    size_t * tree_chunk = vec_size_t_data(&renderer->tree_chunk);
+    for (size_t t = 0; t < mesh->num_trees; t++) {
+        tree_chunk[t] = t < num_tree_chunks ? *vec_size_t_at(&mesh->tree_chunk, t) : 0;
+        soft_chunk_t * s = &renderer->chunks[tree_chunk[t]];
+        chunk_trees[s->first_tree + s->num_trees++] = t;
+    }
+}
+
+// GROUND and SHADOW are converted when they change. Branches thicken every
+// step, so the rings, or instances, are always converted again
+static void upload_chunk(renderer_t * renderer, mesh_t * mesh, size_t c) {
+    mesh_chunk_t * chunk = &mesh->chunks[c];
+    soft_chunk_t * s = &renderer->chunks[c];
+    s->bounds = chunk->bounds;
+    for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+        if (i == TREE || i == LEAF || !chunk->dirty[i]) {
+            continue;
+        }
+        size_t n = vec_vertex_t_size(&chunk->vertices[i]);
+        vec_soft_vertex_t_resize(&s->vertices[i], n, (soft_vertex_t){0});
+        soft_vertex_t * out = vec_soft_vertex_t_data(&s->vertices[i]);
+        for (size_t k = 0; k < n; k++) {
+            out[k] = plain_vertex(vec_vertex_t_at(&chunk->vertices[i], k), chunk->origin);
+        }
+        chunk->dirty[i] = false;
+    }
+    vec_soft_vertex_t * branches = &s->vertices[TREE];
+    if (mesh->instanced) {
+        size_t n = vec_segment_instance_t_size(&chunk->instances);
+        vec_soft_vertex_t_resize(branches, n * UNIT_CYLINDER_VERTICES, (soft_vertex_t){0});
+        soft_vertex_t * out = vec_soft_vertex_t_data(branches);
+        for (size_t i = 0; i < n; i++) {
+            segment_instance_t * instance = vec_segment_instance_t_at(&chunk->instances, i);
+            for (int k = 0; k < UNIT_CYLINDER_VERTICES; k++) {
+                out[i * UNIT_CYLINDER_VERTICES + k] = instance_vertex(chunk, instance, k);
+            }
+        }
+    } else {
+        size_t n = vec_ring_vertex_t_size(&chunk->rings);
+        vec_soft_vertex_t_resize(branches, n, (soft_vertex_t){0});
+        soft_vertex_t * out = vec_soft_vertex_t_data(branches);
+        for (size_t i = 0; i < n; i++) {
+            out[i] = ring_vertex(chunk, vec_ring_vertex_t_at(&chunk->rings, i));
+        }
+    }
+    chunk->dirty[TREE] = false;
+}
+
+// the leaves of one level as LEAF_CLUSTER_VERTICES vertices a cluster, each
+// tree's placed relative to the origin of its chunk
+static void upload_leaves(renderer_t * renderer, mesh_t * mesh, int level) {
+    lod_t * l = &mesh->lods[level];
+    copy_sizes(&renderer->leaf_start[level], &l->leaf_start);
+    size_t n = vec_leaf_instance_t_size(&l->leaves);
+    vec_soft_vertex_t_resize(&renderer->lod_leaves[level], n * LEAF_CLUSTER_VERTICES,
+        (soft_vertex_t){0});
+    soft_vertex_t * out = vec_soft_vertex_t_data(&renderer->lod_leaves[level]);
+    const size_t * start = vec_size_t_data(&l->leaf_start);
+    size_t num_marks = vec_size_t_size(&l->leaf_start);
+    size_t num_tree_chunks = vec_size_t_size(&renderer->tree_chunk);
+    for (size_t t = 0; t + 1 < num_marks; t++) {
+        size_t c = t < num_tree_chunks ? *vec_size_t_at(&renderer->tree_chunk, t) : 0;
+        vec3s origin = renderer->chunk_origins[c];
+        for (size_t i = start[t]; i < start[t + 1] && i < n; i++) {
+            leaf_instance_t * leaf = vec_leaf_instance_t_at(&l->leaves, i);
+            for (int k = 0; k < LEAF_CLUSTER_VERTICES; k++) {
+                out[i * LEAF_CLUSTER_VERTICES + k] = leaf_vertex(leaf, k, origin);
+            }
+        }
+    }
+}
+
+static void upload_trees(renderer_t * renderer, mesh_t * mesh) {
+    renderer->instanced = mesh->instanced;
+    if (mesh->num_trees > renderer->num_trees) {
+        renderer->tree_indices = realloc(renderer->tree_indices,
+            mesh->num_trees * sizeof(vec_uint32_t));
+        for (size_t t = renderer->num_trees; t < mesh->num_trees; t++) {
+            renderer->tree_indices[t] = vec_uint32_t_init();
+        }
+        renderer->num_trees = mesh->num_trees;
+    }
+    for (size_t t = 0; t < mesh->num_trees; t++) {
+        if (mesh->instanced) {
+            instance_indices(&renderer->tree_indices[t], &mesh->tree_instances[t]);
+        } else {
+            copy_indices(&renderer->tree_indices[t], &mesh->tree_indices[t]);
+        }
+    }
+    if (mesh->leaves_dirty) {
+        upload_leaves(renderer, mesh, 0);
+        mesh->leaves_dirty = false;
+    }
+    if (mesh->lods_dirty) {
+        for (int lod = 1; lod < NUM_LODS; lod++) {
+            copy_indices(&renderer->lod_indices[lod], &mesh->lods[lod].indices);
+            copy_sizes(&renderer->index_start[lod], &mesh->lods[lod].index_start);
+            upload_leaves(renderer, mesh, lod);
+        }
+        mesh->lods_dirty = false;
+    }
+    vec_box_t_resize(&renderer->bounds, vec_box_t_size(&mesh->bounds), (box_t){0});
+    if (vec_box_t_size(&mesh->bounds) > 0) {
+        memcpy(vec_box_t_data(&renderer->bounds), vec_box_t_data(&mesh->bounds),
+            vec_box_t_size(&mesh->bounds) * sizeof(box_t));
+    }
+}
+
+// as renderer.c, the boxes of copies follow the trees they copy and take the
+// chunk's box with them
+static void upload_copies(renderer_t * renderer, mesh_t * mesh) {
+    size_t num_bounds = vec_box_t_size(&renderer->bounds);
+    for (size_t c = 0; c < mesh->num_chunks; c++) {
+        vec_mesh_copy_t * copies = &mesh->chunks[c].copies;
+        soft_chunk_t * s = &renderer->chunks[c];
+        size_t n = vec_mesh_copy_t_size(copies);
+        vec_mesh_copy_t_resize(&s->copies, n, (mesh_copy_t){0});
+        if (n > 0) {
+            memcpy(vec_mesh_copy_t_data(&s->copies), vec_mesh_copy_t_data(copies),
+                n * sizeof(mesh_copy_t));
+        }
+        vec_box_t_resize(&s->copy_bounds, n, (box_t){0});
+        box_t * bounds = vec_box_t_data(&s->copy_bounds);
+        for (size_t k = 0; k < n; k++) {
+            mesh_copy_t * copy = vec_mesh_copy_t_at(&s->copies, k);
+            box_t b = copy->tree < num_bounds ? *vec_box_t_at(&renderer->bounds, copy->tree) :
+                box_point((vec3s){0});
+            bounds[k] = box_transform(copy->transform, b);
+            s->bounds = box_extend(box_extend(s->bounds, bounds[k].lo), bounds[k].hi);
+        }
+    }
+}
+
+void renderer_upload_vertices(renderer_t * renderer, mesh_t * mesh) {
+    uint64_t start = timing_now();
+    index_chunks(renderer, mesh);
+    for (size_t c = 0; c < mesh->num_chunks; c++) {
+        upload_chunk(renderer, mesh, c);
+    }
+    upload_trees(renderer, mesh);
+    upload_copies(renderer, mesh);
+    timing_record(TIMING_UPLOAD, start);
+}
+
+void renderer_update(renderer_t * renderer) {
+    renderer->ry += 0.2f;
+}
+
+// the level a box is drawn at, from how much of the viewport it spans, or
+// CULLED if it is outside the frustum
+static uint8_t box_level(renderer_t * renderer, vec4s * planes, mat4s model_view, box_t * b) {
+    vec3s box[2] = {b->lo, b->hi};
+    if (!glms_aabb_frustum(box, planes)) {
+        return CULLED;
+    }
+    vec3s centre = transform(model_view, glms_vec3_scale(glms_vec3_add(b->lo, b->hi), 0.5f));
+    float radius = glms_vec3_distance(b->lo, b->hi) * 0.5f;
+    float distance = fmaxf(-centre.z, 0.1f);
+    return lod_for_screen_size(radius * renderer->focal / distance);
+}
+
+// culls the chunks, then the trees and copies of the chunks left, and picks
+// the level of the rest, as renderer.c
+static void select_levels(renderer_t * renderer, mat4s model, mat4s mvp) {
+    mat4s model_view = glms_mat4_mul(renderer->view, model);
+    vec4s planes[6];
+    glms_frustum_planes(mvp, planes);
+    vec_uint8_t_resize(&renderer->levels, renderer->num_trees, 0);
+    uint8_t * levels = vec_uint8_t_data(&renderer->levels);
+    const size_t * chunk_trees = vec_size_t_data(&renderer->chunk_trees);
+    size_t num_bounds = vec_box_t_size(&renderer->bounds);
+    for (size_t c = 0; c < renderer->num_chunks; c++) {
+        soft_chunk_t * chunk = &renderer->chunks[c];
+        vec3s chunk_box[2] = {chunk->bounds.lo, chunk->bounds.hi};
+        chunk->visible = glms_aabb_frustum(chunk_box, planes);
+        for (size_t k = chunk->first_tree; k < chunk->first_tree + chunk->num_trees; k++) {
+            size_t t = chunk_trees[k];
+            levels[t] = !chunk->visible ? CULLED : t >= num_bounds ? 0 :
+                box_level(renderer, planes, model_view, vec_box_t_at(&renderer->bounds, t));
+        }
+        size_t num_copies = vec_mesh_copy_t_size(&chunk->copies);
+        vec_uint8_t_resize(&chunk->copy_levels, num_copies, 0);
+        uint8_t * copy_levels = vec_uint8_t_data(&chunk->copy_levels);
+        for (size_t k = 0; k < num_copies; k++) {
+            copy_levels[k] = !chunk->visible ? CULLED :
+                box_level(renderer, planes, model_view, vec_box_t_at(&chunk->copy_bounds, k));
+        }
+    }
+}
+
+// the range of tree t in an array laid out by start, empty if the tree is
+// newer than the last rebuild of that level
+static size_t tree_range(vec_size_t * start, size_t t, size_t * first) {
+    if (t + 1 >= vec_size_t_size(start)) {
+        return 0;
+    }
+    *first = *vec_size_t_at(start, t);
+    return *vec_size_t_at(start, t + 1) - *first;
+}
+
+static void add_draw(renderer_t * renderer, draw_t draw) {
+    if (draw.num_triangles == 0) {
+        return;
+    }
+    size_t first = *vec_size_t_at(&renderer->draw_start, vec_draw_t_size(&renderer->draws));
+    vec_draw_t_push_back(&renderer->draws, draw);
+    vec_size_t_push_back(&renderer->draw_start, first + draw.num_triangles);
+}
+
+// the branches or leaves of tree t at a level. Instanced branches have no
+// coarse levels, so are always at full detail
+static void draw_tree(renderer_t * renderer, size_t t, uint8_t level, int type, mat4s mvp,
+        vec4s tint) {
+    draw_t draw = {.mvp = mvp, .type = type, .tint = tint};
+    size_t first = 0;
+    if (type == LEAF) {
+        vec_soft_vertex_t * leaves = &renderer->lod_leaves[level];
+        size_t count = tree_range(&renderer->leaf_start[level], t, &first);
+        draw.vertices = vec_soft_vertex_t_data(leaves) + first * LEAF_CLUSTER_VERTICES;
+        draw.num_vertices = vec_soft_vertex_t_size(leaves) - first * LEAF_CLUSTER_VERTICES;
+        draw.num_triangles = count * LEAF_CLUSTER_VERTICES / 3;
+    } else {
+        soft_chunk_t * chunk = &renderer->chunks[*vec_size_t_at(&renderer->tree_chunk, t)];
+        draw.vertices = vec_soft_vertex_t_data(&chunk->vertices[TREE]);
+        draw.num_vertices = vec_soft_vertex_t_size(&chunk->vertices[TREE]);
+        if (level == 0 || renderer->instanced) {
+            draw.indices = vec_uint32_t_data(&renderer->tree_indices[t]);
+            draw.num_triangles = vec_uint32_t_size(&renderer->tree_indices[t]) / 3;
+        } else {
+            size_t count = tree_range(&renderer->index_start[level], t, &first);
+            draw.indices = vec_uint32_t_data(&renderer->lod_indices[level]) + first;
+            draw.num_triangles = count / 3;
+        }
+    }
+    add_draw(renderer, draw);
+}
+
+// one object type of a visible chunk
+static void draw_chunk(renderer_t * renderer, soft_chunk_t * chunk, int type, mat4s mvp) {
+    static const vec4s no_tint = {1.0f, 1.0f, 1.0f, 1.0f};
+    uint8_t * levels = vec_uint8_t_data(&renderer->levels);
+    const size_t * chunk_trees = vec_size_t_data(&renderer->chunk_trees);
+    if ((type == TREE && !renderer->instanced) || type == LEAF) {
+        for (size_t k = chunk->first_tree; k < chunk->first_tree + chunk->num_trees; k++) {
+            size_t t = chunk_trees[k];
+            if (levels[t] != CULLED) {
+                draw_tree(renderer, t, levels[t], type, mvp, no_tint);
+            }
+        }
+    } else {
+        add_draw(renderer, (draw_t){
+            .vertices = vec_soft_vertex_t_data(&chunk->vertices[type]),
+            .num_vertices = vec_soft_vertex_t_size(&chunk->vertices[type]),
+            .num_triangles = vec_soft_vertex_t_size(&chunk->vertices[type]) / 3,
+            .mvp = mvp,
+            .type = type,
+            .tint = no_tint,
+        });
+    }
+}
+
+// the copies standing in a visible chunk, drawn from their trees' geometry,
+// which is already in world space. Each is a draw of its own, as every draw
+// here carries its own transform
+static void draw_copies(renderer_t * renderer, soft_chunk_t * chunk, int type, mat4s mvp) {
+    if (type != LEAF && type != TREE) {
+        return;
+    }
+    uint8_t * copy_levels = vec_uint8_t_data(&chunk->copy_levels);
+    for (size_t k = 0; k < vec_mesh_copy_t_size(&chunk->copies); k++) {
+        mesh_copy_t * copy = vec_mesh_copy_t_at(&chunk->copies, k);
+        if (copy_levels[k] == CULLED || copy->tree >= renderer->num_trees) {
+            continue;
+        }
+        draw_tree(renderer, copy->tree, copy_levels[k], type,
+            glms_mat4_mul(mvp, copy->transform), glms_vec4(copy->tint, 1.0f));
+    }
+}
+
+// the draws renderer.c would issue, in the same order
+static void gather_draws(renderer_t * renderer, mat4s mvp) {
+    vec_draw_t_clear(&renderer->draws);
+    vec_size_t_clear(&renderer->draw_start);
+    vec_size_t_push_back(&renderer->draw_start, 0);
+    for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+        for (size_t c = 0; c < renderer->num_chunks; c++) {
+            soft_chunk_t * chunk = &renderer->chunks[c];
+            if (chunk->visible) {
+                draw_chunk(renderer, chunk, i, mvp);
+                draw_copies(renderer, chunk, i, mvp);
+            }
+        }
+    }
+}
+
+typedef struct {
+    vec4s clip;
+    vec2s uv;
+    float lambert;
+} clip_vertex_t;
+
+static clip_vertex_t lerp_vertex(clip_vertex_t a, clip_vertex_t b, float t) {
+    return (clip_vertex_t){
+        .clip = glms_vec4_lerp(a.clip, b.clip, t),
+        .uv = glms_vec2_lerp(a.uv, b.uv, t),
+        .lambert = a.lambert + (b.lambert - a.lambert) * t,
+    };
+}
+
+// the polygon left of a triangle in front of the near plane, z >= -w, with
+// up to four vertices
+static int clip_near(const clip_vertex_t * in, clip_vertex_t * out) {
+    int n = 0;
+    for (int k = 0; k < 3; k++) {
+        clip_vertex_t a = in[k];
+        clip_vertex_t b = in[(k + 1) % 3];
+        float da = a.clip.z + a.clip.w;
+        float db = b.clip.z + b.clip.w;
+        if (da >= 0.0f) {
+            out[n++] = a;
+        }
+        if ((da >= 0.0f) != (db >= 0.0f)) {
+            out[n++] = lerp_vertex(a, b, da / (da - db));
+        }
+    }
+    return n;
+}
+
+// the pixels whose centres a triangle's box covers, clamped to a rectangle.
+// Returns false if there are none
+static bool pixel_bounds(const soft_triangle_t * tri, int x0, int y0, int x1, int y1,
+        int * bounds) {
+    float lo_x = fminf(fminf(tri->x[0], tri->x[1]), tri->x[2]);
+    float hi_x = fmaxf(fmaxf(tri->x[0], tri->x[1]), tri->x[2]);
+    float lo_y = fminf(fminf(tri->y[0], tri->y[1]), tri->y[2]);
+    float hi_y = fmaxf(fmaxf(tri->y[0], tri->y[1]), tri->y[2]);
+    // clamped as floats first, the window position of a vertex close to the
+    // camera's plane can be far outside any int
+    bounds[0] = ceilf(fmaxf(lo_x - 0.5f, x0));
+    bounds[1] = ceilf(fmaxf(lo_y - 0.5f, y0));
+    bounds[2] = floorf(fminf(hi_x - 0.5f, x1));
+    bounds[3] = floorf(fminf(hi_y - 0.5f, y1));
+    return bounds[0] <= bounds[2] && bounds[1] <= bounds[3];
+}
+
+// moves a clipped triangle to the window, and bins it into every tile its
+// box touches unless it covers no pixel centres at all
+static void bin_triangle(renderer_t * renderer, size_t task, uint32_t draw,
+        const clip_vertex_t * a, const clip_vertex_t * b, const clip_vertex_t * c) {
+    const clip_vertex_t * v[3] = {a, b, c};
+    soft_triangle_t tri = {.draw = draw};
+    for (int k = 0; k < 3; k++) {
+        float q = 1.0f / v[k]->clip.w;
+        tri.x[k] = (v[k]->clip.x * q * 0.5f + 0.5f) * renderer->width;
+        tri.y[k] = (0.5f - v[k]->clip.y * q * 0.5f) * renderer->height;
+        tri.z[k] = v[k]->clip.z * q * 0.5f + 0.5f;
+        tri.q[k] = q;
+        tri.u[k] = v[k]->uv.x * q;
+        tri.v[k] = v[k]->uv.y * q;
+        tri.l[k] = v[k]->lambert * q;
+    }
+    int bounds[4];
+    if (!pixel_bounds(&tri, 0, 0, renderer->width - 1, renderer->height - 1, bounds)) {
+        return;
+    }
+    vec_soft_triangle_t * triangles = &renderer->triangles[task];
+    uint32_t index = vec_soft_triangle_t_size(triangles);
+    vec_soft_triangle_t_push_back(triangles, tri);
+    size_t num_tiles = renderer->tiles_x * renderer->tiles_y;
+    vec_uint32_t * bins = renderer->tile_bins + task * num_tiles;
+    for (int ty = bounds[1] / TILE_SIZE; ty <= bounds[3] / TILE_SIZE; ty++) {
+        for (int tx = bounds[0] / TILE_SIZE; tx <= bounds[2] / TILE_SIZE; tx++) {
+            vec_uint32_t_push_back(&bins[ty * renderer->tiles_x + tx], index);
+        }
+    }
+}
+
+// triangle i of a draw through the vertex stage, clipped and binned
+static void setup_triangle(renderer_t * renderer, size_t task, uint32_t d, size_t i) {
+    draw_t * draw = vec_draw_t_at(&renderer->draws, d);
+    clip_vertex_t in[3];
+    for (int k = 0; k < 3; k++) {
+        size_t index = draw->indices ? draw->indices[i * 3 + k] : i * 3 + k;
+        if (index >= draw->num_vertices) {
+            // indices into rings that have since been cleared
+            return;
+        }
+        const soft_vertex_t * v = &draw->vertices[index];
+        in[k] = (clip_vertex_t){
+            .clip = glms_mat4_mulv(draw->mvp, glms_vec4(v->position, 1.0f)),
+            .uv = v->uv,
+            .lambert = v->lambert,
+        };
+    }
+    clip_vertex_t out[4];
+    int n = clip_near(in, out);
+    for (int k = 1; k + 1 < n; k++) {
+        bin_triangle(renderer, task, d, &out[0], &out[k], &out[k + 1]);
+    }
+}
+
+// task k sets up an even share of the frame's triangles
+static void setup_task(void * context, size_t task) {
+    renderer_t * renderer = context;
+    size_t num_tiles = renderer->tiles_x * renderer->tiles_y;
+    vec_soft_triangle_t_clear(&renderer->triangles[task]);
+    for (size_t t = 0; t < num_tiles; t++) {
+        vec_uint32_t_clear(&renderer->tile_bins[task * num_tiles + t]);
+    }
+    const size_t * draw_start = vec_size_t_data(&renderer->draw_start);
+    size_t num_draws = vec_draw_t_size(&renderer->draws);
+    size_t total = draw_start[num_draws];
+    size_t begin = total * task / renderer->num_tasks;
+    size_t end = total * (task + 1) / renderer->num_tasks;
+    if (begin == end) {
+        return;
+    }
+    // the draw holding the first triangle, the last whose start is no later
+    size_t lo = 0;
+    size_t hi = num_draws;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (draw_start[mid] <= begin) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    for (size_t i = begin, d = lo; i < end; i++) {
+        while (draw_start[d + 1] <= i) {
+            d++;
+        }
+        setup_triangle(renderer, task, d, i - draw_start[d]);
+    }
+}
+
+// a value interpolated across a triangle, at (x, y) pixels from the first
+// pixel rasterised it is at + dx * x + dy * y
+typedef struct {
+    float at;
+    float dx;
+    float dy;
+} plane_t;
+
+static plane_t make_plane(const float * value, const float * a, const float * b,
+        const float * w, float inv_area) {
+    plane_t p = {0};
+    for (int i = 0; i < 3; i++) {
+        p.at += w[i] * value[i] * inv_area;
+        p.dx += a[i] * value[i] * inv_area;
+        p.dy += b[i] * value[i] * inv_area;
+    }
+    return p;
+}
+
+static void texel(const mip_chain_t * chain, int level, int x, int y, float weight,
+        float * out) {
+    size_t dim = chain->dim >> level;
+    const uint8_t * t = chain->level[level] + ((y & (dim - 1)) * dim + (x & (dim - 1))) * 4;
+    for (int k = 0; k < 4; k++) {
+        out[k] += t[k] * weight;
+    }
+}
+
+// bilinear within a level, wrapping at the edges
+static void sample_level(const mip_chain_t * chain, int level, float u, float v, float weight,
+        float * out) {
+    size_t dim = chain->dim >> level;
+    float s = u * dim - 0.5f;
+    float t = v * dim - 0.5f;
+    float fs = floorf(s);
+    float ft = floorf(t);
+    // kept in range before the conversion, the wrap only needs the low bits
+    int x = fmodf(fs, dim);
+    int y = fmodf(ft, dim);
+    x += x < 0 ? dim : 0;
+    y += y < 0 ? dim : 0;
+    float wx = s - fs;
+    float wy = t - ft;
+    texel(chain, level, x, y, weight * (1.0f - wx) * (1.0f - wy), out);
+    texel(chain, level, x + 1, y, weight * wx * (1.0f - wy), out);
+    texel(chain, level, x, y + 1, weight * (1.0f - wx) * wy, out);
+    texel(chain, level, x + 1, y + 1, weight * wx * wy, out);
+}
+
+// trilinear, as LINEAR_MIPMAP_LINEAR, the level from the larger of the
+// texture's footprints along x and y. Returns RGBA in 0 .. 255
+static void sample(const mip_chain_t * chain, float u, float v, float footprint2,
+        float * out) {
+    out[0] = out[1] = out[2] = out[3] = 0.0f;
+    float lod = footprint2 > 1.0f ? 0.5f * log2f(footprint2) : 0.0f;
+    float top = chain->num_mipmaps - 1;
+    lod = fminf(lod, top);
+    int level = lod;
+    float blend = lod - level;
+    sample_level(chain, level, u, v, 1.0f - blend, out);
+    if (blend > 0.0f) {
+        sample_level(chain, level + 1, u, v, blend, out);
+    }
+}
+
+// rasterises a triangle within the rectangle of one tile. The edge functions
+// are tested SPAN pixels at a time, then the pixels inside are depth tested,
+// shaded as the fragment shader does and blended by their alpha
+static void raster_triangle(renderer_t * renderer, const soft_triangle_t * tri,
+        int x0, int y0, int x1, int y1) {
+    int bounds[4];
+    if (!pixel_bounds(tri, x0, y0, x1, y1, bounds)) {
+        return;
+    }
+    // edge i is opposite vertex i, w = a x + b y + c is twice the area of the
+    // triangle it makes with a point, and turned positive inside
+    float a[3];
+    float b[3];
+    float w[3];
+    bool top_left[3];
+    float px = bounds[0] + 0.5f;
+    float py = bounds[1] + 0.5f;
+    for (int i = 0; i < 3; i++) {
+        int j = (i + 1) % 3;
+        int k = (i + 2) % 3;
+        a[i] = tri->y[j] - tri->y[k];
+        b[i] = tri->x[k] - tri->x[j];
+        w[i] = a[i] * (px - tri->x[j]) + b[i] * (py - tri->y[j]);
+    }
+    float area = a[0] * (tri->x[0] - tri->x[1]) + b[0] * (tri->y[0] - tri->y[1]);
+    if (!(area != 0.0f && isfinite(area))) {
+        return;
+    }
+    float sign = area < 0.0f ? -1.0f : 1.0f;
+    for (int i = 0; i < 3; i++) {
+        a[i] *= sign;
+        b[i] *= sign;
+        w[i] *= sign;
+        // a pixel centre on an edge shared by two triangles goes to one of
+        // them, whose edge faces this way
+        top_left[i] = a[i] > 0.0f || (a[i] == 0.0f && b[i] > 0.0f);
+    }
+    float inv_area = sign / area;
+    plane_t z = make_plane(tri->z, a, b, w, inv_area);
+    plane_t q = make_plane(tri->q, a, b, w, inv_area);
+    plane_t u = make_plane(tri->u, a, b, w, inv_area);
+    plane_t v = make_plane(tri->v, a, b, w, inv_area);
+    plane_t l = make_plane(tri->l, a, b, w, inv_area);
+
+    draw_t * draw = vec_draw_t_at(&renderer->draws, tri->draw);
+    const mip_chain_t * chain = &renderer->textures[draw->type].chain;
+    float dim2 = (float)chain->dim * chain->dim;
+    vec4s tint = draw->tint;
+    uint8_t * colour = vec_uint8_t_data(&renderer->colour);
+    float * depth = vec_float_data(&renderer->depth);
+
+    for (int y = bounds[1]; y <= bounds[3]; y++) {
+        float dy = y - bounds[1];
+        for (int x = bounds[0]; x <= bounds[2]; x += SPAN) {
+            float dx0 = x - bounds[0];
+            int inside[SPAN];
+            float pz[SPAN];
+            for (int s = 0; s < SPAN; s++) {
+                float dx = dx0 + s;
+                float w0 = w[0] + a[0] * dx + b[0] * dy;
+                float w1 = w[1] + a[1] * dx + b[1] * dy;
+                float w2 = w[2] + a[2] * dx + b[2] * dy;
+                inside[s] = ((w0 > 0.0f) | ((w0 == 0.0f) & top_left[0])) &
+                    ((w1 > 0.0f) | ((w1 == 0.0f) & top_left[1])) &
+                    ((w2 > 0.0f) | ((w2 == 0.0f) & top_left[2])) &
+                    (x + s <= bounds[2]);
+                pz[s] = z.at + z.dx * dx + z.dy * dy;
+            }
+            for (int s = 0; s < SPAN; s++) {
+                size_t p = (size_t)y * renderer->width + x + s;
+                if (!inside[s] || !(pz[s] <= depth[p])) {
+                    continue;
+                }
+                float dx = dx0 + s;
+                float pq = 1.0f / (q.at + q.dx * dx + q.dy * dy);
+                float pu = (u.at + u.dx * dx + u.dy * dy) * pq;
+                float pv = (v.at + v.dx * dx + v.dy * dy) * pq;
+                float lambert = (l.at + l.dx * dx + l.dy * dy) * pq;
+                // the change in uv to the next pixel along x and along y
+                float dudx = (u.dx - pu * q.dx) * pq;
+                float dvdx = (v.dx - pv * q.dx) * pq;
+                float dudy = (u.dy - pu * q.dy) * pq;
+                float dvdy = (v.dy - pv * q.dy) * pq;
+                float footprint2 = fmaxf(dudx * dudx + dvdx * dvdx,
+                    dudy * dudy + dvdy * dvdy) * dim2;
+                float t[4];
+                sample(chain, pu, pv, footprint2, t);
+                float light[3] = {
+                    lambert * light_colour.x + ambient_colour.x,
+                    lambert * light_colour.y + ambient_colour.y,
+                    lambert * light_colour.z + ambient_colour.z,
+                };
+                float alpha = fminf(fmaxf(t[3] * tint.w / 255.0f, 0.0f), 1.0f);
+                uint8_t * out = colour + p * 4;
+                for (int k = 0; k < 3; k++) {
+                    float c = fminf(fmaxf(t[k] * tint.raw[k] * light[k], 0.0f), 255.0f);
+                    out[k] = c * alpha + out[k] * (1.0f - alpha) + 0.5f;
+                }
+                out[3] = alpha * 255.0f + 0.5f;
+                depth[p] = pz[s];
+            }
+        }
+    }
+}
+
+// clears one tile and draws every triangle binned into it, task by task,
+// which keeps them in the order they were submitted
+static void raster_tile(void * context, size_t tile) {
+    renderer_t * renderer = context;
+    int x0 = (tile % renderer->tiles_x) * TILE_SIZE;
+    int y0 = (tile / renderer->tiles_x) * TILE_SIZE;
+    int x1 = x0 + TILE_SIZE < renderer->width ? x0 + TILE_SIZE : renderer->width;
+    int y1 = y0 + TILE_SIZE < renderer->height ? y0 + TILE_SIZE : renderer->height;
+    uint8_t * colour = vec_uint8_t_data(&renderer->colour);
+    float * depth = vec_float_data(&renderer->depth);
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            size_t p = (size_t)y * renderer->width + x;
+            memcpy(colour + p * 4, clear_colour, 4);
+            depth[p] = 1.0f;
+        }
+    }
+    size_t num_tiles = renderer->tiles_x * renderer->tiles_y;
+    for (size_t k = 0; k < renderer->num_tasks; k++) {
+        vec_uint32_t * bin = &renderer->tile_bins[k * num_tiles + tile];
+        const soft_triangle_t * triangles = vec_soft_triangle_t_data(&renderer->triangles[k]);
+        foreach(vec_uint32_t, bin, it) {
+            raster_triangle(renderer, &triangles[*it.ref], x0, y0, x1 - 1, y1 - 1);
+        }
+    }
+}
+
+void renderer_set_capture(renderer_t * renderer, capture_t * capture) {
+    // frames are copied out as they're rendered, so there's nothing to flush
+    renderer->capture = capture;
+    renderer->capture_next = false;
+    if (capture) {
+        renderer->capture_view_proj = glms_mat4_mul(projection(
+            (float)capture_width(capture) / (float)capture_height(capture)), renderer->view);
+    }
+}
+
+void renderer_capture_frame(renderer_t * renderer) {
+    renderer->capture_next = renderer->capture != NULL;
+}
+
+// hands the frame just rendered to the capture, dropped if it's still busy
+// with the frames before
+static void capture_framebuffer(renderer_t * renderer) {
+    renderer->capture_next = false;
+    uint8_t * slot = capture_acquire(renderer->capture);
+    if (slot) {
+        memcpy(slot, vec_uint8_t_data(&renderer->colour), vec_uint8_t_size(&renderer->colour));
+        capture_submit(renderer->capture);
+    }
+}
+
+void renderer_render(renderer_t * renderer, int cur_width, int cur_height) {
+    uint64_t start = timing_now();
+    mat4s view_proj = renderer->view_proj;
+    if (renderer->capture) {
+        cur_width = capture_width(renderer->capture);
+        cur_height = capture_height(renderer->capture);
+        view_proj = renderer->capture_view_proj;
+    }
+    resize(renderer, cur_width, cur_height);
+    mat4s rxm = glms_quat_mat4(glms_quatv(glm_rad(renderer->rx), (vec3s){1.0f, 0.0f, 0.0f}));
+    mat4s rym = glms_quat_mat4(glms_quatv(glm_rad(renderer->ry), (vec3s){0.0f, 1.0f, 0.0f}));
+    mat4s model = glms_mat4_mul(rxm, rym);
+    mat4s mvp = glms_mat4_mul(view_proj, model);
+
+    select_levels(renderer, model, mvp);
+    gather_draws(renderer, mvp);
+    pool_run(renderer->pool, setup_task, renderer, renderer->num_tasks);
+    pool_run(renderer->pool, raster_tile, renderer, renderer->tiles_x * renderer->tiles_y);
+    if (renderer->capture_next) {
+        capture_framebuffer(renderer);
+    }
+    renderer->frame++;
+    timing_record(TIMING_RENDER, start);
+}
+
+const uint8_t * renderer_pixels(renderer_t * renderer, int * width, int * height) {
+    *width = renderer->width;
+    *height = renderer->height;
+    return vec_uint8_t_data(&renderer->colour);
+}
@@ -0,0 +1,15 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include "renderer.h"
+
+#include <stdint.h>
+
+// raster.c implements renderer.h on the CPU, for machines without a GPU.
+// Linked in place of renderer.c it draws the same frames into a framebuffer
+// in memory rather than to a window
+
+// the last frame rendered as RGBA8, top row first, and its size
+const uint8_t * renderer_pixels(renderer_t * renderer, int * width, int * height);
+
+#endif
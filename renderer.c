@@ -1,12 +1,18 @@
-#include "mymath.h"
+#include "capture.h"
+#include "image.h"
+#include "lod.h"
+#include "mesh.h"
+#include "timing.h"
 
 #define SOKOL_IMPL
 #define SOKOL_GLES3
 #include "sokol_gfx.h"
+#include <GLES3/gl3.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 /* a uniform block with a model-view-projection matrix */
@@ -14,83 +20,207 @@ typedef struct {
     mat4s mvp;
 } params_t;
 
+// and one for the fragment shaders, the colour of copies of trees is
+// multiplied by their tint, everything else's by white
 typedef struct {
-    vec3s position;
-    vec3s normal;
-    vec2s texcoord;
-} vertex_t;
+    vec4s tint;
+} fs_params_t;
+
+static const fs_params_t no_tint = {.tint = {1.0f, 1.0f, 1.0f, 1.0f}};
+
+// a copy of a tree drawn as an instance of the tree's branches. transform
+// takes the tree from the origin of its chunk to where the copy stands
+typedef struct {
+    mat4s transform;
+    vec4s tint;
+} copy_instance_t;
 
 #define POD
 #define NOT_INTEGRAL
-#define T vertex_t
+#define T copy_instance_t
 #include <ctl/vector.h>
 
+// a copy left after culling, with the tree it copies and the level it is
+// drawn at this frame
+typedef struct {
+    size_t tree;
+    uint8_t level;
+    copy_instance_t instance;
+} copy_draw_t;
+
 #define POD
-#define T uint8_t
+#define NOT_INTEGRAL
+#define T copy_draw_t
 #include <ctl/vector.h>
 
+// segment radii are stored in rows of this many texels, the branch vertex
+// shader relies on this value
+#define RADII_WIDTH 1024
+
+// a GL buffer kept across growth steps. Writes go straight to GL so new
+// geometry can be appended, and it is only reallocated, doubling its
+// capacity, when it fills. sokol draws from it as an injected buffer
+typedef struct {
+    sg_buffer_type type;
+    GLuint gl;
+    sg_buffer buffer;
+    size_t size;
+    size_t capacity;
+} gpu_buffer_t;
+
+// the level of a tree outside the view frustum
+#define CULLED UINT8_MAX
+
+// the buffers of a mesh chunk, drawn with its origin added to the model
+// matrix. The full detail indices of its trees, or their instances, are in
+// one buffer, a slot for each tree in chunk_trees order, see
+// upload_tree_branches. num_instances counts the slack too. The chunk's segment
+// radii are in its own texture, RADII_WIDTH segments to a row, written
+// straight to GL and injected into sokol as the buffers are
 typedef struct {
-    vec2s offset;
-    float scale;
-} atlas_t;
-
-typedef enum object_type_e {
-    GROUND,
-    TREE,
-    LEAF,
-    SHADOW,
-    MAX_OBJECT_TYPE
-} object_type_e;
+    vec3s origin;
+    box_t bounds;
+    size_t num_vertices[MAX_OBJECT_TYPE];
+    gpu_buffer_t vertices[MAX_OBJECT_TYPE];
+    gpu_buffer_t instances;
+    size_t num_instances;
+    gpu_buffer_t indices;
+    GLuint radii_gl;
+    sg_image radii;
+    int radii_rows;
+    // its trees are chunk_trees[first_tree .. first_tree + num_trees]
+    size_t first_tree;
+    size_t num_trees;
+    // copies of trees standing in the chunk, with the box around each and the
+    // level it is drawn at this frame
+    vec_mesh_copy_t copies;
+    vec_box_t copy_bounds;
+    vec_uint8_t copy_levels;
+    // some of the chunk is inside the view frustum this frame
+    bool visible;
+} gpu_chunk_t;
+
+// frames read back for capture at a time
+#define CAPTURE_BUFFERS 3
+// how long, in ns, to wait for the last frames when capture stops
+#define CAPTURE_TIMEOUT 1000000000
+
+// sokol's pools hold every buffer and image, the six buffers of each chunk
+// set the limit on the size of forest that can be drawn
+#define BUFFER_POOL_SIZE 65535
+#define IMAGE_POOL_SIZE 4096
 
 typedef struct {
     long frame;
-    vec_vertex_t vertices[MAX_OBJECT_TYPE];
-    int floats_per_vertex;
     vec_uint8_t pixels[MAX_OBJECT_TYPE];
     sg_image img[MAX_OBJECT_TYPE];
-    sg_bindings bind[MAX_OBJECT_TYPE];;
+    sg_bindings bind[MAX_OBJECT_TYPE];
+    size_t num_chunks;
+    gpu_chunk_t * chunks;
+    // the trees ordered by chunk, and the chunk of each tree
+    vec_size_t chunk_trees;
+    vec_size_t tree_chunk;
+    // where the slot of each tree's full detail branches is in its chunk's
+    // buffer, how much of it they fill and how much they can, counted in
+    // indices, or in instances when instanced
+    size_t num_trees;
+    vec_size_t tree_first;
+    vec_size_t tree_count;
+    vec_size_t tree_capacity;
+    vec_uint32_t chunk_indices;
+    vec_segment_instance_t chunk_instances;
+    // the coarse levels, and the leaves of every level, with copies of the
+    // ranges of each tree in them
+    gpu_buffer_t lod_indices[NUM_LODS];
+    gpu_buffer_t lod_leaves[NUM_LODS];
+    vec_size_t index_start[NUM_LODS];
+    vec_size_t leaf_start[NUM_LODS];
+    vec_box_t bounds;
+    // the level each tree is drawn at this frame, or CULLED
+    vec_uint8_t levels;
     sg_pipeline pip;
+    // branches are drawn from ring vertices inflated by the radius texture
+    sg_pipeline branch_pip[2];
+    // 16 bit indices while the rings of every chunk fit, the 32 bit pipeline
+    // after that
+    bool short_indices;
+    vec_uint16_t indices_staging;
+    // or drawn as instances of a unit cylinder, one per segment
+    bool instanced;
+    sg_pipeline instance_pip;
+    sg_bindings instance_bind;
+    // leaves are drawn as instances of one cluster, one per tip
+    sg_pipeline leaf_pip;
+    sg_bindings leaf_bind;
+    // the copies drawn this frame, sorted by the tree they copy and its
+    // level, and their transforms and tints in the same order, as instances
+    // of the ring branches of their trees
+    vec_copy_draw_t copy_draws;
+    vec_copy_instance_t copy_staging;
+    gpu_buffer_t copy_instances;
+    sg_pipeline copy_pip[2];
+    vec_float radii_staging;
     sg_pass_action pass_action;
+    mat4s view;
     mat4s view_proj;
+    // scales a size over a distance to a fraction of the viewport height
+    float focal;
     float rx;
     float ry;
+    // a frame to capture is drawn again into an offscreen pass of the
+    // capture's size, with a projection of its own, and read back into a ring
+    // of pixel pack buffers. Reads capture_head .. capture_head +
+    // capture_pending are in flight, each handed to the capture once its
+    // fence has passed
+    capture_t * capture;
+    bool capture_next;
+    sg_image capture_colour;
+    sg_image capture_depth;
+    sg_pass capture_pass;
+    mat4s capture_view_proj;
+    GLuint capture_buffers[CAPTURE_BUFFERS];
+    GLsync capture_fences[CAPTURE_BUFFERS];
+    int capture_head;
+    int capture_pending;
 } renderer_t;
 
-// recursively subdivide the image, assumes the source is power of two square
-sg_image_desc mip_chain(size_t dim, uint8_t *data, vec_uint8_t *output) {
-    size_t width = dim;
-    // a mip map chain always fits in twice the original size
-    vec_uint8_t_resize(output, dim * dim * 4 * 2, 0);
-    uint8_t *p = vec_uint8_t_data(output);
-    memcpy(p, data, dim * dim * 4);
-    int num_mipmaps = 0;
-    sg_image_data img_data;
-    do {
-        size_t size = dim * dim * 4;
-        img_data.subimage[0][num_mipmaps].ptr = p;
-        img_data.subimage[0][num_mipmaps].size = size;
-        num_mipmaps += 1;
-        uint8_t * src = p;
-        p += size;
-        dim = dim >> 1;
-        for (size_t y = 0; y < dim; y++) {
-            for (size_t x = 0; x < dim; x++) {
-                for (size_t k = 0; k < 4; k++) {
-                    size_t s00 = k + (x * 2 + y * 4 * dim) * 4; 
-                    p[k + (x + y * dim) * 4] =
-                        (src[s00] +
-                        src[s00 + 4] +
-                        src[s00 + 2 * dim * 4] +
-                        src[s00 + 2 * dim * 4 + 4]) / 4;
-                }
-            }
-        }
-    } while(dim > 0);
+// looks up the radius of a segment in the radii texture
+#define SEGMENT_RADIUS_GLSL \
+    "uniform highp sampler2D radii;\n" \
+    "float segment_radius(float segment) {\n" \
+    "  int s = int(segment);\n" \
+    "  return texelFetch(radii, ivec2(s % 1024, s / 1024), 0).r;\n" \
+    "}\n"
+
+// undoes the quantisation of mesh.h, the scales are POSITION_SCALE and
+// TEXCOORD_RANGE
+#define DEQUANTISE_GLSL \
+    "vec3 dequantise_position(vec4 p) {\n" \
+    "  return p.xyz * (1.0 / 512.0);\n" \
+    "}\n" \
+    "vec2 dequantise_texcoord(vec2 t) {\n" \
+    "  return t * 16.0;\n" \
+    "}\n" \
+    "vec3 oct_decode(vec2 e) {\n" \
+    "  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n" \
+    "  if (n.z < 0.0) {\n" \
+    "    vec2 s = vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);\n" \
+    "    n.xy = (1.0 - abs(e.yx)) * s;\n" \
+    "  }\n" \
+    "  return normalize(n);\n" \
+    "}\n"
+
+static sg_image_desc image_desc(mip_chain_t * chain) {
+    sg_image_data img_data = {0};
+    for (int i = 0; i < chain->num_mipmaps; i++) {
+        img_data.subimage[0][i].ptr = chain->level[i];
+        img_data.subimage[0][i].size = chain->size[i];
+    }
 
     sg_image_desc img_desc = {
-        .width = width,
-        .height = width,
-        .num_mipmaps = num_mipmaps,
+        .width = chain->dim,
+        .height = chain->dim,
+        .num_mipmaps = chain->num_mipmaps,
         .pixel_format = SG_PIXELFORMAT_RGBA8,
         .mag_filter = SG_FILTER_LINEAR,
         .min_filter = SG_FILTER_LINEAR_MIPMAP_LINEAR,
@@ -99,12 +229,275 @@ sg_image_desc mip_chain(size_t dim, uint8_t *data, vec_uint8_t *output) {
     return img_desc;
 }
 
+// the tint is a uniform, or for copies drawn as instances passed on from the
+// vertex shader
+#define FS_SOURCE(tint) \
+    "#version 310 es\n" \
+    "precision mediump float;\n" \
+    "uniform sampler2D tex;" \
+    tint \
+    "in vec3 vnormal;\n" \
+    "in vec2 uv;\n" \
+    "out vec4 frag_color;\n" \
+    "void main() {\n" \
+    "  vec3 light_dir = vec3(0.5, -0.5, 0.0);\n" \
+    "  vec3 light_colour = vec3(1.9, 1.9, 1.7);\n" \
+    "  vec3 ambient_colour = vec3(1.9, 1.9, 1.9);\n" \
+    "  float lambert = dot(light_dir, vnormal);\n" \
+    "  vec4 colour = texture(tex, uv);\n" \
+    "  frag_color = colour * tint * vec4(lambert * light_colour + ambient_colour, 1.0);\n" \
+    "}\n"
+
+static const char * fs_source = FS_SOURCE("uniform vec4 tint;\n");
+static const char * copy_fs_source = FS_SOURCE("in vec4 tint;\n");
+
+#define FS_UNIFORM_BLOCK { \
+    .size = sizeof(fs_params_t), \
+    .uniforms = { [0] = { .name="tint", .type=SG_UNIFORMTYPE_FLOAT4 } } \
+}
+
+static sg_pipeline make_pipeline(sg_shader shd, sg_layout_desc layout,
+        sg_index_type index_type) {
+    return sg_make_pipeline(&(sg_pipeline_desc){
+        .layout = layout,
+        .shader = shd,
+        .index_type = index_type,
+        .depth = {
+            .compare = SG_COMPAREFUNC_LESS_EQUAL,
+            .write_enabled = true,
+        },
+        .colors[0] = {
+            .blend = {
+                .src_factor_rgb =  SG_BLENDFACTOR_SRC_ALPHA,
+                .dst_factor_rgb = SG_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+                .enabled = true
+            }
+        },
+        .face_winding = SG_FACEWINDING_CCW,
+        //.cull_mode = SG_CULLMODE_BACK,
+    });
+}
+
+static gpu_buffer_t gpu_buffer_init(sg_buffer_type type) {
+    return (gpu_buffer_t){.type = type};
+}
+
+static void gpu_buffer_free(gpu_buffer_t * buffer) {
+    sg_destroy_buffer(buffer->buffer);
+    glDeleteBuffers(1, &buffer->gl);
+    *buffer = gpu_buffer_init(buffer->type);
+}
+
+// writes size bytes at offset, keeping what is before offset. Anything that
+// was after the write is dropped
+static void gpu_buffer_write(gpu_buffer_t * buffer, size_t offset, const void * data,
+        size_t size) {
+    size_t end = offset + size;
+    if (end > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < end) {
+            capacity *= 2;
+        }
+        GLuint gl;
+        glGenBuffers(1, &gl);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, gl);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+        if (offset > 0) {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer->gl);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, offset);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        sg_destroy_buffer(buffer->buffer);
+        glDeleteBuffers(1, &buffer->gl);
+        buffer->gl = gl;
+        buffer->capacity = capacity;
+        buffer->buffer = sg_make_buffer(&(sg_buffer_desc){
+            .size = capacity,
+            .type = buffer->type,
+            .gl_buffers[0] = gl
+        });
+    }
+    if (size > 0) {
+        // bound to the copy target so the element array binding of sokol's
+        // vertex array object is left alone
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer->gl);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    buffer->size = end;
+    // sokol caches which GL buffers are bound
+    sg_reset_state_cache();
+}
+
+// overwrites size bytes at offset, within what the buffer already holds,
+// keeping the rest
+static void gpu_buffer_update(gpu_buffer_t * buffer, size_t offset, const void * data,
+        size_t size) {
+    if (size == 0) {
+        return;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer->gl);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    sg_reset_state_cache();
+}
+
+// uploads the bytes of data beyond those the buffer already holds, for
+// arrays that only grow
+static void gpu_buffer_append(gpu_buffer_t * buffer, const void * data, size_t size) {
+    size_t offset = buffer->size < size ? buffer->size : size;
+    gpu_buffer_write(buffer, offset, (const uint8_t *)data + offset, size - offset);
+}
+
+static gpu_chunk_t gpu_chunk_init() {
+    gpu_chunk_t chunk = {
+        .instances = gpu_buffer_init(SG_BUFFERTYPE_VERTEXBUFFER),
+        .indices = gpu_buffer_init(SG_BUFFERTYPE_INDEXBUFFER),
+        .copies = vec_mesh_copy_t_init(),
+        .copy_bounds = vec_box_t_init(),
+        .copy_levels = vec_uint8_t_init(),
+    };
+    for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+        chunk.vertices[i] = gpu_buffer_init(SG_BUFFERTYPE_VERTEXBUFFER);
+    }
+    return chunk;
+}
+
+static void gpu_chunk_free(gpu_chunk_t * chunk) {
+    for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+        gpu_buffer_free(&chunk->vertices[i]);
+    }
+    gpu_buffer_free(&chunk->instances);
+    gpu_buffer_free(&chunk->indices);
+    sg_destroy_image(chunk->radii);
+    glDeleteTextures(1, &chunk->radii_gl);
+    vec_mesh_copy_t_free(&chunk->copies);
+    vec_box_t_free(&chunk->copy_bounds);
+    vec_uint8_t_free(&chunk->copy_levels);
+}
+
+// the camera looks at the middle of the forest, aspect is of the target
+static mat4s projection(float aspect) {
+    return glms_perspective(glm_rad(60.0f), aspect, 0.5f, 20.0f);
+}
+
+// hands the finished reads to the capture, oldest first, waiting for them
+// if wait is set. The rows come back bottom first and are flipped
+static void read_captures(renderer_t * renderer, bool wait) {
+    int width = capture_width(renderer->capture);
+    int height = capture_height(renderer->capture);
+    size_t row = (size_t)width * 4;
+    while (renderer->capture_pending > 0) {
+        int b = renderer->capture_head;
+        GLenum status = glClientWaitSync(renderer->capture_fences[b],
+            wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? CAPTURE_TIMEOUT : 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            return;
+        }
+        glDeleteSync(renderer->capture_fences[b]);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, renderer->capture_buffers[b]);
+        const uint8_t * pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, row * height,
+            GL_MAP_READ_BIT);
+        uint8_t * slot = capture_acquire(renderer->capture);
+        if (pixels && slot) {
+            for (int y = 0; y < height; y++) {
+                memcpy(slot + y * row, pixels + (height - 1 - y) * row, row);
+            }
+            capture_submit(renderer->capture);
+        } else if (slot) {
+            capture_drop(renderer->capture);
+        }
+        if (pixels) {
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        renderer->capture_head = (b + 1) % CAPTURE_BUFFERS;
+        renderer->capture_pending--;
+    }
+}
+
+void renderer_set_capture(renderer_t * renderer, capture_t * capture) {
+    if (renderer->capture) {
+        read_captures(renderer, true);
+        // reads that still haven't finished are given up on
+        for (; renderer->capture_pending > 0; renderer->capture_pending--) {
+            glDeleteSync(renderer->capture_fences[renderer->capture_head]);
+            renderer->capture_head = (renderer->capture_head + 1) % CAPTURE_BUFFERS;
+            capture_drop(renderer->capture);
+        }
+        glDeleteBuffers(CAPTURE_BUFFERS, renderer->capture_buffers);
+        sg_destroy_pass(renderer->capture_pass);
+        sg_destroy_image(renderer->capture_colour);
+        sg_destroy_image(renderer->capture_depth);
+    }
+    renderer->capture = capture;
+    renderer->capture_next = false;
+    renderer->capture_head = 0;
+    if (!capture) {
+        return;
+    }
+    int width = capture_width(capture);
+    int height = capture_height(capture);
+    sg_image_desc target = {
+        .render_target = true,
+        .width = width,
+        .height = height,
+        .pixel_format = SG_PIXELFORMAT_RGBA8,
+        .min_filter = SG_FILTER_LINEAR,
+        .mag_filter = SG_FILTER_LINEAR,
+    };
+    renderer->capture_colour = sg_make_image(&target);
+    // matching the depth format the pipelines default to
+    target.pixel_format = SG_PIXELFORMAT_DEPTH_STENCIL;
+    renderer->capture_depth = sg_make_image(&target);
+    renderer->capture_pass = sg_make_pass(&(sg_pass_desc){
+        .color_attachments[0].image = renderer->capture_colour,
+        .depth_stencil_attachment.image = renderer->capture_depth,
+    });
+    glGenBuffers(CAPTURE_BUFFERS, renderer->capture_buffers);
+    for (int b = 0; b < CAPTURE_BUFFERS; b++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, renderer->capture_buffers[b]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)width * height * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    renderer->capture_view_proj = glms_mat4_mul(projection((float)width / (float)height),
+        renderer->view);
+}
+
+void renderer_capture_frame(renderer_t * renderer) {
+    renderer->capture_next = renderer->capture != NULL;
+}
+
 void renderer_free(renderer_t ** renderer) {
     if (*renderer) {
+        renderer_set_capture(*renderer, NULL);
         for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
-            vec_vertex_t_free(&(*renderer)->vertices[i]);
             vec_uint8_t_free(&(*renderer)->pixels[i]);
         }
+        for (size_t c = 0; c < (*renderer)->num_chunks; c++) {
+            gpu_chunk_free(&(*renderer)->chunks[c]);
+        }
+        free((*renderer)->chunks);
+        vec_size_t_free(&(*renderer)->chunk_trees);
+        vec_size_t_free(&(*renderer)->tree_chunk);
+        vec_size_t_free(&(*renderer)->tree_first);
+        vec_size_t_free(&(*renderer)->tree_count);
+        vec_size_t_free(&(*renderer)->tree_capacity);
+        vec_uint32_t_free(&(*renderer)->chunk_indices);
+        vec_segment_instance_t_free(&(*renderer)->chunk_instances);
+        vec_copy_draw_t_free(&(*renderer)->copy_draws);
+        vec_copy_instance_t_free(&(*renderer)->copy_staging);
+        gpu_buffer_free(&(*renderer)->copy_instances);
+        for (int i = 0; i < NUM_LODS; i++) {
+            gpu_buffer_free(&(*renderer)->lod_indices[i]);
+            gpu_buffer_free(&(*renderer)->lod_leaves[i]);
+            vec_size_t_free(&(*renderer)->index_start[i]);
+            vec_size_t_free(&(*renderer)->leaf_start[i]);
+        }
+        vec_box_t_free(&(*renderer)->bounds);
+        vec_uint8_t_free(&(*renderer)->levels);
+        vec_float_free(&(*renderer)->radii_staging);
+        vec_uint16_t_free(&(*renderer)->indices_staging);
         sg_shutdown();
         free(*renderer);
         *renderer = NULL;
@@ -113,7 +506,10 @@ void renderer_free(renderer_t ** renderer) {
 
 renderer_t * renderer_init(int width, int height) {
     /* setup sokol_gfx */
-    sg_desc desc = {0};
+    sg_desc desc = {
+        .buffer_pool_size = BUFFER_POOL_SIZE,
+        .image_pool_size = IMAGE_POOL_SIZE,
+    };
     sg_setup(&desc);
     assert(sg_isvalid());
 
@@ -121,8 +517,31 @@ renderer_t * renderer_init(int width, int height) {
 
     *renderer = (renderer_t){
         .frame = 0,
-        .floats_per_vertex = sizeof(vertex_t) / sizeof(float),
+        .radii_staging = vec_float_init(),
+        .indices_staging = vec_uint16_t_init(),
+        .num_chunks = 0,
+        .chunks = NULL,
+        .chunk_trees = vec_size_t_init(),
+        .tree_chunk = vec_size_t_init(),
+        .num_trees = 0,
+        .tree_first = vec_size_t_init(),
+        .tree_count = vec_size_t_init(),
+        .tree_capacity = vec_size_t_init(),
+        .chunk_indices = vec_uint32_t_init(),
+        .chunk_instances = vec_segment_instance_t_init(),
+        .copy_draws = vec_copy_draw_t_init(),
+        .copy_staging = vec_copy_instance_t_init(),
+        .copy_instances = gpu_buffer_init(SG_BUFFERTYPE_VERTEXBUFFER),
+        .bounds = vec_box_t_init(),
+        .levels = vec_uint8_t_init(),
+        .capture = NULL,
     };
+    for (int i = 0; i < NUM_LODS; i++) {
+        renderer->lod_indices[i] = gpu_buffer_init(SG_BUFFERTYPE_INDEXBUFFER);
+        renderer->lod_leaves[i] = gpu_buffer_init(SG_BUFFERTYPE_VERTEXBUFFER);
+        renderer->index_start[i] = vec_size_t_init();
+        renderer->leaf_start[i] = vec_size_t_init();
+    }
 
     char texture_file[MAX_OBJECT_TYPE][32] = {
         "mud.png",
@@ -132,13 +551,14 @@ renderer_t * renderer_init(int width, int height) {
     };
 
     for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
-        renderer->vertices[i] = vec_vertex_t_init();
         renderer->pixels[i] = vec_uint8_t_init();
 
         int x,y,n;
         uint8_t *data = stbi_load(texture_file[i], &x, &y, &n, 4);
-        sg_image_desc img_desc = mip_chain(x, data, &renderer->pixels[i]);
+        mip_chain_t chain = mip_chain(x, data, &renderer->pixels[i]);
+        sg_image_desc img_desc = image_desc(&chain);
         renderer->img[i] = sg_make_image(&img_desc);
+        renderer->bind[i].fs_images[0] = renderer->img[i];
         stbi_image_free(data);
     } 
 
@@ -156,202 +576,640 @@ renderer_t * renderer_init(int width, int height) {
         .vs.source =
             "#version 310 es\n"
             "uniform mat4 mvp;\n"
+            DEQUANTISE_GLSL
             "layout(location=0) in vec4 position;\n"
-            "layout(location=1) in vec3 normal;\n"
+            "layout(location=1) in vec2 normal;\n"
             "layout(location=2) in vec2 texcoord;\n"
             "out vec3 vnormal;\n" 
             "out vec2 uv;\n" 
             "void main() {\n"
-            "  vnormal = normal;\n"
-            "  uv = texcoord;\n"
-            "  gl_Position = mvp * position;\n"
+            "  vnormal = oct_decode(normal);\n"
+            "  uv = dequantise_texcoord(texcoord);\n"
+            "  gl_Position = mvp * vec4(dequantise_position(position), 1.0);\n"
             "}\n",
         .fs = {
+            .uniform_blocks[0] = FS_UNIFORM_BLOCK,
             .images[0] = { .name="tex", .image_type = SG_IMAGETYPE_2D },
-            .source =
-                "#version 310 es\n"
-                "precision mediump float;\n"
-                "uniform sampler2D tex;"
-                "in vec3 vnormal;\n"
-                "in vec2 uv;\n"
-                "out vec4 frag_color;\n"
-                "void main() {\n"
-                "  vec3 light_dir = vec3(0.5, -0.5, 0.0);\n"
-                "  vec3 light_colour = vec3(1.9, 1.9, 1.7);\n"
-                "  vec3 ambient_colour = vec3(1.9, 1.9, 1.9);\n"
-                "  float lambert = dot(light_dir, vnormal);\n"
-                "  vec4 colour = texture(tex, uv);\n"
-                "  frag_color = colour * vec4(lambert * light_colour + ambient_colour, 1.0);\n"
-                "}\n"
+            .source = fs_source
         }
     });
 
     /* create pipeline object */
-    renderer->pip = sg_make_pipeline(&(sg_pipeline_desc){
-        .layout = {
-            /* test to provide buffer stride, but no attr offsets */
-            .buffers[0].stride = renderer->floats_per_vertex * 4,
-            .attrs = {
-                [0].format=SG_VERTEXFORMAT_FLOAT3,
-                [1].format=SG_VERTEXFORMAT_FLOAT3,
-                [2].format=SG_VERTEXFORMAT_FLOAT2,
+    renderer->pip = make_pipeline(shd, (sg_layout_desc){
+        /* test to provide buffer stride, but no attr offsets */
+        .buffers[0].stride = sizeof(vertex_t),
+        .attrs = {
+            [0].format=SG_VERTEXFORMAT_SHORT4,
+            [1].format=SG_VERTEXFORMAT_SHORT2N,
+            [2].format=SG_VERTEXFORMAT_SHORT2N,
+        }
+    }, SG_INDEXTYPE_NONE);
+
+    sg_shader branch_shd = sg_make_shader(&(sg_shader_desc) {
+        .vs.uniform_blocks[0] = {
+            .size = sizeof(params_t),
+            .uniforms = {
+                [0] = { .name="mvp", .type=SG_UNIFORMTYPE_MAT4 }
             }
         },
-        .shader = shd,
-        .index_type = SG_INDEXTYPE_NONE,
-        .depth = {
-            .compare = SG_COMPAREFUNC_LESS_EQUAL,
-            .write_enabled = true,
+        .vs.images[0] = { .name="radii", .image_type = SG_IMAGETYPE_2D },
+        .vs.source =
+            "#version 310 es\n"
+            "uniform mat4 mvp;\n"
+            SEGMENT_RADIUS_GLSL
+            DEQUANTISE_GLSL
+            "layout(location=0) in vec4 centre;\n"
+            "layout(location=1) in vec2 direction;\n"
+            "layout(location=2) in float segment;\n"
+            "out vec3 vnormal;\n" 
+            "out vec2 uv;\n" 
+            "void main() {\n"
+            "  vec3 d = oct_decode(direction);\n"
+            "  float corner = mod(centre.w, 4.0);\n"
+            "  vnormal = d;\n"
+            "  uv = vec2(corner * 0.5, floor(centre.w / 4.0));\n"
+            "  gl_Position = mvp * vec4(dequantise_position(centre) + d * segment_radius(segment), 1.0);\n"
+            "}\n",
+        .fs = {
+            .uniform_blocks[0] = FS_UNIFORM_BLOCK,
+            .images[0] = { .name="tex", .image_type = SG_IMAGETYPE_2D },
+            .source = fs_source
+        }
+    });
+
+    sg_layout_desc ring_layout = {
+        .buffers[0].stride = sizeof(ring_vertex_t),
+        .attrs = {
+            [0].format=SG_VERTEXFORMAT_SHORT4,
+            [1].format=SG_VERTEXFORMAT_SHORT2N,
+            [2].format=SG_VERTEXFORMAT_FLOAT,
+        }
+    };
+    renderer->branch_pip[0] = make_pipeline(branch_shd, ring_layout, SG_INDEXTYPE_UINT32);
+    renderer->branch_pip[1] = make_pipeline(branch_shd, ring_layout, SG_INDEXTYPE_UINT16);
+
+    // copies are drawn as instances of their tree's rings, each with its
+    // transform as four columns and its tint
+    sg_shader copy_shd = sg_make_shader(&(sg_shader_desc) {
+        .vs.uniform_blocks[0] = {
+            .size = sizeof(params_t),
+            .uniforms = {
+                [0] = { .name="mvp", .type=SG_UNIFORMTYPE_MAT4 }
+            }
         },
-        .colors[0] = {
-            .blend = {
-                .src_factor_rgb =  SG_BLENDFACTOR_SRC_ALPHA,
-                .dst_factor_rgb = SG_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
-                .enabled = true
+        .vs.images[0] = { .name="radii", .image_type = SG_IMAGETYPE_2D },
+        .vs.source =
+            "#version 310 es\n"
+            "uniform mat4 mvp;\n"
+            SEGMENT_RADIUS_GLSL
+            DEQUANTISE_GLSL
+            "layout(location=0) in vec4 centre;\n"
+            "layout(location=1) in vec2 direction;\n"
+            "layout(location=2) in float segment;\n"
+            "layout(location=3) in vec4 transform0;\n"
+            "layout(location=4) in vec4 transform1;\n"
+            "layout(location=5) in vec4 transform2;\n"
+            "layout(location=6) in vec4 transform3;\n"
+            "layout(location=7) in vec4 copy_tint;\n"
+            "out vec3 vnormal;\n"
+            "out vec2 uv;\n"
+            "out vec4 tint;\n"
+            "void main() {\n"
+            "  mat4 transform = mat4(transform0, transform1, transform2, transform3);\n"
+            "  vec3 d = oct_decode(direction);\n"
+            "  float corner = mod(centre.w, 4.0);\n"
+            "  vnormal = d;\n"
+            "  uv = vec2(corner * 0.5, floor(centre.w / 4.0));\n"
+            "  tint = copy_tint;\n"
+            "  gl_Position = mvp * transform *\n"
+            "    vec4(dequantise_position(centre) + d * segment_radius(segment), 1.0);\n"
+            "}\n",
+        .fs = {
+            .images[0] = { .name="tex", .image_type = SG_IMAGETYPE_2D },
+            .source = copy_fs_source
+        }
+    });
+
+    // sokol only fills in offsets when none are given, so the ring
+    // attributes have theirs too
+    sg_layout_desc copy_layout = {
+        .buffers = {
+            [0].stride = sizeof(ring_vertex_t),
+            [1] = {
+                .stride = sizeof(copy_instance_t),
+                .step_func = SG_VERTEXSTEP_PER_INSTANCE
             }
         },
-        .face_winding = SG_FACEWINDING_CCW,
-        //.cull_mode = SG_CULLMODE_BACK,
+        .attrs = {
+            [0] = { .buffer_index = 0, .format = SG_VERTEXFORMAT_SHORT4,
+                .offset = offsetof(ring_vertex_t, centre) },
+            [1] = { .buffer_index = 0, .format = SG_VERTEXFORMAT_SHORT2N,
+                .offset = offsetof(ring_vertex_t, direction) },
+            [2] = { .buffer_index = 0, .format = SG_VERTEXFORMAT_FLOAT,
+                .offset = offsetof(ring_vertex_t, segment) },
+            [7] = { .buffer_index = 1, .format = SG_VERTEXFORMAT_FLOAT4,
+                .offset = offsetof(copy_instance_t, tint) },
+        }
+    };
+    for (int i = 0; i < 4; i++) {
+        copy_layout.attrs[3 + i] = (sg_vertex_attr_desc){
+            .buffer_index = 1,
+            .format = SG_VERTEXFORMAT_FLOAT4,
+            .offset = offsetof(copy_instance_t, transform) + i * sizeof(vec4s),
+        };
+    }
+    renderer->copy_pip[0] = make_pipeline(copy_shd, copy_layout, SG_INDEXTYPE_UINT32);
+    renderer->copy_pip[1] = make_pipeline(copy_shd, copy_layout, SG_INDEXTYPE_UINT16);
+
+    sg_shader instance_shd = sg_make_shader(&(sg_shader_desc) {
+        .vs.uniform_blocks[0] = {
+            .size = sizeof(params_t),
+            .uniforms = {
+                [0] = { .name="mvp", .type=SG_UNIFORMTYPE_MAT4 }
+            }
+        },
+        .vs.images[0] = { .name="radii", .image_type = SG_IMAGETYPE_2D },
+        .vs.source =
+            "#version 310 es\n"
+            "uniform mat4 mvp;\n"
+            SEGMENT_RADIUS_GLSL
+            DEQUANTISE_GLSL
+            "layout(location=0) in vec4 corner;\n"
+            "layout(location=1) in vec4 centre0;\n"
+            "layout(location=2) in vec2 x0;\n"
+            "layout(location=3) in vec2 z0;\n"
+            "layout(location=4) in vec4 centre1;\n"
+            "layout(location=5) in vec2 x1;\n"
+            "layout(location=6) in vec2 z1;\n"
+            "layout(location=7) in vec2 segment;\n"
+            "out vec3 vnormal;\n" 
+            "out vec2 uv;\n" 
+            "void main() {\n"
+            "  bool far = corner.z > 0.5;\n"
+            "  vec3 centre = dequantise_position(far ? centre1 : centre0);\n"
+            "  vec3 direction = corner.x * oct_decode(far ? x1 : x0) +\n"
+            "    corner.y * oct_decode(far ? z1 : z0);\n"
+            "  vnormal = direction;\n"
+            "  uv = corner.wz;\n"
+            "  float radius = segment_radius(far ? segment.y : segment.x);\n"
+            "  gl_Position = mvp * vec4(centre + direction * radius, 1.0);\n"
+            "}\n",
+        .fs = {
+            .uniform_blocks[0] = FS_UNIFORM_BLOCK,
+            .images[0] = { .name="tex", .image_type = SG_IMAGETYPE_2D },
+            .source = fs_source
+        }
     });
 
+    renderer->instance_pip = make_pipeline(instance_shd, (sg_layout_desc){
+        .buffers = {
+            [0].stride = sizeof(unit_cylinder[0]),
+            [1] = {
+                .stride = sizeof(segment_instance_t),
+                .step_func = SG_VERTEXSTEP_PER_INSTANCE
+            }
+        },
+        .attrs = {
+            [0] = { .buffer_index = 0, .format = SG_VERTEXFORMAT_FLOAT4 },
+            [1] = { .buffer_index = 1, .format = SG_VERTEXFORMAT_SHORT4,
+                .offset = offsetof(segment_instance_t, centre0) },
+            [2] = { .buffer_index = 1, .format = SG_VERTEXFORMAT_SHORT2N,
+                .offset = offsetof(segment_instance_t, x0) },
+            [3] = { .buffer_index = 1, .format = SG_VERTEXFORMAT_SHORT2N,
+                .offset = offsetof(segment_instance_t, z0) },
+            [4] = { .buffer_index = 1, .format = SG_VERTEXFORMAT_SHORT4,
+                .offset = offsetof(segment_instance_t, centre1) },
+            [5] = { .buffer_index = 1, .format = SG_VERTEXFORMAT_SHORT2N,
+                .offset = offsetof(segment_instance_t, x1) },
+            [6] = { .buffer_index = 1, .format = SG_VERTEXFORMAT_SHORT2N,
+                .offset = offsetof(segment_instance_t, z1) },
+            [7] = { .buffer_index = 1, .format = SG_VERTEXFORMAT_FLOAT2,
+                .offset = offsetof(segment_instance_t, segment) },
+        }
+    }, SG_INDEXTYPE_NONE);
+    renderer->instance_bind.vertex_buffers[0] = sg_make_buffer(&(sg_buffer_desc){
+        .data = SG_RANGE(unit_cylinder)
+    });
+    renderer->instance_bind.fs_images[0] = renderer->img[TREE];
+
+    sg_shader leaf_shd = sg_make_shader(&(sg_shader_desc) {
+        .vs.uniform_blocks[0] = {
+            .size = sizeof(params_t),
+            .uniforms = {
+                [0] = { .name="mvp", .type=SG_UNIFORMTYPE_MAT4 }
+            }
+        },
+        .vs.source =
+            "#version 310 es\n"
+            "uniform mat4 mvp;\n"
+            DEQUANTISE_GLSL
+            "layout(location=0) in vec4 corner;\n"
+            "layout(location=1) in vec4 position;\n"
+            "layout(location=2) in vec2 x;\n"
+            "layout(location=3) in vec2 z;\n"
+            "layout(location=4) in float radius;\n"
+            "layout(location=5) in float scale;\n"
+            "out vec3 vnormal;\n" 
+            "out vec2 uv;\n" 
+            "void main() {\n"
+            "  vec3 xaxis = oct_decode(x);\n"
+            "  vec3 zaxis = oct_decode(z);\n"
+            "  vec2 p = corner.xy * (radius + 0.15 * scale) + corner.zw * 0.1 * scale;\n"
+            "  vnormal = cross(zaxis, xaxis);\n"
+            "  uv = corner.zw;\n"
+            "  gl_Position = mvp * vec4(dequantise_position(position) + p.x * xaxis + p.y * zaxis, 1.0);\n"
+            "}\n",
+        .fs = {
+            .uniform_blocks[0] = FS_UNIFORM_BLOCK,
+            .images[0] = { .name="tex", .image_type = SG_IMAGETYPE_2D },
+            .source = fs_source
+        }
+    });
+
+    renderer->leaf_pip = make_pipeline(leaf_shd, (sg_layout_desc){
+        .buffers = {
+            [0].stride = sizeof(leaf_cluster[0]),
+            [1] = {
+                .stride = sizeof(leaf_instance_t),
+                .step_func = SG_VERTEXSTEP_PER_INSTANCE
+            }
+        },
+        .attrs = {
+            [0] = { .buffer_index = 0, .format = SG_VERTEXFORMAT_FLOAT4 },
+            [1] = { .buffer_index = 1, .format = SG_VERTEXFORMAT_SHORT4,
+                .offset = offsetof(leaf_instance_t, position) },
+            [2] = { .buffer_index = 1, .format = SG_VERTEXFORMAT_SHORT2N,
+                .offset = offsetof(leaf_instance_t, x) },
+            [3] = { .buffer_index = 1, .format = SG_VERTEXFORMAT_SHORT2N,
+                .offset = offsetof(leaf_instance_t, z) },
+            [4] = { .buffer_index = 1, .format = SG_VERTEXFORMAT_FLOAT,
+                .offset = offsetof(leaf_instance_t, radius) },
+            [5] = { .buffer_index = 1, .format = SG_VERTEXFORMAT_FLOAT,
+                .offset = offsetof(leaf_instance_t, scale) },
+        }
+    }, SG_INDEXTYPE_NONE);
+    renderer->leaf_bind.vertex_buffers[0] = sg_make_buffer(&(sg_buffer_desc){
+        .data = SG_RANGE(leaf_cluster)
+    });
+    renderer->leaf_bind.fs_images[0] = renderer->img[LEAF];
+
     /* default pass action */
     renderer->pass_action = (sg_pass_action){ 0 };
 
     /* view-projection matrix */
-    mat4s proj = glms_perspective(glm_rad(60.0f), (float)width/(float)height, 0.5f, 20.0f);
+    mat4s proj = projection((float)width/(float)height);
     mat4s view = glms_lookat((vec3s){0.0f, 2.5f, 6.0f}, (vec3s){0.0f, 1.0f, 0.0f}, (vec3s){0.0f, 1.0f, 0.0f});
+    renderer->view = view;
     renderer->view_proj = glms_mat4_mul(proj, view);
+    renderer->focal = proj.col[1].y;
 
     return renderer;
 }
 
 
-static void add_cylinder(vec_vertex_t * vertices, mat4s m0, float r0, mat4s m1, float r1) {
-    const int N = 18;
-    // a 2D triangle
-    const float pi = 3.1416f;
-    float a = cos(pi / 3.0f);
-    float b = sin(pi / 3.0f);
-    vec3s va = (vec3s){0.0f, 0.0f, -1.0f};
-    vec3s vb = (vec3s){  -b, 0.0f,     a};
-    vec3s vc = (vec3s){   b, 0.0f,     a};
- 
-    // a three sided cylinder
-    vertex_t v0 =  (vertex_t) {transform(m0, glms_vec3_scale(va, r0)), transform_normal(m0, va), (vec2s){0.0f, 0.0f}};
-    vertex_t v1 =  (vertex_t) {transform(m0, glms_vec3_scale(vb, r0)), transform_normal(m0, vb), (vec2s){0.5f, 0.0f}};
-    vertex_t v2 =  (vertex_t) {transform(m0, glms_vec3_scale(vc, r0)), transform_normal(m0, vc), (vec2s){1.0f, 0.0f}};
-    vertex_t v01 = (vertex_t) {transform(m1, glms_vec3_scale(va, r1)), transform_normal(m1, va), (vec2s){0.0f, 1.0f}}; 
-    vertex_t v11 = (vertex_t) {transform(m1, glms_vec3_scale(vb, r1)), transform_normal(m1, vb), (vec2s){0.5f, 1.0f}};
-    vertex_t v21 = (vertex_t) {transform(m1, glms_vec3_scale(vc, r1)), transform_normal(m1, vc), (vec2s){1.0f, 1.0f}};
-
-    vertex_t triangles[] = {
-        v0, v1, v01,
-        v1, v11, v01,
-        v1, v2, v11,
-        v2, v21, v11,
-        v2, v0, v21,
-        v0, v01, v21
-    };
-    assert(sizeof(triangles) / sizeof(vertex_t) == N);
+// writes count indices to buffer, starting at index at, narrowed to 16 bits
+// while every ring vertex can be addressed so. With update they overwrite
+// some of what the buffer holds, otherwise anything after them is dropped
+static void write_indices(renderer_t * renderer, gpu_buffer_t * buffer, size_t at,
+        const uint32_t * src, size_t count, bool update) {
+    size_t index_size = renderer->short_indices ? sizeof(uint16_t) : sizeof(uint32_t);
+    const void * data = src;
+    if (renderer->short_indices) {
+        vec_uint16_t_resize(&renderer->indices_staging, count, 0);
+        uint16_t * dst = vec_uint16_t_data(&renderer->indices_staging);
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = src[i];
+        }
+        data = dst;
+    }
+    if (update) {
+        gpu_buffer_update(buffer, at * index_size, data, count * index_size);
+    } else {
+        gpu_buffer_write(buffer, at * index_size, data, count * index_size);
+    }
+}
 
-    for (int i = 0; i < N; i++) {
-        vec_vertex_t_push_back(vertices, triangles[i]);
+// an empty vector may have no storage, and memcpy must not be passed NULL
+// even for no bytes
+static void copy_sizes(vec_size_t * dst, vec_size_t * src) {
+    vec_size_t_resize(dst, vec_size_t_size(src), 0);
+    if (vec_size_t_size(src) > 0) {
+        memcpy(vec_size_t_data(dst), vec_size_t_data(src),
+            vec_size_t_size(src) * sizeof(size_t));
     }
 }
 
-static void add_leaves(vec_vertex_t * vertices, mat4s mat, float radius) {
-    // a 2D triangle
-    const float pi = 3.1416f;
-    float a = cos(pi / 3.0f);
-    float b = sin(pi / 3.0f);
-    vec3s c[3] = {
-        (vec3s){0.0f, 0.0f, -1.0f},
-        (vec3s){  -b, 0.0f,     a},
-        (vec3s){   b, 0.0f,     a}
-    };
-    vec3s normal = transform_normal(mat, (vec3s){0.0f, 1.0f, 0.0f});
-    const float s = 0.1f;
-
-    // at three points around the branch we add a leaf composed of a single triangle
-    for(int i = 0; i < 3; i++) { 
-        vec3s p = glms_vec3_scale(c[i], radius + s * 1.5);
-        for (int j = 0; j < 3; j++) {
-            vec3s t = glms_vec3_add(p, glms_vec3_scale(c[j], s));
-            vertex_t v = (vertex_t) {transform(mat, t), normal, (vec2s){c[j].x, c[j].z}};
-            vec_vertex_t_push_back(vertices, v);
-        }
-    }
-}
-
-static void add_horiz_triangle(vec_vertex_t * vertices, vec3s origin, float radius,
-        atlas_t tex) {
-    // a 2D triangle
-    const float pi = 3.1416f;
-    float a = cos(pi / 3.0f);
-    float b = sin(pi / 3.0f);
-    vec3s c[3] = {
-        (vec3s){0.0f, 0.0f, -1.0f},
-        (vec3s){  -b, 0.0f,     a},
-        (vec3s){   b, 0.0f,     a}
-    };
-    vec3s normal = (vec3s){0.0f, 1.0f, 0.0f};
-    for(int i = 0; i < 3; i++) { 
-        vec3s t = glms_vec3_add(origin, glms_vec3_scale(c[i], radius));
-        vec2s uv = glms_vec2_add(tex.offset,
-                    glms_vec2_add((vec2s){0.5f, 0.5f}, 
-                        glms_vec2_scale((vec2s){c[i].x, c[i].z}, tex.scale * 0.5f)));
-        vertex_t v = (vertex_t) {t, normal, uv};
-        vec_vertex_t_push_back(vertices, v);
+// the chunks match the mesh's, and the trees are sorted into them with a
+// counting sort
+static void index_chunks(renderer_t * renderer, mesh_t * mesh) {
+    if (mesh->num_chunks > renderer->num_chunks) {
+        renderer->chunks = realloc(renderer->chunks, mesh->num_chunks * sizeof(gpu_chunk_t));
+        for (size_t c = renderer->num_chunks; c < mesh->num_chunks; c++) {
+            renderer->chunks[c] = gpu_chunk_init();
+        }
+        renderer->num_chunks = mesh->num_chunks;
+    }
+    size_t num_tree_chunks = vec_size_t_size(&mesh->tree_chunk);
+    for (size_t c = 0; c < renderer->num_chunks; c++) {
+        renderer->chunks[c].num_trees = 0;
+    }
+    for (size_t t = 0; t < mesh->num_trees; t++) {
+        size_t c = t < num_tree_chunks ? *vec_size_t_at(&mesh->tree_chunk, t) : 0;
+        renderer->chunks[c].num_trees++;
+    }
+    size_t first = 0;
+    for (size_t c = 0; c < renderer->num_chunks; c++) {
+        renderer->chunks[c].first_tree = first;
+        first += renderer->chunks[c].num_trees;
+        renderer->chunks[c].num_trees = 0;
+    }
+    vec_size_t_resize(&renderer->chunk_trees, mesh->num_trees, 0);
+    vec_size_t_resize(&renderer->tree_chunk, mesh->num_trees, 0);
+    size_t * chunk_trees = vec_size_t_data(&renderer->chunk_trees);
+    size_t * tree_chunk = vec_size_t_data(&renderer->tree_chunk);
+    for (size_t t = 0; t < mesh->num_trees; t++) {
+        tree_chunk[t] = t < num_tree_chunks ? *vec_size_t_at(&mesh->tree_chunk, t) : 0;
+        gpu_chunk_t * g = &renderer->chunks[tree_chunk[t]];
+        chunk_trees[g->first_tree + g->num_trees++] = t;
     }
 }
 
-void renderer_clear_vertices(renderer_t * renderer) {
-    for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
-        vec_vertex_t_clear(&renderer->vertices[i]);
+// room left after a tree's full detail branches when its chunk is laid out,
+// so that it can grow for a while before the chunk is laid out again.
+// Counted in indices, or instances
+#define TREE_SLACK 192
+
+// the size of a tree's slot, in whole triangles
+static size_t slot_capacity(size_t count) {
+    size_t capacity = count + count / 2 + TREE_SLACK;
+    return capacity + (3 - capacity % 3) % 3;
+}
+
+// sends branches from .. to of one tree, by their index in tree_branches,
+// into its slot. With update they follow those already there, otherwise
+// they start the chunk's buffer again at the tree's slot
+static void write_branches(renderer_t * renderer, mesh_t * mesh, size_t c, size_t t,
+        size_t from, size_t to) {
+    gpu_chunk_t * g = &renderer->chunks[c];
+    mesh_chunk_t * chunk = &mesh->chunks[c];
+    size_t at = *vec_size_t_at(&renderer->tree_first, t) + from;
+    if (mesh->instanced) {
+        const uint32_t * ids = vec_uint32_t_data(&mesh->tree_instances[t]);
+        vec_segment_instance_t_clear(&renderer->chunk_instances);
+        for (size_t i = from; i < to; i++) {
+            vec_segment_instance_t_push_back(&renderer->chunk_instances,
+                *vec_segment_instance_t_at(&chunk->instances, ids[i]));
+        }
+        gpu_buffer_update(&g->instances, at * sizeof(segment_instance_t),
+            vec_segment_instance_t_data(&renderer->chunk_instances),
+            (to - from) * sizeof(segment_instance_t));
+    } else {
+        write_indices(renderer, &g->indices, at,
+            vec_uint32_t_data(&mesh->tree_indices[t]) + from, to - from, true);
     }
 }
 
-void renderer_add_cylinder(renderer_t * renderer, mat4s m0, float r0, mat4s m1, float r1) {
-    add_cylinder(&renderer->vertices[TREE], m0, r0, m1, r1);
+// the full detail branches of a chunk's trees, indices or instances, are in
+// one buffer with a slot for each tree, laid out in chunk_trees order, so the
+// branches of trees drawn side by side can be drawn together, and a copy can
+// draw its tree's alone. Trees only ever gain branches, and each step only
+// the new ones are sent, after the tree's others in its slot. The chunk is
+// laid out and sent again whole only when a tree outgrows its slot, giving
+// every tree room to grow. The room left in a slot is degenerate: zero
+// indices, or zeroed instances whose corners all fall on one line. So a run
+// of trees is drawn over the slack between them
+static void upload_tree_branches(renderer_t * renderer, mesh_t * mesh, size_t c,
+        bool rewrite) {
+    gpu_chunk_t * g = &renderer->chunks[c];
+    mesh_chunk_t * chunk = &mesh->chunks[c];
+    vec_uint32_t * tree_branches = mesh->instanced ? mesh->tree_instances : mesh->tree_indices;
+    const size_t * chunk_trees = vec_size_t_data(&renderer->chunk_trees);
+    size_t * first = vec_size_t_data(&renderer->tree_first);
+    size_t * count = vec_size_t_data(&renderer->tree_count);
+    size_t * capacity = vec_size_t_data(&renderer->tree_capacity);
+    bool relayout = rewrite;
+    for (size_t k = g->first_tree; k < g->first_tree + g->num_trees && !relayout; k++) {
+        size_t t = chunk_trees[k];
+        size_t n = vec_uint32_t_size(&tree_branches[t]);
+        relayout = n > capacity[t] || n < count[t];
+    }
+    if (!relayout) {
+        for (size_t k = g->first_tree; k < g->first_tree + g->num_trees; k++) {
+            size_t t = chunk_trees[k];
+            size_t n = vec_uint32_t_size(&tree_branches[t]);
+            if (n > count[t]) {
+                write_branches(renderer, mesh, c, t, count[t], n);
+                count[t] = n;
+            }
+        }
+        return;
+    }
+    vec_uint32_t_clear(&renderer->chunk_indices);
+    vec_segment_instance_t_clear(&renderer->chunk_instances);
+    size_t size = 0;
+    for (size_t k = g->first_tree; k < g->first_tree + g->num_trees; k++) {
+        size_t t = chunk_trees[k];
+        first[t] = size;
+        count[t] = vec_uint32_t_size(&tree_branches[t]);
+        capacity[t] = slot_capacity(count[t]);
+        size += capacity[t];
+        foreach(vec_uint32_t, &tree_branches[t], it) {
+            if (mesh->instanced) {
+                vec_segment_instance_t_push_back(&renderer->chunk_instances,
+                    *vec_segment_instance_t_at(&chunk->instances, *it.ref));
+            } else {
+                vec_uint32_t_push_back(&renderer->chunk_indices, *it.ref);
+            }
+        }
+        if (mesh->instanced) {
+            vec_segment_instance_t_resize(&renderer->chunk_instances, size,
+                (segment_instance_t){0});
+        } else {
+            vec_uint32_t_resize(&renderer->chunk_indices, size, 0);
+        }
+    }
+    if (mesh->instanced) {
+        gpu_buffer_write(&g->instances, 0, vec_segment_instance_t_data(&renderer->chunk_instances),
+            size * sizeof(segment_instance_t));
+        g->num_instances = size;
+    } else {
+        write_indices(renderer, &g->indices, 0, vec_uint32_t_data(&renderer->chunk_indices),
+            size, false);
+    }
 }
 
-void renderer_add_leaves(renderer_t * renderer, mat4s mat, float radius) {
-    add_leaves(&renderer->vertices[LEAF], mat, radius);
-} 
+// rings only ever have segments appended, so unless a chunk's branches were
+// cleared only what was added since the last upload is sent. Instances go
+// into the slots of their trees with the indices. The coarse levels are sent
+// whole when rebuilt
+static void upload_branches(renderer_t * renderer, mesh_t * mesh) {
+    bool short_indices = true;
+    bool cleared = false;
+    for (size_t c = 0; c < mesh->num_chunks; c++) {
+        short_indices = short_indices &&
+            vec_ring_vertex_t_size(&mesh->chunks[c].rings) <= UINT16_MAX + 1;
+        cleared = cleared || mesh->chunks[c].dirty[TREE];
+    }
+    bool rewrite = cleared || short_indices != renderer->short_indices ||
+        mesh->instanced != renderer->instanced;
+    renderer->short_indices = short_indices;
+    renderer->instanced = mesh->instanced;
 
-void renderer_add_contact_shadow(renderer_t * renderer, vec3s origin, float radius) {
-    add_horiz_triangle(&renderer->vertices[SHADOW], origin, radius,
-        (atlas_t){.scale = 1.0f});
-} 
+    for (size_t c = 0; c < mesh->num_chunks; c++) {
+        mesh_chunk_t * chunk = &mesh->chunks[c];
+        gpu_chunk_t * g = &renderer->chunks[c];
+        if (chunk->dirty[TREE]) {
+            g->vertices[TREE].size = 0;
+            chunk->dirty[TREE] = false;
+        }
+        gpu_buffer_append(&g->vertices[TREE], vec_ring_vertex_t_data(&chunk->rings),
+            vec_ring_vertex_t_size(&chunk->rings) * sizeof(ring_vertex_t));
+        g->num_vertices[TREE] = vec_ring_vertex_t_size(&chunk->rings);
+    }
 
-void renderer_add_ground_plane(renderer_t * renderer, float radius) {
-    add_horiz_triangle(&renderer->vertices[GROUND], (vec3s){0.0f, -0.1f, 0.0f},
-        radius, (atlas_t){.scale = radius * 0.25f });
+    // a new tree has no slot, so its chunk is laid out once it has branches
+    if (mesh->num_trees > renderer->num_trees) {
+        vec_size_t_resize(&renderer->tree_first, mesh->num_trees, 0);
+        vec_size_t_resize(&renderer->tree_count, mesh->num_trees, 0);
+        vec_size_t_resize(&renderer->tree_capacity, mesh->num_trees, 0);
+        renderer->num_trees = mesh->num_trees;
+    }
+    for (size_t c = 0; c < mesh->num_chunks; c++) {
+        upload_tree_branches(renderer, mesh, c, rewrite);
+    }
+
+    if (mesh->lods_dirty || rewrite) {
+        for (int lod = 1; lod < NUM_LODS; lod++) {
+            lod_t * l = &mesh->lods[lod];
+            write_indices(renderer, &renderer->lod_indices[lod], 0,
+                vec_uint32_t_data(&l->indices), vec_uint32_t_size(&l->indices), false);
+            copy_sizes(&renderer->index_start[lod], &l->index_start);
+            gpu_buffer_write(&renderer->lod_leaves[lod], 0, vec_leaf_instance_t_data(&l->leaves),
+                vec_leaf_instance_t_size(&l->leaves) * sizeof(leaf_instance_t));
+            copy_sizes(&renderer->leaf_start[lod], &l->leaf_start);
+        }
+        mesh->lods_dirty = false;
+    }
+
+    // the bounds grow every step
+    vec_box_t_resize(&renderer->bounds, vec_box_t_size(&mesh->bounds), (box_t){0});
+    if (vec_box_t_size(&mesh->bounds) > 0) {
+        memcpy(vec_box_t_data(&renderer->bounds), vec_box_t_data(&mesh->bounds),
+            vec_box_t_size(&mesh->bounds) * sizeof(box_t));
+    }
 }
 
-static void upload_vertices(int floats_per_vertex, int frame, vec_vertex_t *vertices, 
-        sg_bindings *bind, sg_image *image) {
-    size_t size = 
-        vec_vertex_t_size(vertices) * floats_per_vertex * sizeof(float);
+// the radii of a chunk go up as a float texture, RADII_WIDTH segments to a
+// row. The texture grows by doubling its rows, when it is sent whole, and is
+// otherwise only sent the rows holding radii that changed
+static void upload_radii(renderer_t * renderer, gpu_chunk_t * chunk, mesh_chunk_t * mesh_chunk) {
+    size_t num_segments = vec_float_size(&mesh_chunk->radii);
+    size_t lo = mesh_chunk->radii_lo;
+    size_t hi = mesh_chunk->radii_hi < num_segments ? mesh_chunk->radii_hi : num_segments;
+    mesh_chunk->radii_lo = mesh_chunk->radii_hi = 0;
+    int rows = (num_segments + RADII_WIDTH - 1) / RADII_WIDTH;
+    rows = rows > 0 ? rows : 1;
+    if (rows > chunk->radii_rows) {
+        int capacity = chunk->radii_rows ? chunk->radii_rows : 1;
+        while (capacity < rows) {
+            capacity *= 2;
+        }
+        sg_destroy_image(chunk->radii);
+        glDeleteTextures(1, &chunk->radii_gl);
+        glGenTextures(1, &chunk->radii_gl);
+        glBindTexture(GL_TEXTURE_2D, chunk->radii_gl);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, RADII_WIDTH, capacity);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        chunk->radii = sg_make_image(&(sg_image_desc){
+            .width = RADII_WIDTH,
+            .height = capacity,
+            .pixel_format = SG_PIXELFORMAT_R32F,
+            .min_filter = SG_FILTER_NEAREST,
+            .mag_filter = SG_FILTER_NEAREST,
+            .gl_textures[0] = chunk->radii_gl,
+        });
+        chunk->radii_rows = capacity;
+        lo = 0;
+        hi = num_segments;
+    }
+    if (lo < hi) {
+        // whole rows, the last padded out with zeros
+        size_t first_row = lo / RADII_WIDTH;
+        size_t end_row = (hi + RADII_WIDTH - 1) / RADII_WIDTH;
+        size_t first = first_row * RADII_WIDTH;
+        size_t n = (end_row - first_row) * RADII_WIDTH;
+        vec_float_resize(&renderer->radii_staging, n, 0.0f);
+        float * staging = vec_float_data(&renderer->radii_staging);
+        size_t filled = num_segments - first < n ? num_segments - first : n;
+        memcpy(staging, vec_float_data(&mesh_chunk->radii) + first, filled * sizeof(float));
+        memset(staging + filled, 0, (n - filled) * sizeof(float));
+        glBindTexture(GL_TEXTURE_2D, chunk->radii_gl);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first_row, RADII_WIDTH, end_row - first_row,
+            GL_RED, GL_FLOAT, staging);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    // sokol caches which GL textures are bound
+    sg_reset_state_cache();
+}
 
-    if (frame > 0) {
-        sg_destroy_buffer(bind->vertex_buffers[0]);
+// copies are only added with a chunk's ground, but their boxes follow the
+// trees they copy and take the chunk's box with them
+static void upload_copies(renderer_t * renderer, mesh_t * mesh) {
+    size_t num_bounds = vec_box_t_size(&renderer->bounds);
+    for (size_t c = 0; c < mesh->num_chunks; c++) {
+        vec_mesh_copy_t * copies = &mesh->chunks[c].copies;
+        gpu_chunk_t * g = &renderer->chunks[c];
+        size_t n = vec_mesh_copy_t_size(copies);
+        if (n != vec_mesh_copy_t_size(&g->copies)) {
+            vec_mesh_copy_t_resize(&g->copies, n, (mesh_copy_t){0});
+            if (n > 0) {
+                memcpy(vec_mesh_copy_t_data(&g->copies), vec_mesh_copy_t_data(copies),
+                    n * sizeof(mesh_copy_t));
+            }
+        }
+        vec_box_t_resize(&g->copy_bounds, n, (box_t){0});
+        box_t * bounds = vec_box_t_data(&g->copy_bounds);
+        for (size_t k = 0; k < n; k++) {
+            mesh_copy_t * copy = vec_mesh_copy_t_at(&g->copies, k);
+            box_t b = copy->tree < num_bounds ? *vec_box_t_at(&renderer->bounds, copy->tree) :
+                box_point((vec3s){0});
+            bounds[k] = box_transform(copy->transform, b);
+            g->bounds = box_extend(box_extend(g->bounds, bounds[k].lo), bounds[k].hi);
+        }
     }
-    sg_buffer vbuf = sg_make_buffer(&(sg_buffer_desc){
-        .data = (sg_range){vec_vertex_t_data(vertices), size}
-    });
-    *bind = (sg_bindings) {
-        .vertex_buffers[0] = vbuf,
-        .fs_images[0] = *image
-    };
 }
 
-void renderer_upload_vertices(renderer_t * renderer) {
-    for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
-        upload_vertices(renderer->floats_per_vertex, 
-            renderer->frame, &renderer->vertices[i], 
-            &renderer->bind[i], &renderer->img[i]);
+void renderer_upload_vertices(renderer_t * renderer, mesh_t * mesh) {
+    uint64_t start = timing_now();
+    index_chunks(renderer, mesh);
+    for (size_t c = 0; c < mesh->num_chunks; c++) {
+        mesh_chunk_t * chunk = &mesh->chunks[c];
+        gpu_chunk_t * g = &renderer->chunks[c];
+        g->origin = chunk->origin;
+        g->bounds = chunk->bounds;
+        for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+            vec_vertex_t * vertices = &chunk->vertices[i];
+            if (i == TREE || !chunk->dirty[i]) {
+                continue;
+            }
+            gpu_buffer_write(&g->vertices[i], 0, vec_vertex_t_data(vertices),
+                vec_vertex_t_size(vertices) * sizeof(vertex_t));
+            g->num_vertices[i] = vec_vertex_t_size(vertices);
+            chunk->dirty[i] = false;
+        }
+        upload_radii(renderer, g, chunk);
+    }
+    if (mesh->leaves_dirty) {
+        lod_t * l = &mesh->lods[0];
+        gpu_buffer_write(&renderer->lod_leaves[0], 0, vec_leaf_instance_t_data(&l->leaves),
+            vec_leaf_instance_t_size(&l->leaves) * sizeof(leaf_instance_t));
+        copy_sizes(&renderer->leaf_start[0], &l->leaf_start);
+        mesh->leaves_dirty = false;
     }
+    upload_branches(renderer, mesh);
+    upload_copies(renderer, mesh);
+    timing_record(TIMING_UPLOAD, start);
 }
 
 void renderer_update(renderer_t * renderer) {
@@ -360,25 +1218,357 @@ void renderer_update(renderer_t * renderer) {
     renderer->ry += 0.2f;
 }
 
+// the level a box is drawn at, from how much of the viewport it spans, or
+// CULLED if it is outside the frustum
+static uint8_t box_level(renderer_t * renderer, vec4s * planes, mat4s model_view, box_t * b) {
+    vec3s box[2] = {b->lo, b->hi};
+    if (!glms_aabb_frustum(box, planes)) {
+        return CULLED;
+    }
+    vec3s centre = transform(model_view, glms_vec3_scale(glms_vec3_add(b->lo, b->hi), 0.5f));
+    float radius = glms_vec3_distance(b->lo, b->hi) * 0.5f;
+    float distance = fmaxf(-centre.z, 0.1f);
+    return lod_for_screen_size(radius * renderer->focal / distance);
+}
+
+// culls the chunks, then the trees and copies of the chunks left, whose box
+// is outside the frustum and picks the level of the rest. The frustum planes
+// are taken from mvp, so the boxes are tested where they are, in model space.
+// Trees without bounds yet are drawn at full detail
+static void select_levels(renderer_t * renderer, mat4s model, mat4s mvp) {
+    mat4s model_view = glms_mat4_mul(renderer->view, model);
+    vec4s planes[6];
+    glms_frustum_planes(mvp, planes);
+    vec_uint8_t_resize(&renderer->levels, renderer->num_trees, 0);
+    uint8_t * levels = vec_uint8_t_data(&renderer->levels);
+    const size_t * chunk_trees = vec_size_t_data(&renderer->chunk_trees);
+    size_t num_bounds = vec_box_t_size(&renderer->bounds);
+    for (size_t c = 0; c < renderer->num_chunks; c++) {
+        gpu_chunk_t * chunk = &renderer->chunks[c];
+        vec3s chunk_box[2] = {chunk->bounds.lo, chunk->bounds.hi};
+        chunk->visible = glms_aabb_frustum(chunk_box, planes);
+        for (size_t k = chunk->first_tree; k < chunk->first_tree + chunk->num_trees; k++) {
+            size_t t = chunk_trees[k];
+            levels[t] = !chunk->visible ? CULLED : t >= num_bounds ? 0 :
+                box_level(renderer, planes, model_view, vec_box_t_at(&renderer->bounds, t));
+        }
+        size_t num_copies = vec_mesh_copy_t_size(&chunk->copies);
+        vec_uint8_t_resize(&chunk->copy_levels, num_copies, 0);
+        uint8_t * copy_levels = vec_uint8_t_data(&chunk->copy_levels);
+        for (size_t k = 0; k < num_copies; k++) {
+            copy_levels[k] = !chunk->visible ? CULLED :
+                box_level(renderer, planes, model_view, vec_box_t_at(&chunk->copy_bounds, k));
+        }
+    }
+}
+
+// the range of tree t in a buffer laid out by start, empty if the tree is
+// newer than the last rebuild of that level
+static size_t range_in(vec_size_t * start, size_t t, size_t * first) {
+    if (t + 1 >= vec_size_t_size(start)) {
+        return 0;
+    }
+    *first = *vec_size_t_at(start, t);
+    return *vec_size_t_at(start, t + 1) - *first;
+}
+
+// the range of tree t at level in the buffer its branches or leaves are drawn
+// from, counted in indices or instances. Instanced branches have no coarse
+// levels
+static size_t tree_range(renderer_t * renderer, int type, uint8_t level, size_t t,
+        size_t * first) {
+    if (type == LEAF) {
+        return range_in(&renderer->leaf_start[level], t, first);
+    }
+    if (level > 0 && !renderer->instanced) {
+        return range_in(&renderer->index_start[level], t, first);
+    }
+    if (t >= vec_size_t_size(&renderer->tree_count)) {
+        return 0;
+    }
+    *first = *vec_size_t_at(&renderer->tree_first, t);
+    return *vec_size_t_at(&renderer->tree_count, t);
+}
+
+// where the room for a range from tree_range ends. Full detail branches have
+// slack after them, the rest are packed
+static size_t slot_end(renderer_t * renderer, int type, uint8_t level, size_t t, size_t first,
+        size_t count) {
+    if (type == LEAF || (level > 0 && !renderer->instanced)) {
+        return first + count;
+    }
+    return first + *vec_size_t_at(&renderer->tree_capacity, t);
+}
+
+// the rings of a chunk's trees at level, and the radii they are inflated by
+static sg_bindings ring_bindings(renderer_t * renderer, gpu_chunk_t * chunk, uint8_t level) {
+    sg_bindings bind = renderer->bind[TREE];
+    bind.vertex_buffers[0] = chunk->vertices[TREE].buffer;
+    bind.vs_images[0] = chunk->radii;
+    bind.index_buffer = level == 0 ? chunk->indices.buffer : renderer->lod_indices[level].buffer;
+    return bind;
+}
+
+// draws a range of the branches or leaves of a chunk's trees at level, from
+// the rings of the chunk. Ring bindings are applied once, by the first range
+// drawn after bound is cleared. Leaves and instanced branches are a range of
+// instances, selected by offsetting the instance buffer rather than by a base
+// instance GLES doesn't have, so they are bound for every range
+static void draw_range(renderer_t * renderer, gpu_chunk_t * chunk, int type, uint8_t level,
+        size_t first, size_t count, bool * bound) {
+    if (count == 0) {
+        return;
+    }
+    if (type == LEAF) {
+        sg_bindings bind = renderer->leaf_bind;
+        bind.vertex_buffers[1] = renderer->lod_leaves[level].buffer;
+        bind.vertex_buffer_offsets[1] = first * sizeof(leaf_instance_t);
+        sg_apply_bindings(&bind);
+        sg_draw(0, LEAF_CLUSTER_VERTICES, count);
+        return;
+    }
+    if (renderer->instanced) {
+        sg_bindings bind = renderer->instance_bind;
+        bind.vertex_buffers[1] = chunk->instances.buffer;
+        bind.vertex_buffer_offsets[1] = first * sizeof(segment_instance_t);
+        bind.vs_images[0] = chunk->radii;
+        sg_apply_bindings(&bind);
+        sg_draw(0, UNIT_CYLINDER_VERTICES, count);
+        return;
+    }
+    if (!*bound) {
+        sg_bindings bind = ring_bindings(renderer, chunk, level);
+        sg_apply_bindings(&bind);
+        *bound = true;
+    }
+    sg_draw(first, count, 1);
+}
+
+// the branches or leaves of tree t, at level, on their own
+static void draw_tree(renderer_t * renderer, size_t t, int type, uint8_t level) {
+    gpu_chunk_t * chunk = &renderer->chunks[*vec_size_t_at(&renderer->tree_chunk, t)];
+    size_t first = 0;
+    size_t count = tree_range(renderer, type, level, t, &first);
+    bool bound = false;
+    draw_range(renderer, chunk, type, level, first, count, &bound);
+}
+
+// the branches or leaves of the trees of a chunk drawn at level. Trees are
+// laid out in chunk order in every buffer, so the ranges of trees side by
+// side run on from each other, or from the degenerate slack of the slot
+// before, and are drawn together, in as few draws as there are runs of trees
+// at the level
+static void draw_level(renderer_t * renderer, gpu_chunk_t * chunk, int type, uint8_t level) {
+    const uint8_t * levels = vec_uint8_t_data(&renderer->levels);
+    const size_t * chunk_trees = vec_size_t_data(&renderer->chunk_trees);
+    size_t run_first = 0;
+    size_t run_count = 0;
+    size_t run_end = 0;
+    bool bound = false;
+    for (size_t k = chunk->first_tree; k < chunk->first_tree + chunk->num_trees; k++) {
+        size_t t = chunk_trees[k];
+        size_t first = 0;
+        size_t count = levels[t] == level ? tree_range(renderer, type, level, t, &first) : 0;
+        if (count == 0) {
+            continue;
+        }
+        if (run_count == 0 || first != run_end) {
+            draw_range(renderer, chunk, type, level, run_first, run_count, &bound);
+            run_first = first;
+        }
+        run_count = first + count - run_first;
+        run_end = slot_end(renderer, type, level, t, first, count);
+    }
+    draw_range(renderer, chunk, type, level, run_first, run_count, &bound);
+}
+
+// one object type of a visible chunk, its pipeline already applied
+static void draw_chunk(renderer_t * renderer, gpu_chunk_t * chunk, int type) {
+    if (type == TREE && renderer->instanced) {
+        bool bound = false;
+        draw_range(renderer, chunk, TREE, 0, 0, chunk->num_instances, &bound);
+    } else if (type == TREE || type == LEAF) {
+        for (uint8_t level = 0; level < NUM_LODS; level++) {
+            draw_level(renderer, chunk, type, level);
+        }
+    } else if (chunk->num_vertices[type] > 0) {
+        sg_bindings bind = renderer->bind[type];
+        bind.vertex_buffers[0] = chunk->vertices[type].buffer;
+        sg_apply_bindings(&bind);
+        sg_draw(0, chunk->num_vertices[type], 1);
+    }
+}
+
+static int compare_copy_draws(const void * a, const void * b) {
+    const copy_draw_t * x = a;
+    const copy_draw_t * y = b;
+    if (x->tree != y->tree) {
+        return x->tree < y->tree ? -1 : 1;
+    }
+    return (int)x->level - (int)y->level;
+}
+
+// the copies left after culling, from every chunk, sorted so that the copies
+// of one tree at one level are side by side. Their transforms and tints are
+// sent in that order for the copy pipeline to draw each run as instances
+static void gather_copies(renderer_t * renderer) {
+    vec_copy_draw_t_clear(&renderer->copy_draws);
+    for (size_t c = 0; c < renderer->num_chunks; c++) {
+        gpu_chunk_t * chunk = &renderer->chunks[c];
+        uint8_t * copy_levels = vec_uint8_t_data(&chunk->copy_levels);
+        for (size_t k = 0; k < vec_mesh_copy_t_size(&chunk->copies); k++) {
+            mesh_copy_t * copy = vec_mesh_copy_t_at(&chunk->copies, k);
+            if (copy_levels[k] == CULLED || copy->tree >= renderer->num_trees) {
+                continue;
+            }
+            // the tree's geometry is relative to the origin of its own chunk
+            vec3s origin =
+                renderer->chunks[*vec_size_t_at(&renderer->tree_chunk, copy->tree)].origin;
+            vec_copy_draw_t_push_back(&renderer->copy_draws, (copy_draw_t){
+                .tree = copy->tree,
+                .level = copy_levels[k],
+                .instance = {
+                    .transform = glms_mat4_mul(copy->transform, glms_translate_make(origin)),
+                    .tint = glms_vec4(copy->tint, 1.0f),
+                },
+            });
+        }
+    }
+    size_t n = vec_copy_draw_t_size(&renderer->copy_draws);
+    if (n == 0) {
+        return;
+    }
+    copy_draw_t * draws = vec_copy_draw_t_data(&renderer->copy_draws);
+    qsort(draws, n, sizeof(copy_draw_t), compare_copy_draws);
+    vec_copy_instance_t_resize(&renderer->copy_staging, n, (copy_instance_t){0});
+    copy_instance_t * instances = vec_copy_instance_t_data(&renderer->copy_staging);
+    for (size_t k = 0; k < n; k++) {
+        instances[k] = draws[k].instance;
+    }
+    gpu_buffer_write(&renderer->copy_instances, 0, instances, n * sizeof(copy_instance_t));
+}
+
+// the copies of every chunk. Ring branches go through the copy pipeline, one
+// draw for each run of copies of a tree at a level. Leaves and instanced
+// branches are already instances, of clusters or of the unit cylinder, and
+// GLES can't instance those again by copy, so each copy of them is a draw
+// with its own transform, in the pipeline of the object type
+static void draw_copies(renderer_t * renderer, int type, mat4s mvp) {
+    size_t n = vec_copy_draw_t_size(&renderer->copy_draws);
+    copy_draw_t * draws = vec_copy_draw_t_data(&renderer->copy_draws);
+    if (n == 0 || (type != TREE && type != LEAF)) {
+        return;
+    }
+    if (type == TREE && !renderer->instanced) {
+        sg_apply_pipeline(renderer->copy_pip[renderer->short_indices]);
+        params_t vs_params = {.mvp = mvp};
+        sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &SG_RANGE(vs_params));
+        size_t end = 0;
+        for (size_t k = 0; k < n; k = end) {
+            end = k + 1;
+            while (end < n && draws[end].tree == draws[k].tree &&
+                    draws[end].level == draws[k].level) {
+                end++;
+            }
+            size_t first = 0;
+            size_t count = tree_range(renderer, TREE, draws[k].level, draws[k].tree, &first);
+            if (count == 0) {
+                continue;
+            }
+            gpu_chunk_t * chunk =
+                &renderer->chunks[*vec_size_t_at(&renderer->tree_chunk, draws[k].tree)];
+            sg_bindings bind = ring_bindings(renderer, chunk, draws[k].level);
+            bind.vertex_buffers[1] = renderer->copy_instances.buffer;
+            bind.vertex_buffer_offsets[1] = k * sizeof(copy_instance_t);
+            sg_apply_bindings(&bind);
+            sg_draw(first, count, end - k);
+        }
+        return;
+    }
+    for (size_t k = 0; k < n; k++) {
+        params_t vs_params = {.mvp = glms_mat4_mul(mvp, draws[k].instance.transform)};
+        fs_params_t fs_params = {.tint = draws[k].instance.tint};
+        sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &SG_RANGE(vs_params));
+        sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &SG_RANGE(fs_params));
+        draw_tree(renderer, draws[k].tree, type, draws[k].level);
+    }
+}
+
+// draws the forest seen through view_proj into the pass begun
+static void draw_scene(renderer_t * renderer, mat4s view_proj, mat4s model) {
+    /* model-view-projection matrix for vertex shader */
+    mat4s mvp = glms_mat4_mul(view_proj, model);
+
+    select_levels(renderer, model, mvp);
+    gather_copies(renderer);
+
+    for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
+        if (i == TREE && renderer->instanced) {
+            sg_apply_pipeline(renderer->instance_pip);
+        } else if (i == TREE) {
+            sg_apply_pipeline(renderer->branch_pip[renderer->short_indices]);
+        } else if (i == LEAF) {
+            sg_apply_pipeline(renderer->leaf_pip);
+        } else {
+            sg_apply_pipeline(renderer->pip);
+        }
+        for (size_t c = 0; c < renderer->num_chunks; c++) {
+            gpu_chunk_t * chunk = &renderer->chunks[c];
+            if (!chunk->visible) {
+                continue;
+            }
+            // positions in a chunk are relative to its origin
+            params_t vs_params = {
+                .mvp = glms_mat4_mul(mvp, glms_translate_make(chunk->origin)),
+            };
+            sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &SG_RANGE(vs_params));
+            sg_apply_uniforms(SG_SHADERSTAGE_FS, 0, &SG_RANGE(no_tint));
+            draw_chunk(renderer, chunk, i);
+        }
+        draw_copies(renderer, i, mvp);
+    }
+}
+
+// draws the frame again for the capture and starts reading it back. If every
+// buffer of the ring is still being read the frame is dropped rather than
+// waiting for one
+static void capture_scene(renderer_t * renderer, mat4s model) {
+    renderer->capture_next = false;
+    if (renderer->capture_pending == CAPTURE_BUFFERS) {
+        capture_drop(renderer->capture);
+        return;
+    }
+    int b = (renderer->capture_head + renderer->capture_pending) % CAPTURE_BUFFERS;
+    sg_begin_pass(renderer->capture_pass, &renderer->pass_action);
+    draw_scene(renderer, renderer->capture_view_proj, model);
+    // read while the pass's framebuffer is still bound
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, renderer->capture_buffers[b]);
+    glReadPixels(0, 0, capture_width(renderer->capture), capture_height(renderer->capture),
+        GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    renderer->capture_fences[b] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    renderer->capture_pending++;
+    sg_end_pass();
+}
+
+// the time recorded is the time taken to issue the draws, the GPU runs on.
+// Captured frames are read back a frame or two later, once the GPU is done
 void renderer_render(renderer_t * renderer, int cur_width, int cur_height) {
-    params_t vs_params;
+    uint64_t start = timing_now();
     mat4s rxm = glms_quat_mat4(glms_quatv(glm_rad(renderer->rx), (vec3s){1.0f, 0.0f, 0.0f}));
     mat4s rym = glms_quat_mat4(glms_quatv(glm_rad(renderer->ry), (vec3s){0.0f, 1.0f, 0.0f}));
     mat4s model = glms_mat4_mul(rxm, rym);
 
-    /* model-view-projection matrix for vertex shader */
-    vs_params.mvp = glms_mat4_mul(renderer->view_proj, model);
-
-    sg_begin_default_pass(&renderer->pass_action, cur_width, cur_height);
-    sg_apply_pipeline(renderer->pip);
-    sg_apply_uniforms(SG_SHADERSTAGE_VS, 0, &SG_RANGE(vs_params));
-    for (int i = 0; i < MAX_OBJECT_TYPE; i++) {
-        sg_apply_bindings(&renderer->bind[i]);
-        sg_draw(0, vec_vertex_t_size(&renderer->vertices[i]), 1);
+    if (renderer->capture) {
+        read_captures(renderer, false);
     }
+    sg_begin_default_pass(&renderer->pass_action, cur_width, cur_height);
+    draw_scene(renderer, renderer->view_proj, model);
     sg_end_pass();
+    if (renderer->capture_next) {
+        capture_scene(renderer, model);
+    }
     sg_commit();
     renderer->frame++;
+    timing_record(TIMING_RENDER, start);
 }
-
-
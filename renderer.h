@@ -3,24 +3,27 @@
 
 typedef struct renderer_s renderer_t;
 
-void renderer_free(renderer_t ** renderer); 
-
-renderer_t * renderer_init(int width, int height); 
-
-void renderer_clear_vertices(renderer_t * renderer); 
+typedef struct mesh_s mesh_t;
 
-void renderer_add_cylinder(renderer_t * renderer, mat4s m0, float r0, mat4s m1, float r1); 
+typedef struct capture_s capture_t;
 
-void renderer_add_leaves(renderer_t * renderer, mat4s mat, float radius);
- 
-void renderer_add_contact_shadow(renderer_t * renderer, vec3s origin, float radius); 
+void renderer_free(renderer_t ** renderer); 
 
-void renderer_add_ground_plane(renderer_t * renderer, float radius); 
+renderer_t * renderer_init(int width, int height); 
 
-void renderer_upload_vertices(renderer_t * renderer); 
+void renderer_upload_vertices(renderer_t * renderer, mesh_t * mesh); 
 
 void renderer_update(renderer_t * renderer);
 
 void renderer_render(renderer_t * renderer, int cur_width, int cur_height);
 
+// frames asked for with renderer_capture_frame are also drawn at the size of
+// capture and handed to it, a few frames later, without renderer_render ever
+// waiting on them. NULL stops capturing once the frames still on their way
+// are handed over, as does renderer_free, so capture must outlive either
+void renderer_set_capture(renderer_t * renderer, capture_t * capture);
+
+// the next renderer_render captures its frame too
+void renderer_capture_frame(renderer_t * renderer);
+
 #endif
@@ -0,0 +1,148 @@
+#include "sim.h"
+#include "timing.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef struct sim_s {
+    forest_t * forest;
+    mesh_t * mesh;
+    pool_t * pool;
+    uint64_t budget;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    // the sim thread works until deadline, set by each sim_frame
+    uint64_t deadline;
+    bool requested;
+    // a step is part done
+    bool stepping;
+    // the forest has grown since the mesh was last brought up to date
+    bool meshing;
+    // the mesh holds a finished step, or the render thread has it
+    bool ready;
+    bool acquired;
+    bool quit;
+} sim_t;
+
+typedef enum {
+    NO_WORK,
+    GROW,
+    MESH,
+} work_e;
+
+// meshing only happens between steps, so the mesh never sees half a step,
+// and only once the render thread is done with the last one
+static work_e next_work(sim_t * sim) {
+    if (!sim->stepping && sim->meshing && !sim->ready && !sim->acquired) {
+        return MESH;
+    }
+    if (sim->stepping || sim->requested) {
+        return GROW;
+    }
+    return NO_WORK;
+}
+
+static void * run(void * arg) {
+    sim_t * sim = arg;
+    pthread_mutex_lock(&sim->mutex);
+    while (true) {
+        work_e work;
+        while (!sim->quit &&
+                ((work = next_work(sim)) == NO_WORK || timing_now() >= sim->deadline)) {
+            pthread_cond_wait(&sim->changed, &sim->mutex);
+        }
+        if (sim->quit) {
+            break;
+        }
+        uint64_t deadline = sim->deadline;
+        if (work == GROW) {
+            sim->stepping = true;
+            sim->requested = false;
+        }
+        pthread_mutex_unlock(&sim->mutex);
+
+        // growth only touches the forest, so it can run while the render
+        // thread still has the mesh
+        bool done = work == GROW ? grow_until(sim->forest, sim->pool, deadline) :
+            new_geometry_until(sim->forest, sim->mesh, deadline);
+
+        pthread_mutex_lock(&sim->mutex);
+        if (done && work == GROW) {
+            sim->stepping = false;
+            sim->meshing = true;
+        } else if (done) {
+            sim->meshing = false;
+            sim->ready = true;
+        }
+    }
+    // a part done step would leave the forest half grown
+    if (sim->stepping) {
+        grow(sim->forest, sim->pool);
+    }
+    pthread_mutex_unlock(&sim->mutex);
+    return NULL;
+}
+
+sim_t * sim_init(forest_t * forest, mesh_t * mesh, pool_t * pool, uint64_t budget) {
+    sim_t * sim = malloc(sizeof(sim_t));
+    *sim = (sim_t){
+        .forest = forest,
+        .mesh = mesh,
+        .pool = pool,
+        .budget = budget,
+    };
+    pthread_mutex_init(&sim->mutex, NULL);
+    pthread_cond_init(&sim->changed, NULL);
+    pthread_create(&sim->thread, NULL, run, sim);
+    return sim;
+}
+
+void sim_free(sim_t ** sim) {
+    if (*sim) {
+        sim_t * s = *sim;
+        pthread_mutex_lock(&s->mutex);
+        s->quit = true;
+        pthread_cond_broadcast(&s->changed);
+        pthread_mutex_unlock(&s->mutex);
+        pthread_join(s->thread, NULL);
+        pthread_cond_destroy(&s->changed);
+        pthread_mutex_destroy(&s->mutex);
+        free(s);
+        *sim = NULL;
+    }
+}
+
+void sim_step(sim_t * sim) {
+    pthread_mutex_lock(&sim->mutex);
+    sim->requested = true;
+    pthread_cond_broadcast(&sim->changed);
+    pthread_mutex_unlock(&sim->mutex);
+}
+
+void sim_frame(sim_t * sim) {
+    pthread_mutex_lock(&sim->mutex);
+    sim->deadline = timing_now() + sim->budget;
+    pthread_cond_broadcast(&sim->changed);
+    pthread_mutex_unlock(&sim->mutex);
+}
+
+mesh_t * sim_acquire(sim_t * sim) {
+    mesh_t * mesh = NULL;
+    pthread_mutex_lock(&sim->mutex);
+    if (sim->ready) {
+        sim->ready = false;
+        sim->acquired = true;
+        mesh = sim->mesh;
+    }
+    pthread_mutex_unlock(&sim->mutex);
+    return mesh;
+}
+
+void sim_release(sim_t * sim) {
+    pthread_mutex_lock(&sim->mutex);
+    sim->acquired = false;
+    pthread_cond_broadcast(&sim->changed);
+    pthread_mutex_unlock(&sim->mutex);
+}
@@ -0,0 +1,36 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "forest.h"
+#include "mesh.h"
+#include "pool.h"
+
+// runs growth steps and meshing on a thread of their own so that the render
+// thread never waits on them. While it runs only the sim thread touches the
+// forest. The mesh is handed to the render thread after each step and back
+// once uploaded, and the next step's growth goes ahead meanwhile. The sim
+// thread works for at most a budget of time each frame, a batch at a time,
+// so a step in a big forest spans several frames rather than taking cores
+// from the render thread
+typedef struct sim_s sim_t;
+
+// forest, mesh and pool must outlive the sim, budget is in ns
+sim_t * sim_init(forest_t * forest, mesh_t * mesh, pool_t * pool, uint64_t budget);
+
+// finishes the step in progress, if any, and stops the thread
+void sim_free(sim_t ** sim);
+
+// asks for one growth step, ignored while one is already waiting to start
+void sim_step(sim_t * sim);
+
+// starts a frame, giving the sim thread its budget from now
+void sim_frame(sim_t * sim);
+
+// the mesh if a step has finished since the last release, otherwise NULL.
+// Never waits for a step
+mesh_t * sim_acquire(sim_t * sim);
+
+// gives the mesh from sim_acquire back
+void sim_release(sim_t * sim);
+
+#endif
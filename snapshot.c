@@ -0,0 +1,472 @@
+#include "snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// layout, every section starting on an 8 byte boundary:
+//   header_t
+//   num_trees tree records of TREE_RECORD bytes, chunk by chunk as laid out
+//   by forest_init_templates
+//   the paths columns position, direction, up (3 floats each), radius,
+//   is_leader, is_leaf (a byte each), last_path, tree (64 bits each)
+//   the tips, 64 bits each
+//   the occupancy bricks then the light bricks, as in memory
+static const char magic[8] = {'T', 'R', 'E', 'E', 'S', 'N', 'A', 'P'};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t seed;
+    uint64_t steps;
+    uint64_t tips_visited;
+    uint64_t segments_visited;
+    uint64_t num_trees;
+    uint64_t num_paths;
+    uint64_t num_tips;
+    uint64_t num_grid_bricks;
+    uint64_t num_light_bricks;
+    // of the grid of spots the trees and their copies stand in
+    uint64_t side;
+    // metres of shade under a tip the light bricks were cast with
+    float shadow_depth;
+} header_t;
+
+// rng key and counter, shoot, origin, radius, bounds, has_leader
+#define TREE_RECORD 72
+// the count and tree of every cell
+#define GRID_BRICK_WORDS (2 * BRICK_CELLS)
+// the shade of every cell, the total is summed again on loading
+#define LIGHT_BRICK_WORDS BRICK_CELLS
+
+static bool little_endian() {
+    const uint16_t one = 1;
+    return *(const uint8_t *)&one == 1;
+}
+
+// reverses the bytes of each of count words of size bytes, on big endian
+// hosts only, so the same call converts to and from the file's order
+static void to_little(void * data, size_t count, size_t size) {
+    if (little_endian() || size == 1) {
+        return;
+    }
+    uint8_t * bytes = data;
+    for (size_t i = 0; i < count; i++, bytes += size) {
+        for (size_t j = 0; j < size / 2; j++) {
+            uint8_t b = bytes[j];
+            bytes[j] = bytes[size - 1 - j];
+            bytes[size - 1 - j] = b;
+        }
+    }
+}
+
+static size_t padded(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+typedef struct {
+    FILE * file;
+    bool ok;
+} writer_t;
+
+// writes count words of size bytes, then pads to the next section
+static void put(writer_t * w, const void * data, size_t count, size_t size) {
+    static const uint8_t zeros[8] = {0};
+    size_t bytes = count * size;
+    if (little_endian() || size == 1) {
+        w->ok = w->ok && fwrite(data, 1, bytes, w->file) == bytes;
+    } else {
+        // a chunk at a time so that no copy of a whole column is needed
+        uint8_t chunk[4096];
+        size_t per_chunk = sizeof(chunk) / size;
+        for (size_t i = 0; i < count && w->ok; i += per_chunk) {
+            size_t n = count - i < per_chunk ? count - i : per_chunk;
+            memcpy(chunk, (const uint8_t *)data + i * size, n * size);
+            to_little(chunk, n, size);
+            w->ok = fwrite(chunk, 1, n * size, w->file) == n * size;
+        }
+    }
+    size_t pad = padded(bytes) - bytes;
+    w->ok = w->ok && fwrite(zeros, 1, pad, w->file) == pad;
+}
+
+static void put_record(uint8_t * record, size_t * at, const void * data, size_t count,
+        size_t size) {
+    memcpy(record + *at, data, count * size);
+    to_little(record + *at, count, size);
+    *at += count * size;
+}
+
+static void put_tree(writer_t * w, tree_t * tree) {
+    uint8_t record[TREE_RECORD] = {0};
+    size_t at = 0;
+    uint64_t shoot = tree->shoot;
+    put_record(record, &at, &tree->rng.key, 1, sizeof(uint64_t));
+    put_record(record, &at, &tree->rng.counter, 1, sizeof(uint64_t));
+    put_record(record, &at, &shoot, 1, sizeof(uint64_t));
+    put_record(record, &at, tree->origin.raw, 3, sizeof(float));
+    put_record(record, &at, &tree->radius, 1, sizeof(float));
+    put_record(record, &at, tree->bounds.lo.raw, 3, sizeof(float));
+    put_record(record, &at, tree->bounds.hi.raw, 3, sizeof(float));
+    record[at] = tree->has_leader;
+    put(w, record, TREE_RECORD, 1);
+}
+
+// size_t columns are written as 64 bits whatever the host
+static void put_sizes(writer_t * w, vec_size_t * v) {
+    size_t n = vec_size_t_size(v);
+    if (sizeof(size_t) == sizeof(uint64_t)) {
+        put(w, vec_size_t_data(v), n, sizeof(uint64_t));
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint64_t x = *vec_size_t_at(v, i);
+        to_little(&x, 1, sizeof(x));
+        w->ok = w->ok && fwrite(&x, sizeof(x), 1, w->file) == 1;
+    }
+}
+
+static void put_vecs(writer_t * w, vec_vec3s * v) {
+    put(w, vec_vec3s_data(v), vec_vec3s_size(v) * 3, sizeof(float));
+}
+
+// a field at a time, the struct may be padded. The version and flags share
+// one 8 byte section
+static void put_header(writer_t * w, header_t * header) {
+    uint8_t record[8];
+    size_t at = 0;
+    put_record(record, &at, &header->version, 1, sizeof(uint32_t));
+    put_record(record, &at, &header->flags, 1, sizeof(uint32_t));
+    put(w, header->magic, sizeof(magic), 1);
+    put(w, record, sizeof(record), 1);
+    put(w, &header->seed, 1, sizeof(uint64_t));
+    put(w, &header->steps, 1, sizeof(uint64_t));
+    put(w, &header->tips_visited, 1, sizeof(uint64_t));
+    put(w, &header->segments_visited, 1, sizeof(uint64_t));
+    put(w, &header->num_trees, 1, sizeof(uint64_t));
+    put(w, &header->num_paths, 1, sizeof(uint64_t));
+    put(w, &header->num_tips, 1, sizeof(uint64_t));
+    put(w, &header->num_grid_bricks, 1, sizeof(uint64_t));
+    put(w, &header->num_light_bricks, 1, sizeof(uint64_t));
+    put(w, &header->side, 1, sizeof(uint64_t));
+    put(w, &header->shadow_depth, 1, sizeof(float));
+}
+
+bool snapshot_save(forest_t * forest, const char * filename) {
+    writer_t w = {.file = fopen(filename, "wb"), .ok = true};
+    if (!w.file) {
+        perror(filename);
+        return false;
+    }
+    paths_t * paths = &forest->paths;
+    header_t header = {
+        .version = SNAPSHOT_VERSION,
+        .flags = 0,
+        .seed = forest->seed,
+        .steps = forest->stats.steps,
+        .tips_visited = forest->stats.tips,
+        .segments_visited = forest->stats.segments,
+        .num_trees = vec_tree_t_size(&forest->trees),
+        .num_paths = paths_size(paths),
+        .num_tips = vec_size_t_size(&paths->tips),
+        .num_grid_bricks = vec_brick_t_size(&forest->grid.bricks),
+        .num_light_bricks = vec_light_brick_t_size(&forest->light.bricks),
+        .side = forest->side,
+        .shadow_depth = forest->light.depth,
+    };
+    memcpy(header.magic, magic, sizeof(magic));
+    put_header(&w, &header);
+
+    foreach(vec_tree_t, &forest->trees, it) {
+        put_tree(&w, it.ref);
+    }
+    put_vecs(&w, &paths->position);
+    put_vecs(&w, &paths->direction);
+    put_vecs(&w, &paths->up);
+    put(&w, vec_float_data(&paths->radius), header.num_paths, sizeof(float));
+    put(&w, vec_uint8_t_data(&paths->is_leader), header.num_paths, 1);
+    put(&w, vec_uint8_t_data(&paths->is_leaf), header.num_paths, 1);
+    put_sizes(&w, &paths->last_path);
+    put_sizes(&w, &paths->tree);
+    put_sizes(&w, &paths->tips);
+
+    // a brick is its key then 32 bit words, two for each occupancy cell
+    foreach(vec_brick_t, &forest->grid.bricks, it) {
+        put(&w, &it.ref->key, 1, sizeof(uint64_t));
+        put(&w, it.ref->cells, GRID_BRICK_WORDS, sizeof(uint32_t));
+    }
+    foreach(vec_light_brick_t, &forest->light.bricks, it) {
+        put(&w, &it.ref->key, 1, sizeof(uint64_t));
+        put(&w, it.ref->shade, LIGHT_BRICK_WORDS, sizeof(int32_t));
+    }
+
+    if (fclose(w.file) != 0) {
+        w.ok = false;
+    }
+    if (!w.ok) {
+        fprintf(stderr, "%s: failed writing snapshot\n", filename);
+    }
+    return w.ok;
+}
+
+// a snapshot being loaded, either mapped, when data is set, or read from file
+// a section at a time. at is the offset of the next section, size the length
+// of the file
+typedef struct {
+    const uint8_t * data;
+    FILE * file;
+    size_t size;
+    size_t at;
+    bool ok;
+} reader_t;
+
+// copies count words of size bytes out of the file into data, then skips to
+// the next section. Either way the columns go straight into place, with no
+// copy of the whole file in between
+static void get(reader_t * r, void * data, size_t count, size_t size) {
+    size_t bytes = count * size;
+    if (!r->ok || count > r->size / (size ? size : 1) || r->size - r->at < padded(bytes)) {
+        r->ok = false;
+        return;
+    }
+    if (r->data) {
+        if (bytes > 0) {
+            memcpy(data, r->data + r->at, bytes);
+        }
+    } else {
+        uint8_t pad[8];
+        size_t skip = padded(bytes) - bytes;
+        r->ok = (bytes == 0 || fread(data, 1, bytes, r->file) == bytes) &&
+            fread(pad, 1, skip, r->file) == skip;
+        if (!r->ok) {
+            return;
+        }
+    }
+    to_little(data, count, size);
+    r->at += padded(bytes);
+}
+
+// whether count words of size bytes are left in the file. Every count read
+// from the file is checked with this before anything is sized from it
+static bool remains(reader_t * r, uint64_t count, size_t size) {
+    r->ok = r->ok && count <= (r->size - r->at) / size;
+    return r->ok;
+}
+
+static void get_record(const uint8_t * record, size_t * at, void * data, size_t count,
+        size_t size) {
+    memcpy(data, record + *at, count * size);
+    to_little(data, count, size);
+    *at += count * size;
+}
+
+static void get_header(reader_t * r, header_t * header) {
+    uint8_t record[8] = {0};
+    size_t at = 0;
+    get(r, header->magic, sizeof(magic), 1);
+    get(r, record, sizeof(record), 1);
+    get_record(record, &at, &header->version, 1, sizeof(uint32_t));
+    get_record(record, &at, &header->flags, 1, sizeof(uint32_t));
+    get(r, &header->seed, 1, sizeof(uint64_t));
+    get(r, &header->steps, 1, sizeof(uint64_t));
+    get(r, &header->tips_visited, 1, sizeof(uint64_t));
+    get(r, &header->segments_visited, 1, sizeof(uint64_t));
+    get(r, &header->num_trees, 1, sizeof(uint64_t));
+    get(r, &header->num_paths, 1, sizeof(uint64_t));
+    get(r, &header->num_tips, 1, sizeof(uint64_t));
+    get(r, &header->num_grid_bricks, 1, sizeof(uint64_t));
+    get(r, &header->num_light_bricks, 1, sizeof(uint64_t));
+    get(r, &header->side, 1, sizeof(uint64_t));
+    get(r, &header->shadow_depth, 1, sizeof(float));
+}
+
+static tree_t get_tree(reader_t * r) {
+    uint8_t record[TREE_RECORD];
+    tree_t tree = {0};
+    get(r, record, TREE_RECORD, 1);
+    if (!r->ok) {
+        return tree;
+    }
+    size_t at = 0;
+    uint64_t shoot;
+    get_record(record, &at, &tree.rng.key, 1, sizeof(uint64_t));
+    get_record(record, &at, &tree.rng.counter, 1, sizeof(uint64_t));
+    get_record(record, &at, &shoot, 1, sizeof(uint64_t));
+    get_record(record, &at, tree.origin.raw, 3, sizeof(float));
+    get_record(record, &at, &tree.radius, 1, sizeof(float));
+    get_record(record, &at, tree.bounds.lo.raw, 3, sizeof(float));
+    get_record(record, &at, tree.bounds.hi.raw, 3, sizeof(float));
+    tree.has_leader = record[at];
+    tree.shoot = shoot;
+    return tree;
+}
+
+static void get_sizes(reader_t * r, vec_size_t * v, uint64_t n) {
+    if (!remains(r, n, sizeof(uint64_t))) {
+        return;
+    }
+    vec_size_t_resize(v, n, 0);
+    if (sizeof(size_t) == sizeof(uint64_t)) {
+        get(r, vec_size_t_data(v), n, sizeof(uint64_t));
+        return;
+    }
+    for (size_t i = 0; i < n && r->ok; i++) {
+        uint64_t x;
+        get(r, &x, 1, sizeof(x));
+        *vec_size_t_at(v, i) = x;
+    }
+}
+
+static void get_vecs(reader_t * r, vec_vec3s * v, uint64_t n) {
+    if (!remains(r, n, 3 * sizeof(float))) {
+        return;
+    }
+    vec_vec3s_resize(v, n, (vec3s){0});
+    get(r, vec_vec3s_data(v), n * 3, sizeof(float));
+}
+
+// everything past the header, into a forest made by forest_init
+static void get_forest(reader_t * r, header_t * header, forest_t * forest) {
+    paths_t * paths = &forest->paths;
+    // each path takes at least a byte, so this bounds n before anything is
+    // sized from it
+    if (!remains(r, header->num_paths, 1)) {
+        return;
+    }
+    size_t n = header->num_paths;
+    forest->stats = (growth_stats_t){
+        .steps = header->steps,
+        .tips = header->tips_visited,
+        .segments = header->segments_visited,
+    };
+    remains(r, header->num_trees, TREE_RECORD);
+    for (size_t t = 0; t < header->num_trees && r->ok; t++) {
+        vec_tree_t_push_back(&forest->trees, get_tree(r));
+    }
+    get_vecs(r, &paths->position, n);
+    get_vecs(r, &paths->direction, n);
+    get_vecs(r, &paths->up, n);
+    if (remains(r, n, sizeof(float))) {
+        vec_float_resize(&paths->radius, n, 0.0f);
+        get(r, vec_float_data(&paths->radius), n, sizeof(float));
+    }
+    if (remains(r, n, 1)) {
+        vec_uint8_t_resize(&paths->is_leader, n, 0);
+        get(r, vec_uint8_t_data(&paths->is_leader), n, 1);
+    }
+    if (remains(r, n, 1)) {
+        vec_uint8_t_resize(&paths->is_leaf, n, 0);
+        get(r, vec_uint8_t_data(&paths->is_leaf), n, 1);
+    }
+    get_sizes(r, &paths->last_path, n);
+    get_sizes(r, &paths->tree, n);
+    get_sizes(r, &paths->tips, header->num_tips);
+
+    remains(r, header->num_grid_bricks, 8 + GRID_BRICK_WORDS * sizeof(uint32_t));
+    for (size_t b = 0; b < header->num_grid_bricks && r->ok; b++) {
+        brick_t brick;
+        get(r, &brick.key, 1, sizeof(uint64_t));
+        get(r, brick.cells, GRID_BRICK_WORDS, sizeof(uint32_t));
+        vec_brick_t_push_back(&forest->grid.bricks, brick);
+    }
+    light_free(&forest->light);
+    forest->light = light_init(header->shadow_depth);
+    remains(r, header->num_light_bricks, 8 + LIGHT_BRICK_WORDS * sizeof(int32_t));
+    for (size_t b = 0; b < header->num_light_bricks && r->ok; b++) {
+        light_brick_t brick;
+        get(r, &brick.key, 1, sizeof(uint64_t));
+        get(r, brick.shade, LIGHT_BRICK_WORDS, sizeof(int32_t));
+        vec_light_brick_t_push_back(&forest->light.bricks, brick);
+    }
+    grid_reindex(&forest->grid);
+    light_reindex(&forest->light);
+    // the copies aren't saved, they follow from the seed
+    forest->side = header->side;
+    r->ok = r->ok && header->side < (1 << 20) && header->side * header->side >= header->num_trees;
+    if (r->ok) {
+        forest_index_chunks(forest);
+    }
+
+    // indices that point outside the store would be read without checks later
+    for (size_t i = 0; i < n && r->ok; i++) {
+        r->ok = *vec_size_t_at(&paths->last_path, i) < n &&
+            *vec_size_t_at(&paths->tree, i) < header->num_trees;
+    }
+    for (size_t t = 0; t < header->num_tips && r->ok; t++) {
+        r->ok = *vec_size_t_at(&paths->tips, t) < n;
+    }
+    foreach(vec_tree_t, &forest->trees, it) {
+        r->ok = r->ok && it.ref->shoot < n;
+    }
+}
+
+// opens filename for reading, or when map is set maps the whole of it
+static bool open_reader(reader_t * r, const char * filename, bool map) {
+    *r = (reader_t){.ok = true};
+    r->file = fopen(filename, "rb");
+    struct stat st;
+    if (!r->file || fstat(fileno(r->file), &st) != 0) {
+        perror(filename);
+        if (r->file) {
+            fclose(r->file);
+        }
+        return false;
+    }
+    r->size = st.st_size;
+    // an empty file can't be mapped, it is read and found too short instead
+    if (map && r->size > 0) {
+        void * data = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fileno(r->file), 0);
+        if (data == MAP_FAILED) {
+            perror(filename);
+            fclose(r->file);
+            return false;
+        }
+        // the columns are copied out front to back
+        madvise(data, r->size, MADV_SEQUENTIAL);
+        r->data = data;
+    }
+    return true;
+}
+
+static void close_reader(reader_t * r) {
+    if (r->data) {
+        munmap((void *)r->data, r->size);
+    }
+    fclose(r->file);
+}
+
+bool snapshot_load(forest_t * forest, const char * filename, size_t num_tasks, bool map) {
+    reader_t r;
+    if (!open_reader(&r, filename, map)) {
+        return false;
+    }
+    header_t header;
+    get_header(&r, &header);
+    bool ok = r.ok && memcmp(header.magic, magic, sizeof(magic)) == 0;
+    if (ok && header.version != SNAPSHOT_VERSION) {
+        fprintf(stderr, "%s: snapshot version %u, expected %u\n", filename,
+            header.version, SNAPSHOT_VERSION);
+        ok = false;
+    } else if (!ok) {
+        fprintf(stderr, "%s: not a snapshot\n", filename);
+    }
+
+    if (ok) {
+        forest_t loaded = forest_init(0, header.seed, num_tasks);
+        get_forest(&r, &header, &loaded);
+        ok = r.ok;
+        if (ok) {
+            forest_free(forest);
+            *forest = loaded;
+        } else {
+            fprintf(stderr, "%s: truncated or corrupt snapshot\n", filename);
+            forest_free(&loaded);
+        }
+    }
+
+    close_reader(&r);
+    return ok;
+}
@@ -0,0 +1,21 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "forest.h"
+
+// bumped whenever the layout below changes, older files are refused
+#define SNAPSHOT_VERSION 5
+
+// the whole simulation state of a forest in one little endian file: the
+// trees with their random streams, every column of the paths, the growth
+// counters and the occupancy and light grids, so that a restored forest
+// grows exactly as the saved one would have. Returns false, having said why
+// on stderr, if the file can't be written
+bool snapshot_save(forest_t * forest, const char * filename);
+
+// replaces forest with the one saved in filename, growing in num_tasks
+// pieces. With map the file is memory mapped rather than read. forest is
+// left alone if the file can't be read or isn't a snapshot of this version
+bool snapshot_load(forest_t * forest, const char * filename, size_t num_tasks, bool map);
+
+#endif
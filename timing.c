@@ -0,0 +1,119 @@
+#include "timing.h"
+
+#include <time.h>
+
+// times below 16ns get a bucket each, above that every power of two is split
+// into 8
+#define SUB_BUCKETS 8
+#define NUM_BUCKETS (16 + (64 - 4) * SUB_BUCKETS)
+
+typedef struct {
+    uint64_t counts[NUM_BUCKETS];
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+} histogram_t;
+
+static const char * phase_name[MAX_TIMING_PHASE] = {
+    [TIMING_RADIAL_GROWTH] = "radial_growth",
+    [TIMING_LEADER_DECAY] = "leader decay",
+    [TIMING_NEW_PATHS] = "new_paths",
+    [TIMING_MERGE] = "merge children",
+    [TIMING_STEP] = "growth step",
+    [TIMING_NEW_GEOMETRY] = "new_geometry",
+    [TIMING_UPLOAD] = "upload vertices",
+    [TIMING_RENDER] = "renderer_render",
+    [TIMING_FRAME] = "frame",
+};
+
+// counters are only ever added to with relaxed atomics, so that printing
+// from one thread while another records reads whole values
+static histogram_t histograms[MAX_TIMING_PHASE];
+
+static size_t bucket(uint64_t ns) {
+    if (ns < 16) {
+        return ns;
+    }
+    int e = 63 - __builtin_clzll(ns);
+    return 16 + (e - 4) * SUB_BUCKETS + ((ns >> (e - 3)) & (SUB_BUCKETS - 1));
+}
+
+// the middle of the times that fall in bucket b
+static double bucket_ns(size_t b) {
+    if (b < 16) {
+        return b;
+    }
+    int e = (b - 16) / SUB_BUCKETS + 4;
+    uint64_t width = (uint64_t)1 << (e - 3);
+    return (SUB_BUCKETS + (b - 16) % SUB_BUCKETS) * width + width * 0.5;
+}
+
+static uint64_t load(uint64_t * v) {
+    return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+uint64_t timing_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void timing_record(timing_phase_e phase, uint64_t start) {
+    timing_record_ns(phase, timing_now() - start);
+}
+
+void timing_record_ns(timing_phase_e phase, uint64_t ns) {
+    histogram_t * h = &histograms[phase];
+    __atomic_fetch_add(&h->counts[bucket(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total, ns, __ATOMIC_RELAXED);
+    // only one thread records a phase at a time, so no other store can
+    // come between the load and this one
+    if (ns > load(&h->max)) {
+        __atomic_store_n(&h->max, ns, __ATOMIC_RELAXED);
+    }
+}
+
+// the time below which a fraction q of the n recorded times fall, never
+// more than the slowest
+static double percentile(histogram_t * h, uint64_t n, double q) {
+    uint64_t rank = (uint64_t)(q * (n - 1)) + 1;
+    double max = load(&h->max);
+    uint64_t seen = 0;
+    for (size_t b = 0; b < NUM_BUCKETS; b++) {
+        seen += load(&h->counts[b]);
+        if (seen >= rank) {
+            return bucket_ns(b) < max ? bucket_ns(b) : max;
+        }
+    }
+    return max;
+}
+
+void timing_print(FILE * file) {
+    fprintf(file, "%-16s %8s %10s %10s %10s %10s %10s\n",
+        "phase (us)", "count", "mean", "p50", "p95", "p99", "max");
+    for (int phase = 0; phase < MAX_TIMING_PHASE; phase++) {
+        histogram_t * h = &histograms[phase];
+        uint64_t n = load(&h->count);
+        if (n == 0) {
+            continue;
+        }
+        fprintf(file, "%-16s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            phase_name[phase], (unsigned long long)n, load(&h->total) * 1e-3 / n,
+            percentile(h, n, 0.5) * 1e-3, percentile(h, n, 0.95) * 1e-3,
+            percentile(h, n, 0.99) * 1e-3, load(&h->max) * 1e-3);
+    }
+    fflush(file);
+}
+
+void timing_reset() {
+    for (int phase = 0; phase < MAX_TIMING_PHASE; phase++) {
+        histogram_t * h = &histograms[phase];
+        for (size_t b = 0; b < NUM_BUCKETS; b++) {
+            __atomic_store_n(&h->counts[b], 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&h->count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->total, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->max, 0, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// the phases of a growth step and of a frame that are timed
+typedef enum {
+    TIMING_RADIAL_GROWTH,
+    TIMING_LEADER_DECAY,
+    TIMING_NEW_PATHS,
+    TIMING_MERGE,
+    TIMING_STEP,
+    TIMING_NEW_GEOMETRY,
+    TIMING_UPLOAD,
+    TIMING_RENDER,
+    TIMING_FRAME,
+    MAX_TIMING_PHASE
+} timing_phase_e;
+
+// wall clock time in ns, from CLOCK_MONOTONIC
+uint64_t timing_now();
+
+// records the time since start, from timing_now, against phase. Each phase
+// has a histogram of its own with buckets about 12% wide, so recording is a
+// few instructions and never allocates. A phase may be recorded from any
+// thread, but from only one at a time
+void timing_record(timing_phase_e phase, uint64_t start);
+
+// records a time taken in ns, for phases done a piece at a time
+void timing_record_ns(timing_phase_e phase, uint64_t ns);
+
+// writes the count, mean, p50, p95, p99 and max of every phase recorded so
+// far, in microseconds. Percentiles are to within a bucket
+void timing_print(FILE * file);
+
+void timing_reset();
+
+#endif
@@ -1,84 +1,42 @@
-#include "mymath.h"
-
+#include "capture.h"
+#include "export.h"
+#include "forest.h"
+#include "pool.h"
 #include "renderer.h"
+#include "sim.h"
+#include "snapshot.h"
+#include "timing.h"
 
 #define GLFW_INCLUDE_NONE
 #include "GLFW/glfw3.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <time.h>
-
-typedef struct timespec timespec_t;
-
-timespec_t now() {
-    timespec_t now;
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
-    return now;
-}
-
-long elapsed_ns(timespec_t start) {
-    timespec_t end = now();
-    return (long)(end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
-}
-
-struct path_s;
-
-typedef struct path_s {
-    vec3s position;
-    vec3s direction;
-    vec3s up;
-    float radius;
-    bool is_leader;
-    bool is_leaf;
-    size_t last_path;
-    size_t tree;
-} path_t;
-
-#define POD
-#define NOT_INTEGRAL
-#define T path_t
-#include <ctl/vector.h>
-
-typedef struct tree_s {
-    bool has_leader; 
-    vec3s origin;
-    float radius;
-} tree_t;
-
-#define POD
-#define NOT_INTEGRAL
-#define T tree_t
-#include <ctl/vector.h>
 
 typedef struct {
     GLFWwindow * window;
     long frame;
     renderer_t *renderer;
-    bool is_growing;
-    size_t num_trees;
-    vec_tree_t trees;
-    vec_path_t paths;
+    pool_t * pool;
+    forest_t forest;
+    mesh_t mesh;
+    // grows the forest and meshes it, off the render thread
+    sim_t * sim;
+    // T was down last frame
+    bool timing_key;
+    // while capturing a time-lapse the forest grows a step every
+    // frames_per_step captured frames, step_frames of them captured since
+    // the last step's mesh was uploaded
+    capture_t * capture;
+    int frames_per_step;
+    int step_frames;
 } app_t;
 
-path_t create_shoot(vec3s origin, size_t tree) {
-    return (path_t){
-        .position =  glms_vec3_add(origin, (vec3s){.x = 0, .y = 0.0f, .z = 0.0f}),
-        .direction = (vec3s){.x = 0, .y = 0.1f, .z = 0.0f},
-        .up =  (vec3s){.x =  0, .y = 0.0f, .z = 1.0f},
-        .radius = 0.01f,
-        .is_leader = true,
-        .is_leaf = true,
-        .tree = tree
-    };
-}
-
-void init(app_t * app) {
+void init(app_t * app, size_t num_trees, size_t num_templates, bool instanced) {
     const int WIDTH = 800;
     const int HEIGHT = 600;
 
-    srand(time(0));
-
     /* create GLFW window and initialize GL */
     glfwInit();
     glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_ES_API);
@@ -90,186 +48,65 @@ void init(app_t * app) {
 
     renderer_t * renderer = renderer_init(WIDTH, HEIGHT);
 
+    const char * threads = getenv("TREE_THREADS");
+    pool_t * pool = pool_init(threads ? atoi(threads) : 0);
+
     *app = (app_t){
         .frame = 0,
         .window = w,
         .renderer = renderer,
-        .num_trees = 16,
-        .trees = vec_tree_t_init(),
-        .paths = vec_path_t_init(),
-        .is_growing = true,
+        .pool = pool,
+        .forest = forest_init_templates(num_trees, num_templates, forest_seed_from_env(),
+            pool_num_threads(pool) * 4),
+        .mesh = mesh_init(),
+        .sim = NULL,
+        .timing_key = false,
+        .capture = NULL,
+        .frames_per_step = 0,
+        .step_frames = 0,
     };
-
-    int A = (int)sqrt(app->num_trees);
-    float off = (A - 1.0f) / 2.0f;
-
-    for(int x = 0; x < A; x++) {
-        for(int z = 0; z < A; z++) {
-            int tree = x * A + z;
-            vec3s root_pos =
-                    glms_vec3_add(
-                        rand_vec(1.0f), 
-                        glms_vec3_scale(
-                            glms_vec3_add(
-                                (vec3s){x, 0.0f, z},
-                                (vec3s){-off, 0.0f, -off}),
-                            2.0f));
-            root_pos.y = 0.0f;
-            path_t path = create_shoot(root_pos, tree);
-            vec_path_t_push_back(&app->paths, path);
-            vec_tree_t_push_back(&app->trees, 
-                (tree_t){
-                    .has_leader = true,
-                    .origin = root_pos,
-                    .radius = 0.0f
-            });
-        }
-    }
-
+    app->mesh.instanced = instanced;
 }
 
 bool should_quit(app_t * app) {
     return glfwWindowShouldClose(app->window);
 }
 
-void new_path(vec_path_t * paths, const size_t parent_index, path_t * child, float radius, bool is_leader,
-        bool has_leader) {
-    path_t *parent = vec_path_t_at(paths, parent_index);
-    vec3s x, y, z;
-    axes_from_dir_up(parent->direction, parent->up, &x, &y, &z);
-    // perturb direction randomly
-    float perturb = is_leader ? 0.1f : 1.0f;
-    float length = 0.01f;
-    if (is_leader) {
-        length = 0.05f;
-    } else if(!has_leader) {
-        length = 0.03f;
-    }
-
-    vec3s direction = glms_vec3_scale( 
-        glms_vec3_normalize(glms_vec3_add(
-                (vec3s){.x = 0.0f, .y = 0.1f, .z = 0.0f}, // vertical tropism
-                glms_vec3_add(y, rand_vec(perturb)))),
-                length);
-
-    *child = (path_t){
-        .position = glms_vec3_add(parent->position, parent->direction),
-        .direction = direction,
-        .up = z,
-        .radius = radius,
-        .is_leader = is_leader,
-        .is_leaf = true,
-        .tree = parent->tree,
-        .last_path = parent_index
-    };
-}
-
-void radial_growth(vec_path_t * paths, vec_tree_t * trees) {
-    foreach(vec_path_t, paths, it) {
-        path_t *path = it.ref;
-        bool has_leader = vec_tree_t_at(trees, path->tree)->has_leader;
-        path->radius += path->is_leader || !has_leader ? 0.001f : 0.0001f;
-    }
-}
-
-void new_paths(vec_path_t * paths, vec_tree_t * trees) {
-    const int num_paths = vec_path_t_size(paths);
-    for(int i = 0; i < num_paths; i++) {
-        path_t *path = vec_path_t_at(paths, i);
-        if (path->is_leaf) {
-            path->is_leaf = false;
-            int n = rand_prob(path->is_leader ? 0.2f : 0.05f) ? 2 : 1;
-            float radius = 0.01f;
-            float radii[] = {radius, radius};
-            tree_t * tree = vec_tree_t_at(trees, path->tree);
-            
-            vec3s position = path->position;
-            float horiz_dist_from_root = glms_vec3_norm(
-                glms_vec3_sub(
-                    (vec3s){position.x, 0.0f, position.z},
-                    tree->origin));
-            tree->radius = tree->radius > horiz_dist_from_root ? tree->radius : horiz_dist_from_root;
-
-            bool has_leader = tree->has_leader;
-            bool child_is_leader = path->is_leader && has_leader;
-            bool is_leader[] = {child_is_leader, false};
-            if (path->is_leader && !child_is_leader) {
-                printf("stop leader\n");
-            }
-  
-            if (n == 2) {
-                radii[0] = path->is_leader ? radius :
-                    (rand_float(0.5f) + 0.5f) * radius;
-                // sum of children = area of parent
-                radii[1] = sqrt(radius * radius - radii[0] * radii[0]);
-            }
-
-            for (int j = 0; j < n; j++) {
-                vec_path_t_push_back(paths, (path_t){});
-                new_path(paths, i, vec_path_t_back(paths), radii[j], is_leader[j],
-                        has_leader);
-            }
-        }
-    }
-}
-
-void add_cylinder(renderer_t * renderer, const path_t * last_path, const path_t * path) {
-    vec3s x, y, z;
-    axes_from_dir_up(last_path->direction, last_path->up, &x, &y, &z);
-    mat4s m0 = mat_from_axes(x, y, z, path->position);
-    float r0 = last_path->radius;
-
-    vec3s position = glms_vec3_add(path->position, path->direction);
-    axes_from_dir_up(path->direction, path->up, &x, &y, &z);
-    mat4s m1 = mat_from_axes(x, y, z, position);
-    float r1 = path->radius;
-
-    renderer_add_cylinder(renderer, m0, r0, m1, r1);
-    if (path->is_leaf) {
-        renderer_add_leaves(renderer, m1, r1);
+// the render thread only asks for steps and uploads the meshes of finished
+// ones, so a slow step never holds up a frame
+void update(app_t * app) {
+    if (!app->capture) {
+        renderer_update(app->renderer);
     }
-}
+    sim_frame(app->sim);
 
-void new_geometry(app_t * app) {
-    renderer_clear_vertices(app->renderer);
-    foreach(vec_path_t, &app->paths, it) {
-        path_t *path = it.ref;
-        path_t *last_path = vec_path_t_at(&app->paths, path->last_path);
-        add_cylinder(app->renderer, last_path, path);
+    // T prints the timings so far
+    bool timing_key = glfwGetKey(app->window, GLFW_KEY_T) == GLFW_PRESS;
+    if (timing_key && !app->timing_key) {
+        timing_print(stdout);
     }
-    foreach(vec_tree_t, &app->trees, it) {
-        tree_t *tree = it.ref;
-        renderer_add_contact_shadow(app->renderer, tree->origin, tree->radius);
-    }
-    renderer_add_ground_plane(app->renderer, 60.0f);
-}
-
-void update(app_t * app) {
-    renderer_update(app->renderer);
+    app->timing_key = timing_key;
 
-    if (app->frame % 60 != 0) {
-        return;
+    if (!app->capture && app->frame % 60 == 0) {
+        sim_step(app->sim);
     }
 
-    if (!app->is_growing) {
-        return;
+    mesh_t * mesh = sim_acquire(app->sim);
+    if (mesh) {
+        renderer_upload_vertices(app->renderer, mesh);
+        sim_release(app->sim);
+        app->step_frames = 0;
     }
 
-    timespec_t start = now();
-
-    radial_growth(&app->paths, &app->trees);
-    foreach(vec_tree_t, &app->trees, it) {
-        tree_t *tree = it.ref;
-        tree->has_leader = tree->has_leader && rand_prob(0.98f);
-    }
-    new_paths(&app->paths, &app->trees);
-    new_geometry(app);
-    renderer_upload_vertices(app->renderer);
-    
-    if (elapsed_ns(start) > 1e8) {
-        // stop growing if taking more thn 100ms
-        printf("stopped growing\n");
-        app->is_growing = false;
+    // captured, the time-lapse has the same number of frames a step however
+    // long the steps take, so it plays back faster or slower than real time.
+    // The camera stands still while a step is waited for
+    if (app->capture && app->step_frames < app->frames_per_step) {
+        renderer_update(app->renderer);
+        renderer_capture_frame(app->renderer);
+        if (++app->step_frames == app->frames_per_step) {
+            sim_step(app->sim);
+        }
     }
 }
 
@@ -283,17 +120,117 @@ void render(app_t * app) {
 }
 
 void terminate(app_t *app) {
+    sim_free(&app->sim);
+    forest_print_stats(&app->forest);
+    timing_print(stdout);
+    // the renderer hands over the frames it's still reading back
     renderer_free(&app->renderer);
-    vec_path_t_free(&app->paths);
+    if (app->capture) {
+        printf("captured %zu frames, dropped %zu\n", capture_frames(app->capture),
+            capture_dropped(app->capture));
+        capture_free(&app->capture);
+    }
+    pool_free(&app->pool);
+    forest_free(&app->forest);
+    mesh_free(&app->mesh);
     glfwTerminate();
 }
 
-int main() {
+int main(int argc, char ** argv) {
+    // --instanced draws branches as instances of a unit cylinder, --load
+    // starts from a snapshot, --save writes one on exit, --export writes the
+    // mesh of the grown trees, not their copies, on exit, --budget is the ms
+    // of growth and meshing a frame and --trees the number planted, rounded
+    // down to a square. --templates grows only that many of them and fills
+    // the rest of the forest with copies. --capture records a time-lapse, of
+    // --capture-size, at --frames-per-step frames for each step of growth.
+    // --shadow-depth is how many metres below itself a tip shades
+    bool instanced = false;
+    size_t num_trees = 16;
+    size_t num_templates = 0;
+    double budget = 8.0;
+    const char * load = NULL;
+    const char * save = NULL;
+    const char * export = NULL;
+    const char * capture = NULL;
+    int capture_width = 800;
+    int capture_height = 600;
+    int frames_per_step = 60;
+    float shadow_depth = -1.0f;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--instanced") == 0) {
+            instanced = true;
+        } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            load = argv[++i];
+        } else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            save = argv[++i];
+        } else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+            export = argv[++i];
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            budget = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--trees") == 0 && i + 1 < argc) {
+            num_trees = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--templates") == 0 && i + 1 < argc) {
+            num_templates = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capture = argv[++i];
+        } else if (strcmp(argv[i], "--capture-size") == 0 && i + 1 < argc &&
+                sscanf(argv[i + 1], "%dx%d", &capture_width, &capture_height) == 2 &&
+                capture_width > 0 && capture_height > 0) {
+            i++;
+        } else if (strcmp(argv[i], "--frames-per-step") == 0 && i + 1 < argc &&
+                (frames_per_step = atoi(argv[i + 1])) > 0) {
+            i++;
+        } else if (strcmp(argv[i], "--shadow-depth") == 0 && i + 1 < argc) {
+            shadow_depth = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--instanced] [--load file] [--save file] "
+                "[--export file] [--budget ms] [--trees n] [--templates k] "
+                "[--capture file] [--capture-size WxH] [--frames-per-step n] "
+                "[--shadow-depth m]\n", argv[0]);
+            return 1;
+        }
+    }
     app_t app;
-    init(&app);
+    init(&app, num_trees, num_templates ? num_templates : num_trees, instanced);
+    // snapshots are mapped, which loads them faster than reading
+    if (load && !snapshot_load(&app.forest, load, pool_num_threads(app.pool) * 4, true)) {
+        terminate(&app);
+        return 1;
+    }
+    if (shadow_depth >= 0.0f) {
+        forest_set_shadow_depth(&app.forest, shadow_depth);
+    }
+    if (capture) {
+        app.capture = capture_init(capture, capture_width, capture_height, 60);
+        if (!app.capture) {
+            terminate(&app);
+            return 1;
+        }
+        renderer_set_capture(app.renderer, app.capture);
+        app.frames_per_step = frames_per_step;
+        // nothing is captured until the first step's mesh is uploaded
+        app.step_frames = frames_per_step;
+    }
+    app.sim = sim_init(&app.forest, &app.mesh, app.pool, (uint64_t)(budget * 1e6));
+    if (app.capture) {
+        sim_step(app.sim);
+    }
     while(!should_quit(&app)) {
+        uint64_t start = timing_now();
         update(&app);
         render(&app);
+        timing_record(TIMING_FRAME, start);
+    }
+    // the forest and mesh are the sim thread's until it stops
+    sim_free(&app.sim);
+    if (save) {
+        snapshot_save(&app.forest, save);
+    }
+    if (export) {
+        // the last step may have grown without being meshed
+        new_geometry(&app.forest, &app.mesh);
+        export_mesh(&app.mesh, export);
     }
     terminate(&app);
     return 0;
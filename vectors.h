@@ -0,0 +1,32 @@
+#ifndef VECTORS_H
+#define VECTORS_H
+
+// ctl vectors of the basic types, shared so that each is only instantiated once
+#include "mymath.h"
+
+#define POD
+#define NOT_INTEGRAL
+#define T vec3s
+#include <ctl/vector.h>
+
+#define POD
+#define T float
+#include <ctl/vector.h>
+
+#define POD
+#define T uint8_t
+#include <ctl/vector.h>
+
+#define POD
+#define T uint16_t
+#include <ctl/vector.h>
+
+#define POD
+#define T uint32_t
+#include <ctl/vector.h>
+
+#define POD
+#define T size_t
+#include <ctl/vector.h>
+
+#endif